@@ -26,12 +26,26 @@ project "CpuRaytracer"
    targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
    objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
 
+   filter "options:simd=avx2"
+      vectorextensions "AVX2"
+
+   filter { "options:simd=avx512", "toolset:msc*" }
+      buildoptions { "/arch:AVX512" }
+
+   filter { "options:simd=avx512", "toolset:not msc*" }
+      buildoptions { "-mavx512f" }
+
+   -- GCC and Clang fuse multiplies and adds into FMAs once the target has them (AVX-512 does), and only where the
+   -- optimizer sees both, so the integrators would stop giving the same image. MSVC does not contract by default
+   filter "toolset:not msc*"
+      buildoptions { "-ffp-contract=off" }
+
    filter "system:windows"
       systemversion "latest"
       defines { "WL_PLATFORM_WINDOWS" }
 
    filter "configurations:Debug"
-      defines { "WL_DEBUG" }
+      defines { "WL_DEBUG", "RT_COUNT_ALLOCATIONS=1" }
       runtime "Debug"
       symbols "On"
 
@@ -0,0 +1,519 @@
+#include "BVH.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Hash.h"
+
+// Centroid bins per axis when looking for a split, more bins approach a full SAH sweep but cost build time
+static constexpr uint32_t s_BinCount = 16;
+
+// Little endian, every section starts on a 64 byte boundary so nodes keep their cache line alignment when mapped
+struct BVHFileHeader
+{
+	enum Section
+	{
+		Nodes = 0, Indices, Parents, PrimitiveLeaves, PrimitiveEntries, PrimitiveBounds,
+		SectionCount
+	};
+
+	char Magic[4] = { 'C', 'B', 'V', 'H' };
+	uint32_t Version = BVH::FileVersion;
+	uint64_t Key = 0;
+	uint64_t PayloadHash = 0; // Of every section in order, catches files that were cut short or written over
+
+	uint32_t PrimitiveCount = 0;
+	uint32_t NodeCount = 0;
+
+	double CostSum = 0.0;
+	float BuildCost = 0.0f;
+	float BuildTime = 0.0f;
+
+	// Byte offsets from the start of the file
+	uint64_t Sections[SectionCount] = {};
+};
+
+static uint32_t GetProcessIdentifier()
+{
+#ifdef _WIN32
+	return (uint32_t)_getpid();
+#else
+	return (uint32_t)getpid();
+#endif
+}
+
+static uint64_t AlignSection(uint64_t offset)
+{
+	return (offset + 63) & ~(uint64_t)63;
+}
+
+static uint64_t GetSectionSize(const BVHFileHeader& header, uint32_t section)
+{
+	switch (section)
+	{
+	case BVHFileHeader::Nodes: return (uint64_t)header.NodeCount * sizeof(BVHNode);
+	case BVHFileHeader::Parents: return (uint64_t)header.NodeCount * sizeof(uint32_t);
+	case BVHFileHeader::PrimitiveBounds: return (uint64_t)header.PrimitiveCount * sizeof(AABB);
+	default: return (uint64_t)header.PrimitiveCount * sizeof(uint32_t);
+	}
+}
+
+template<typename T>
+static void CopySection(const MappedFile& file, const BVHFileHeader& header, uint32_t section, std::vector<T>& values)
+{
+	values.resize(GetSectionSize(header, section) / sizeof(T));
+	memcpy(values.data(), file.GetData() + header.Sections[section], values.size() * sizeof(T));
+}
+
+void BVH::Build(const std::vector<AABB>& primitiveBounds)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	Clear();
+
+	uint32_t primitiveCount = (uint32_t)primitiveBounds.size();
+	if (primitiveCount == 0)
+		return;
+
+	m_Indices.resize(primitiveCount);
+	std::iota(m_Indices.begin(), m_Indices.end(), 0u);
+
+	m_Centroids.resize(primitiveCount);
+	for (uint32_t i = 0; i < primitiveCount; i++)
+		m_Centroids[i] = primitiveBounds[i].GetCenter();
+
+	// At most 2N - 1 nodes, slot 1 stays unused so every pair of siblings starts on a 64 byte boundary
+	m_Nodes.resize(primitiveCount * 2 + 1);
+	m_Parents.assign(primitiveCount * 2 + 1, InvalidIndex);
+
+	BVHNode& root = m_Nodes[0];
+	root.LeftFirst = 0;
+	root.Count = primitiveCount;
+	m_NodesUsed = 2;
+
+	UpdateNodeBounds(0, primitiveBounds);
+	Subdivide(0, 0, primitiveBounds);
+
+	m_Nodes.resize(m_NodesUsed);
+	m_Parents.resize(m_NodesUsed);
+	m_Centroids.clear();
+	m_Centroids.shrink_to_fit();
+
+	m_PrimitiveBounds = primitiveBounds;
+	m_PrimitiveLeaves.resize(primitiveCount);
+	m_PrimitiveEntries.resize(primitiveCount);
+	UseOwnedData();
+
+	m_CostSum = 0.0;
+	for (uint32_t i = 0; i < m_NodesUsed; i++)
+	{
+		if (i == 1)
+			continue;
+
+		const BVHNode& node = m_Nodes[i];
+
+		AABB bounds;
+		bounds.Min = node.Min;
+		bounds.Max = node.Max;
+		m_CostSum += bounds.Area() * GetNodeWeight(i);
+
+		if (!node.IsLeaf())
+			continue;
+
+		for (uint32_t entry = node.LeftFirst; entry < node.LeftFirst + node.Count; entry++)
+		{
+			m_PrimitiveLeaves[m_Indices[entry]] = i;
+			m_PrimitiveEntries[m_Indices[entry]] = entry;
+		}
+	}
+
+	m_BuildCost = GetCost();
+	m_RefitCount = 0;
+
+	m_BuildTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void BVH::Clear()
+{
+	m_Nodes.clear();
+	m_Indices.clear();
+	m_Parents.clear();
+	m_PrimitiveBounds.clear();
+	m_PrimitiveLeaves.clear();
+	m_PrimitiveEntries.clear();
+	m_NodesUsed = 0;
+	m_CostSum = 0.0;
+	m_BuildCost = 0.0f;
+	m_RefitCount = 0;
+	m_BuildTime = 0.0f;
+
+	m_File.reset();
+	UseOwnedData();
+}
+
+bool BVH::Save(const std::string& filepath, uint64_t key) const
+{
+	BVHFileHeader header;
+	header.Key = key;
+	header.PrimitiveCount = m_PrimitiveCount;
+	header.NodeCount = m_NodeCount;
+	header.CostSum = m_CostSum;
+	header.BuildCost = m_BuildCost;
+	header.BuildTime = m_BuildTime;
+
+	// Refit data goes along, a loaded hierarchy continues from the bounds it was last fitted to
+	const void* data[BVHFileHeader::SectionCount];
+	if (m_File)
+	{
+		BVHFileHeader mappedHeader;
+		memcpy(&mappedHeader, m_File->GetData(), sizeof(mappedHeader));
+		for (uint32_t section = 0; section < BVHFileHeader::SectionCount; section++)
+			data[section] = m_File->GetData() + mappedHeader.Sections[section];
+	}
+	else
+	{
+		data[BVHFileHeader::Nodes] = m_Nodes.data();
+		data[BVHFileHeader::Indices] = m_Indices.data();
+		data[BVHFileHeader::Parents] = m_Parents.data();
+		data[BVHFileHeader::PrimitiveLeaves] = m_PrimitiveLeaves.data();
+		data[BVHFileHeader::PrimitiveEntries] = m_PrimitiveEntries.data();
+		data[BVHFileHeader::PrimitiveBounds] = m_PrimitiveBounds.data();
+	}
+
+	uint64_t offset = AlignSection(sizeof(BVHFileHeader));
+	for (uint32_t section = 0; section < BVHFileHeader::SectionCount; section++)
+	{
+		header.Sections[section] = offset;
+		offset = AlignSection(offset + GetSectionSize(header, section));
+		header.PayloadHash = HashBytes(data[section], GetSectionSize(header, section), header.PayloadHash);
+	}
+
+	// Written next to the target and renamed over it, so a crash never leaves half a file. The temp name is unique to
+	// this process and save, two writers of the same key (the CLI next to the benchmarks) each rename a whole file
+	static std::atomic<uint32_t> s_SaveCount{ 0 };
+	std::string tempPath = filepath + "." + std::to_string(GetProcessIdentifier()) + "." + std::to_string(s_SaveCount++) + ".tmp";
+	{
+		std::ofstream stream(tempPath, std::ios::binary);
+		if (!stream)
+			return false;
+
+		stream.write((const char*)&header, sizeof(header));
+		for (uint32_t section = 0; section < BVHFileHeader::SectionCount; section++)
+		{
+			static const char zeros[64] = {};
+			stream.write(zeros, header.Sections[section] - (uint64_t)stream.tellp());
+			stream.write((const char*)data[section], GetSectionSize(header, section));
+		}
+
+		if (!stream)
+			return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, filepath, error);
+	if (error)
+	{
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	return true;
+}
+
+bool BVH::Load(const std::string& filepath, uint64_t key, uint32_t primitiveCount)
+{
+	auto file = std::make_shared<MappedFile>();
+	if (!file->Open(filepath))
+		return false;
+
+	BVHFileHeader header;
+	if (file->GetSize() < sizeof(header))
+		return false;
+	memcpy(&header, file->GetData(), sizeof(header));
+
+	if (memcmp(header.Magic, BVHFileHeader().Magic, sizeof(header.Magic)) != 0 || header.Version != FileVersion)
+		return false;
+
+	if (header.Key != key || header.PrimitiveCount != primitiveCount || header.NodeCount == 0)
+		return false;
+
+	for (uint32_t section = 0; section < BVHFileHeader::SectionCount; section++)
+	{
+		uint64_t offset = header.Sections[section];
+		if (offset % 64 != 0 || offset > file->GetSize() || file->GetSize() - offset < GetSectionSize(header, section))
+			return false;
+	}
+
+	// One pass over the file, about what hashing the primitive bounds for the key already cost
+	uint64_t payloadHash = 0;
+	for (uint32_t section = 0; section < BVHFileHeader::SectionCount; section++)
+		payloadHash = HashBytes(file->GetData() + header.Sections[section], GetSectionSize(header, section), payloadHash);
+	if (payloadHash != header.PayloadHash)
+		return false;
+
+	Clear();
+
+	const uint8_t* data = file->GetData();
+	m_NodeData = (const BVHNode*)(data + header.Sections[BVHFileHeader::Nodes]);
+	m_NodeCount = header.NodeCount;
+	m_IndexData = (const uint32_t*)(data + header.Sections[BVHFileHeader::Indices]);
+	m_EntryData = (const uint32_t*)(data + header.Sections[BVHFileHeader::PrimitiveEntries]);
+	m_PrimitiveCount = header.PrimitiveCount;
+
+	m_NodesUsed = header.NodeCount;
+	m_CostSum = header.CostSum;
+	m_BuildCost = header.BuildCost;
+	m_BuildTime = header.BuildTime;
+
+	m_File = file;
+	return true;
+}
+
+void BVH::Detach()
+{
+	if (!m_File)
+		return;
+
+	BVHFileHeader header;
+	memcpy(&header, m_File->GetData(), sizeof(header));
+
+	CopySection(*m_File, header, BVHFileHeader::Nodes, m_Nodes);
+	CopySection(*m_File, header, BVHFileHeader::Indices, m_Indices);
+	CopySection(*m_File, header, BVHFileHeader::Parents, m_Parents);
+	CopySection(*m_File, header, BVHFileHeader::PrimitiveLeaves, m_PrimitiveLeaves);
+	CopySection(*m_File, header, BVHFileHeader::PrimitiveEntries, m_PrimitiveEntries);
+	CopySection(*m_File, header, BVHFileHeader::PrimitiveBounds, m_PrimitiveBounds);
+
+	m_File.reset();
+	UseOwnedData();
+}
+
+void BVH::UseOwnedData()
+{
+	m_NodeData = m_Nodes.data();
+	m_NodeCount = (uint32_t)m_Nodes.size();
+	m_IndexData = m_Indices.data();
+	m_EntryData = m_PrimitiveEntries.data();
+	m_PrimitiveCount = (uint32_t)m_Indices.size();
+}
+
+void BVH::UpdatePrimitive(uint32_t primitive, const AABB& bounds)
+{
+	Detach();
+
+	m_PrimitiveBounds[primitive] = bounds;
+	m_RefitCount++;
+
+	uint32_t nodeIndex = m_PrimitiveLeaves[primitive];
+	while (nodeIndex != InvalidIndex)
+	{
+		BVHNode& node = m_Nodes[nodeIndex];
+
+		AABB newBounds;
+		if (node.IsLeaf())
+		{
+			for (uint32_t i = 0; i < node.Count; i++)
+				newBounds.Grow(m_PrimitiveBounds[m_Indices[node.LeftFirst + i]]);
+		}
+		else
+		{
+			const BVHNode& left = m_Nodes[node.LeftFirst];
+			const BVHNode& right = m_Nodes[node.LeftFirst + 1];
+			newBounds.Grow(left.Min);
+			newBounds.Grow(left.Max);
+			newBounds.Grow(right.Min);
+			newBounds.Grow(right.Max);
+		}
+
+		// Nothing further up can change either
+		if (newBounds.Min == node.Min && newBounds.Max == node.Max)
+			break;
+
+		AABB oldBounds;
+		oldBounds.Min = node.Min;
+		oldBounds.Max = node.Max;
+		m_CostSum += (newBounds.Area() - oldBounds.Area()) * GetNodeWeight(nodeIndex);
+
+		node.Min = newBounds.Min;
+		node.Max = newBounds.Max;
+
+		nodeIndex = m_Parents[nodeIndex];
+	}
+}
+
+float BVH::GetCost() const
+{
+	if (m_NodeCount == 0)
+		return 0.0f;
+
+	AABB rootBounds;
+	rootBounds.Min = m_NodeData[0].Min;
+	rootBounds.Max = m_NodeData[0].Max;
+
+	float rootArea = rootBounds.Area();
+	return rootArea > 0.0f ? (float)(m_CostSum / rootArea) : 0.0f;
+}
+
+float BVH::GetNodeWeight(uint32_t nodeIndex) const
+{
+	const BVHNode& node = m_NodeData[nodeIndex];
+	return node.IsLeaf() ? (float)node.Count : TraversalCost;
+}
+
+void BVH::UpdateNodeBounds(uint32_t nodeIndex, const std::vector<AABB>& primitiveBounds)
+{
+	BVHNode& node = m_Nodes[nodeIndex];
+
+	AABB bounds;
+	for (uint32_t i = 0; i < node.Count; i++)
+		bounds.Grow(primitiveBounds[m_Indices[node.LeftFirst + i]]);
+
+	node.Min = bounds.Min;
+	node.Max = bounds.Max;
+}
+
+void BVH::Subdivide(uint32_t nodeIndex, uint32_t depth, const std::vector<AABB>& primitiveBounds)
+{
+	BVHNode& node = m_Nodes[nodeIndex];
+
+	// Traversal stacks are MaxDepth deep, anything left at the bottom stays in one leaf
+	if (node.Count <= 1 || depth + 1 >= MaxDepth)
+		return;
+
+	int axis;
+	uint32_t splitBin;
+	float binScale, binMin;
+	float splitCost = FindBestSplit(node, primitiveBounds, axis, splitBin, binScale, binMin);
+
+	AABB bounds;
+	bounds.Min = node.Min;
+	bounds.Max = node.Max;
+
+	// Splitting has to beat testing every primitive of this node, visiting the node itself included
+	float leafCost = (float)node.Count * bounds.Area();
+	if (TraversalCost * bounds.Area() + splitCost >= leafCost)
+		return;
+
+	// Partition with the exact same binning the split was evaluated with
+	uint32_t i = node.LeftFirst;
+	uint32_t j = i + node.Count - 1;
+	while (i <= j)
+	{
+		uint32_t bin = glm::min(s_BinCount - 1, (uint32_t)((m_Centroids[m_Indices[i]][axis] - binMin) * binScale));
+		if (bin <= splitBin)
+		{
+			i++;
+		}
+		else
+		{
+			std::swap(m_Indices[i], m_Indices[j]);
+			if (j == 0)
+				break;
+			j--;
+		}
+	}
+
+	uint32_t leftCount = i - node.LeftFirst;
+	if (leftCount == 0 || leftCount == node.Count)
+		return;
+
+	uint32_t leftChild = m_NodesUsed++;
+	uint32_t rightChild = m_NodesUsed++;
+
+	m_Nodes[leftChild].LeftFirst = node.LeftFirst;
+	m_Nodes[leftChild].Count = leftCount;
+	m_Nodes[rightChild].LeftFirst = i;
+	m_Nodes[rightChild].Count = node.Count - leftCount;
+
+	node.LeftFirst = leftChild;
+	node.Count = 0;
+
+	m_Parents[leftChild] = nodeIndex;
+	m_Parents[rightChild] = nodeIndex;
+
+	UpdateNodeBounds(leftChild, primitiveBounds);
+	UpdateNodeBounds(rightChild, primitiveBounds);
+
+	Subdivide(leftChild, depth + 1, primitiveBounds);
+	Subdivide(rightChild, depth + 1, primitiveBounds);
+}
+
+float BVH::FindBestSplit(const BVHNode& node, const std::vector<AABB>& primitiveBounds, int& axis, uint32_t& splitBin, float& binScale, float& binMin) const
+{
+	float bestCost = std::numeric_limits<float>::max();
+
+	// Bins are spread over the centroid bounds, not the node bounds, so big primitives do not squash them together
+	AABB centroidBounds;
+	for (uint32_t i = 0; i < node.Count; i++)
+		centroidBounds.Grow(m_Centroids[m_Indices[node.LeftFirst + i]]);
+
+	for (int a = 0; a < 3; a++)
+	{
+		float boundsMin = centroidBounds.Min[a], boundsMax = centroidBounds.Max[a];
+		if (boundsMin == boundsMax)
+			continue;
+
+		struct Bin
+		{
+			AABB Bounds;
+			uint32_t Count = 0;
+		} bins[s_BinCount];
+
+		float scale = (float)s_BinCount / (boundsMax - boundsMin);
+
+		for (uint32_t i = 0; i < node.Count; i++)
+		{
+			uint32_t primitive = m_Indices[node.LeftFirst + i];
+			uint32_t bin = glm::min(s_BinCount - 1, (uint32_t)((m_Centroids[primitive][a] - boundsMin) * scale));
+
+			// Centroids pick the bin, but the SAH needs the real extent of every primitive
+			bins[bin].Count++;
+			bins[bin].Bounds.Grow(primitiveBounds[primitive]);
+		}
+
+		// Sweep from both ends, plane i sits between bin i and bin i + 1
+		float leftArea[s_BinCount - 1], rightArea[s_BinCount - 1];
+		uint32_t leftCount[s_BinCount - 1], rightCount[s_BinCount - 1];
+
+		AABB leftBounds, rightBounds;
+		uint32_t leftSum = 0, rightSum = 0;
+
+		for (uint32_t i = 0; i < s_BinCount - 1; i++)
+		{
+			leftSum += bins[i].Count;
+			leftCount[i] = leftSum;
+			leftBounds.Grow(bins[i].Bounds);
+			leftArea[i] = leftBounds.Area();
+
+			rightSum += bins[s_BinCount - 1 - i].Count;
+			rightCount[s_BinCount - 2 - i] = rightSum;
+			rightBounds.Grow(bins[s_BinCount - 1 - i].Bounds);
+			rightArea[s_BinCount - 2 - i] = rightBounds.Area();
+		}
+
+		for (uint32_t i = 0; i < s_BinCount - 1; i++)
+		{
+			float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+			if (leftCount[i] > 0 && rightCount[i] > 0 && cost < bestCost)
+			{
+				bestCost = cost;
+				axis = a;
+				splitBin = i;
+				binScale = scale;
+				binMin = boundsMin;
+			}
+		}
+	}
+
+	return bestCost;
+}
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "MappedFile.h"
+#include "Ray.h"
+#include "Simd.h"
+
+struct AABB
+{
+	glm::vec3 Min{ std::numeric_limits<float>::max() };
+	glm::vec3 Max{ std::numeric_limits<float>::lowest() };
+
+	void Grow(const glm::vec3& point) { Min = glm::min(Min, point); Max = glm::max(Max, point); }
+	void Grow(const AABB& other) { Min = glm::min(Min, other.Min); Max = glm::max(Max, other.Max); }
+
+	glm::vec3 GetCenter() const { return (Min + Max) * 0.5f; }
+
+	float Area() const
+	{
+		glm::vec3 extent = Max - Min;
+		if (extent.x < 0.0f)
+			return 0.0f;
+
+		return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+	}
+};
+
+// 32 bytes, so a pair of siblings shares one cache line.
+// Interior nodes point to their first child (the second one follows it), leaves to their first entry in the index list
+struct alignas(32) BVHNode
+{
+	glm::vec3 Min;
+	uint32_t LeftFirst;
+	glm::vec3 Max;
+	uint32_t Count; // Primitives in a leaf, 0 for interior nodes
+
+	bool IsLeaf() const { return Count > 0; }
+};
+
+// Counted per worker while tracing and summed once the frame is done
+struct TraversalStats
+{
+	uint64_t Rays = 0;
+	uint64_t SecondaryRays = 0; // Bounces, the rest of Rays are primary
+	uint64_t Misses = 0;
+	uint64_t NodesVisited = 0;
+	uint64_t LeavesTested = 0;
+	uint64_t PrimitivesTested = 0;
+
+	// Pixels traced, fewer than the frame has once adaptive sampling lets converged ones skip
+	uint64_t Samples = 0;
+
+	// Wavefront only. Secondary packets traced and the sum of their direction coherence, the length of the mean direction
+	// of their lanes: 1 when every lane heads the same way, near 0 when they scatter. Divide for the average
+	uint64_t SecondaryPackets = 0;
+	double DirectionCoherence = 0.0;
+
+	TraversalStats& operator+=(const TraversalStats& other)
+	{
+		Rays += other.Rays;
+		SecondaryRays += other.SecondaryRays;
+		Misses += other.Misses;
+		NodesVisited += other.NodesVisited;
+		LeavesTested += other.LeavesTested;
+		PrimitivesTested += other.PrimitivesTested;
+		Samples += other.Samples;
+		SecondaryPackets += other.SecondaryPackets;
+		DirectionCoherence += other.DirectionCoherence;
+		return *this;
+	}
+};
+
+// Bounding volume hierarchy built with binned SAH over the bounds of any kind of primitive.
+// Leaves reference a range of GetIndices(), which maps back to the primitive order the bounds were given in
+class BVH
+{
+public:
+	static constexpr uint32_t MaxDepth = 64;
+
+	// Surface area heuristic weight of visiting an inner node, in primitive tests. Splits have to save more than this
+	// over testing everything in one leaf, and GetCost() weighs inner nodes with it too. Leaves are tested a SIMD
+	// width at a time, anything from 4 to 16 was about the same in the Render benchmarks and far ahead of 1
+	static constexpr float TraversalCost = 8.0f;
+
+	static constexpr uint32_t InvalidIndex = 0xffffffff;
+
+	// Bump it whenever the builder or the file layout changes, older files are then rejected
+	static constexpr uint32_t FileVersion = 3;
+
+	void Build(const std::vector<AABB>& primitiveBounds);
+	void Clear();
+
+	// The whole hierarchy including its refit data, tagged with key so Load can tell whether it still fits the scene
+	bool Save(const std::string& filepath, uint64_t key) const;
+
+	// Maps a file written by Save and traverses it in place, fails if it is not for key and primitiveCount or its
+	// sections do not match the hash Save stored. Nothing is copied until the first UpdatePrimitive
+	bool Load(const std::string& filepath, uint64_t key, uint32_t primitiveCount);
+
+	bool IsMapped() const { return m_File != nullptr; }
+
+	// Refits the leaf holding primitive and its ancestors bottom-up, stopping as soon as a node's bounds do not change.
+	// The topology stays the same, so quality drops as primitives move away from where they were built, see GetCostRatio
+	void UpdatePrimitive(uint32_t primitive, const AABB& bounds);
+
+	bool IsEmpty() const { return m_NodeCount == 0; }
+
+	const BVHNode* GetNodes() const { return m_NodeData; }
+	uint32_t GetNodeCount() const { return m_NodeCount; }
+
+	// Primitive indices in leaf order, GetPrimitiveCount() of them
+	const uint32_t* GetIndices() const { return m_IndexData; }
+	uint32_t GetPrimitiveCount() const { return m_PrimitiveCount; }
+
+	// Position of a primitive in GetIndices(), for data kept in leaf order
+	uint32_t GetEntry(uint32_t primitive) const { return m_EntryData[primitive]; }
+
+	float GetBuildTime() const { return m_BuildTime; } // ms
+
+	// Expected cost of a random ray relative to testing a single primitive, lower is better. Kept up to date while refitting
+	float GetCost() const;
+	// Current cost over the cost right after the last build, 1 for a fresh tree
+	float GetCostRatio() const { return m_BuildCost > 0.0f ? GetCost() / m_BuildCost : 1.0f; }
+
+	uint32_t GetRefitCount() const { return m_RefitCount; }
+
+	// Ordered closest hit traversal. intersectLeaf(first, count, hitDistance) tests the leaf entries and shrinks hitDistance on closer hits
+	template<typename LeafFunc>
+	void Traverse(const Ray& ray, float& hitDistance, LeafFunc&& intersectLeaf, TraversalStats& stats) const;
+
+	// Same for Simd::Width rays. intersectLeaf(first, count, active, hitDistances) only needs to update the active lanes
+	template<typename LeafFunc>
+	void Traverse(const RayPacket& packet, Simd::Mask active, Simd::Float& hitDistances, LeafFunc&& intersectLeaf, TraversalStats& stats) const;
+
+private:
+	// Copies a mapped hierarchy into the vectors below and drops the mapping
+	void Detach();
+	void UseOwnedData();
+
+	void UpdateNodeBounds(uint32_t nodeIndex, const std::vector<AABB>& primitiveBounds);
+	float GetNodeWeight(uint32_t nodeIndex) const;
+	void Subdivide(uint32_t nodeIndex, uint32_t depth, const std::vector<AABB>& primitiveBounds);
+	float FindBestSplit(const BVHNode& node, const std::vector<AABB>& primitiveBounds, int& axis, uint32_t& splitBin, float& binScale, float& binMin) const;
+
+	static float IntersectAABB(const Ray& ray, const glm::vec3& inverseDirection, const BVHNode& node, float hitDistance);
+	static Simd::Mask IntersectAABB(const RayPacket& packet, const Simd::Float* inverseDirection, const BVHNode& node, const Simd::Float& hitDistances, Simd::Float& entry);
+
+private:
+	std::vector<BVHNode> m_Nodes;
+	std::vector<uint32_t> m_Indices;
+	std::vector<glm::vec3> m_Centroids; // Build time only
+	uint32_t m_NodesUsed = 0;
+
+	// Refit data, primitives know their leaf and nodes their parent
+	std::vector<AABB> m_PrimitiveBounds;
+	std::vector<uint32_t> m_PrimitiveLeaves;
+	std::vector<uint32_t> m_PrimitiveEntries;
+	std::vector<uint32_t> m_Parents;
+
+	// Sum of node area times node weight, divided by the root area it is the SAH cost
+	double m_CostSum = 0.0;
+	float m_BuildCost = 0.0f;
+	uint32_t m_RefitCount = 0;
+
+	float m_BuildTime = 0.0f;
+
+	// What traversal reads, either the vectors above or a mapped file
+	const BVHNode* m_NodeData = nullptr;
+	uint32_t m_NodeCount = 0;
+	const uint32_t* m_IndexData = nullptr;
+	const uint32_t* m_EntryData = nullptr;
+	uint32_t m_PrimitiveCount = 0;
+	std::shared_ptr<const MappedFile> m_File;
+};
+
+// The slab distances are rounded, a ray grazing a box face could come out with its exit just before its entry and skip
+// a leaf holding the triangle it really hits. Pushing the exit out by the worst case error keeps that from happening (Ize 2013)
+static constexpr float s_SlabExitScale = 1.0f + 2.0f * (3.0f * 5.96046448e-8f / (1.0f - 3.0f * 5.96046448e-8f));
+
+inline float BVH::IntersectAABB(const Ray& ray, const glm::vec3& inverseDirection, const BVHNode& node, float hitDistance)
+{
+	// Slab test, returns the entry distance or max float when the box is missed or behind the current hit
+	glm::vec3 t1 = (node.Min - ray.Origin) * inverseDirection;
+	glm::vec3 t2 = (node.Max - ray.Origin) * inverseDirection;
+
+	glm::vec3 tNear = glm::min(t1, t2);
+	glm::vec3 tFar = glm::max(t1, t2);
+
+	float tMin = glm::max(glm::max(tNear.x, tNear.y), tNear.z);
+	float tMax = glm::min(glm::min(tFar.x, tFar.y), tFar.z) * s_SlabExitScale;
+
+	if (tMax >= tMin && tMin < hitDistance && tMax > 0.0f)
+		return tMin;
+
+	return std::numeric_limits<float>::max();
+}
+
+inline Simd::Mask BVH::IntersectAABB(const RayPacket& packet, const Simd::Float* inverseDirection, const BVHNode& node, const Simd::Float& hitDistances, Simd::Float& entry)
+{
+	Simd::Float x1 = (Simd::Float(node.Min.x) - packet.OriginX) * inverseDirection[0];
+	Simd::Float x2 = (Simd::Float(node.Max.x) - packet.OriginX) * inverseDirection[0];
+	Simd::Float y1 = (Simd::Float(node.Min.y) - packet.OriginY) * inverseDirection[1];
+	Simd::Float y2 = (Simd::Float(node.Max.y) - packet.OriginY) * inverseDirection[1];
+	Simd::Float z1 = (Simd::Float(node.Min.z) - packet.OriginZ) * inverseDirection[2];
+	Simd::Float z2 = (Simd::Float(node.Max.z) - packet.OriginZ) * inverseDirection[2];
+
+	Simd::Float tMin = Simd::Max(Simd::Max(Simd::Min(x1, x2), Simd::Min(y1, y2)), Simd::Min(z1, z2));
+	Simd::Float tMax = Simd::Min(Simd::Min(Simd::Max(x1, x2), Simd::Max(y1, y2)), Simd::Max(z1, z2)) * s_SlabExitScale;
+
+	entry = tMin;
+	return (tMax >= tMin) & (tMin < hitDistances) & (tMax > 0.0f);
+}
+
+template<typename LeafFunc>
+void BVH::Traverse(const Ray& ray, float& hitDistance, LeafFunc&& intersectLeaf, TraversalStats& stats) const
+{
+	if (m_NodeCount == 0)
+		return;
+
+	constexpr float miss = std::numeric_limits<float>::max();
+	glm::vec3 inverseDirection = 1.0f / ray.Direction;
+
+	if (IntersectAABB(ray, inverseDirection, m_NodeData[0], hitDistance) == miss)
+		return;
+
+	// Far children wait on the stack with their entry distance, so they can be skipped once a closer hit shows up
+	std::pair<const BVHNode*, float> stack[MaxDepth];
+	uint32_t stackSize = 0;
+
+	// Skips far children that can no longer hold a closer hit
+	auto pop = [&]() -> const BVHNode*
+	{
+		while (stackSize > 0)
+		{
+			stackSize--;
+			if (stack[stackSize].second < hitDistance)
+				return stack[stackSize].first;
+		}
+		return nullptr;
+	};
+
+	const BVHNode* node = &m_NodeData[0];
+
+	while (true)
+	{
+		stats.NodesVisited++;
+
+		if (node->IsLeaf())
+		{
+			stats.LeavesTested++;
+			stats.PrimitivesTested += node->Count;
+			intersectLeaf(node->LeftFirst, node->Count, hitDistance);
+
+			node = pop();
+			if (!node)
+				break;
+
+			continue;
+		}
+
+		const BVHNode* nearChild = &m_NodeData[node->LeftFirst];
+		const BVHNode* farChild = nearChild + 1;
+
+		float nearDistance = IntersectAABB(ray, inverseDirection, *nearChild, hitDistance);
+		float farDistance = IntersectAABB(ray, inverseDirection, *farChild, hitDistance);
+
+		if (nearDistance > farDistance)
+		{
+			std::swap(nearChild, farChild);
+			std::swap(nearDistance, farDistance);
+		}
+
+		if (nearDistance == miss)
+		{
+			node = pop();
+			if (!node)
+				break;
+
+			continue;
+		}
+
+		node = nearChild;
+		if (farDistance != miss)
+			stack[stackSize++] = { farChild, farDistance };
+	}
+}
+
+template<typename LeafFunc>
+void BVH::Traverse(const RayPacket& packet, Simd::Mask active, Simd::Float& hitDistances, LeafFunc&& intersectLeaf, TraversalStats& stats) const
+{
+	if (m_NodeCount == 0)
+		return;
+
+	const Simd::Float one = 1.0f;
+	Simd::Float inverseDirection[3] = { one / packet.DirectionX, one / packet.DirectionY, one / packet.DirectionZ };
+
+	// Nodes are (re)tested against the whole packet when popped, any active lane hitting them keeps them alive
+	uint32_t stack[MaxDepth];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const BVHNode& node = m_NodeData[stack[--stackSize]];
+
+		Simd::Float entry;
+		Simd::Mask hit = active & IntersectAABB(packet, inverseDirection, node, hitDistances, entry);
+		if (!Simd::Any(hit))
+			continue;
+
+		stats.NodesVisited++;
+
+		if (node.IsLeaf())
+		{
+			stats.LeavesTested++;
+			stats.PrimitivesTested += node.Count;
+			intersectLeaf(node.LeftFirst, node.Count, hit, hitDistances);
+			continue;
+		}
+
+		// Go down the child the packet reaches first, the other one waits on the stack
+		Simd::Float nearEntry, farEntry;
+		Simd::Mask nearHit = active & IntersectAABB(packet, inverseDirection, m_NodeData[node.LeftFirst], hitDistances, nearEntry);
+		Simd::Mask farHit = active & IntersectAABB(packet, inverseDirection, m_NodeData[node.LeftFirst + 1], hitDistances, farEntry);
+
+		constexpr float miss = std::numeric_limits<float>::max();
+		float nearDistance = Simd::HorizontalMin(Simd::Select(nearHit, nearEntry, miss));
+		float farDistance = Simd::HorizontalMin(Simd::Select(farHit, farEntry, miss));
+
+		uint32_t nearIndex = node.LeftFirst, farIndex = node.LeftFirst + 1;
+		if (nearDistance > farDistance)
+		{
+			std::swap(nearIndex, farIndex);
+			std::swap(nearHit, farHit);
+		}
+
+		if (Simd::Any(farHit))
+			stack[stackSize++] = farIndex;
+		if (Simd::Any(nearHit))
+			stack[stackSize++] = nearIndex;
+	}
+}
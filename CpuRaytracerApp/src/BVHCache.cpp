@@ -0,0 +1,57 @@
+#include "BVHCache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+
+#include "Hash.h"
+
+bool BVHCache::LoadOrBuild(BVH& bvh, const std::vector<AABB>& primitiveBounds)
+{
+	if (!IsEnabled((uint32_t)primitiveBounds.size()))
+	{
+		bvh.Build(primitiveBounds);
+		return false;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	uint64_t key = Hash(primitiveBounds);
+	std::string path = GetPath(key);
+
+	auto hashed = std::chrono::high_resolution_clock::now();
+	m_Stats.HashTime = std::chrono::duration<float, std::milli>(hashed - start).count();
+
+	m_Stats.LastHit = bvh.Load(path, key, (uint32_t)primitiveBounds.size());
+	m_Stats.LoadTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - hashed).count();
+
+	if (m_Stats.LastHit)
+	{
+		m_Stats.Hits++;
+		return true;
+	}
+
+	m_Stats.Misses++;
+	bvh.Build(primitiveBounds);
+
+	// A failed save only costs the next run another build
+	std::error_code error;
+	std::filesystem::create_directories(m_Directory, error);
+	if (!bvh.Save(path, key))
+		std::cerr << "Could not write BVH cache file " << path << std::endl;
+
+	return false;
+}
+
+uint64_t BVHCache::Hash(const std::vector<AABB>& primitiveBounds)
+{
+	return HashBytes(primitiveBounds.data(), primitiveBounds.size() * sizeof(AABB), BVH::FileVersion);
+}
+
+std::string BVHCache::GetPath(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)key);
+	return (std::filesystem::path(m_Directory) / name).string();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BVH.h"
+
+struct BVHCacheStats
+{
+	uint32_t Hits = 0;
+	uint32_t Misses = 0;
+
+	// Of the last LoadOrBuild, in ms
+	bool LastHit = false;
+	float HashTime = 0.0f;
+	float LoadTime = 0.0f;
+};
+
+// Built hierarchies on disk, one file per set of primitive bounds. The key is a hash of exactly what Build reads
+// plus BVH::FileVersion, so any change to the scene or the builder misses instead of loading a stale tree
+class BVHCache
+{
+public:
+	// Empty disables the cache, the directory is created on the first save
+	void SetDirectory(const std::string& directory) { m_Directory = directory; }
+	const std::string& GetDirectory() const { return m_Directory; }
+
+	// Small scenes build faster than they hash and load, they never touch the disk
+	void SetMinPrimitiveCount(uint32_t count) { m_MinPrimitiveCount = count; }
+
+	bool IsEnabled(uint32_t primitiveCount) const { return !m_Directory.empty() && primitiveCount >= m_MinPrimitiveCount; }
+
+	// Loads the hierarchy for primitiveBounds if there is one, otherwise builds and stores it. True on a hit
+	bool LoadOrBuild(BVH& bvh, const std::vector<AABB>& primitiveBounds);
+
+	static uint64_t Hash(const std::vector<AABB>& primitiveBounds);
+
+	const BVHCacheStats& GetStats() const { return m_Stats; }
+
+private:
+	std::string GetPath(uint64_t key) const;
+
+private:
+	std::string m_Directory;
+	uint32_t m_MinPrimitiveCount = 1 << 16;
+
+	BVHCacheStats m_Stats;
+};
@@ -1,15 +1,9 @@
 #include "Camera.h"
 
 #include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtc/quaternion.hpp>
-#include <glm/gtx/quaternion.hpp>
-
-#include "Walnut/Input/Input.h"
 
 #include <iostream>
 
-using namespace Walnut;
-
 Camera::Camera(float verticalFOV, float nearClip, float farClip)
 	: m_VerticalFOV(verticalFOV), m_NearClip(nearClip), m_FarClip(farClip)
 {
@@ -17,78 +11,24 @@ Camera::Camera(float verticalFOV, float nearClip, float farClip)
 	m_Position = glm::vec3(0, 0, 1);
 }
 
-void Camera::OnUpdate(float ts)
+void Camera::SetView(const glm::vec3& position, const glm::vec3& direction)
 {
-	glm::vec2 mousePos = Input::GetMousePosition();
-	glm::vec2 delta = (mousePos - m_LastMousePosition) * 0.002f;
-	m_LastMousePosition = mousePos;
-
-	bool moved = false;
-
-	constexpr glm::vec3 upDirection(0.0f, 1.0f, 0.0f);
-	glm::vec3 rightDirection = glm::cross(m_ForwardDirection, upDirection);
-
-	float speed = 5.0f;
-
-	if (Input::IsMouseButtonDown(MouseButton::Right))
-	{
-		Input::SetCursorMode(CursorMode::Locked);
-
-		// Rotation
-		if (delta.x != 0.0f || delta.y != 0.0f)
-		{
-			float pitchDelta = delta.y * GetRotationSpeed();
-			float yawDelta = delta.x * GetRotationSpeed();
-
-			glm::quat q = glm::normalize(glm::cross(glm::angleAxis(-pitchDelta, rightDirection), glm::angleAxis(-yawDelta, glm::vec3(0.f, 1.0f, 0.0f))));
-			m_ForwardDirection = glm::rotate(q, m_ForwardDirection);
-
-			moved = true;
-		}
-
-	}
+	m_Position = position;
+	m_ForwardDirection = glm::normalize(direction);
 
-	Input::SetCursorMode(CursorMode::Normal);
+	RecalculateView();
+	RecalculateRayDirections();
+}
 
-	// Movement
-	if (Input::IsKeyDown(KeyCode::W))
-	{
-		m_Position += m_ForwardDirection * speed * ts;
-		moved = true;
-	}
-	else if (Input::IsKeyDown(KeyCode::S))
-	{
-		m_Position -= m_ForwardDirection * speed * ts;
-		moved = true;
-	}
-	if (Input::IsKeyDown(KeyCode::A))
-	{
-		m_Position -= rightDirection * speed * ts;
-		moved = true;
-	}
-	else if (Input::IsKeyDown(KeyCode::D))
-	{
-		m_Position += rightDirection * speed * ts;
-		moved = true;
-	}
-	if (Input::IsKeyDown(KeyCode::Q))
-	{
-		m_Position -= upDirection * speed * ts;
-		moved = true;
-	}
-	else if (Input::IsKeyDown(KeyCode::E))
-	{
-		m_Position += upDirection * speed * ts;
-		moved = true;
-	}
+void Camera::SetVerticalFOV(float verticalFOV)
+{
+	m_VerticalFOV = verticalFOV;
 
-	if (moved)
-	{
-		RecalculateView();
-		RecalculateRayDirections();
-	}
+	if (m_ViewportWidth == 0 || m_ViewportHeight == 0)
+		return;
 
-	return;
+	RecalculateProjection();
+	RecalculateRayDirections();
 }
 
 void Camera::OnResize(uint32_t width, uint32_t height)
@@ -112,28 +52,58 @@ void Camera::RecalculateProjection()
 {
 	m_Projection = glm::perspectiveFov(glm::radians(m_VerticalFOV), (float)m_ViewportWidth, (float)m_ViewportHeight, m_NearClip, m_FarClip);
 	m_InverseProjection = glm::inverse(m_Projection);
+	m_Version++;
+}
+
+void Camera::SetRayDirectionCaching(bool enabled)
+{
+	if (enabled == m_CacheRayDirections)
+		return;
+
+	m_CacheRayDirections = enabled;
+
+	if (m_CacheRayDirections)
+	{
+		RecalculateRayDirections();
+	}
+	else
+	{
+		m_RayDirections.Release();
+	}
 }
 
 void Camera::RecalculateView()
 {
 	m_View = glm::lookAt(m_Position, m_Position + m_ForwardDirection, glm::vec3(0, 1, 0));
 	m_InverseView = glm::inverse(m_View);
+	m_Version++;
+
+	// Same basis lookAt builds the view from
+	m_RightDirection = glm::normalize(glm::cross(m_ForwardDirection, glm::vec3(0, 1, 0)));
+	m_UpDirection = glm::cross(m_RightDirection, m_ForwardDirection);
 }
 
 void Camera::RecalculateRayDirections()
 {
-	m_RayDirections.resize(m_ViewportWidth * m_ViewportHeight);
+	if (!m_CacheRayDirections)
+		return;
+
+	m_RayDirections.Resize((size_t)m_ViewportWidth * m_ViewportHeight);
 
 	for (uint32_t y = 0; y < m_ViewportHeight; y++)
 	{
 		for (uint32_t x = 0; x < m_ViewportWidth; x++)
 		{
-			glm::vec2 coord = { (float)x / (float)m_ViewportWidth, (float)y / (float)m_ViewportHeight };
-			coord = coord * 2.0f - 1.0f; // -1 -> 1
-
-			glm::vec4 target = m_InverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
-			glm::vec3 rayDirection = glm::vec3(m_InverseView * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0)); // World space
-			m_RayDirections[x + y * m_ViewportWidth] = rayDirection;
+			m_RayDirections[x + y * m_ViewportWidth] = CalculateRayDirection({ (float)x, (float)y });
 		}
 	}
+}
+
+glm::vec3 Camera::CalculateRayDirection(const glm::vec2& pixel) const
+{
+	glm::vec2 coord = { pixel.x / (float)m_ViewportWidth, pixel.y / (float)m_ViewportHeight };
+	coord = coord * 2.0f - 1.0f; // -1 -> 1
+
+	glm::vec4 target = m_InverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
+	return glm::vec3(m_InverseView * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0)); // World space
 }
\ No newline at end of file
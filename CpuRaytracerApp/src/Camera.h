@@ -1,16 +1,21 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <vector>
+
+#include "Memory.h"
 
 class Camera
 {
 public:
 	Camera(float verticalFOV, float nearClip, float farClip);
 
-	void OnUpdate(float ts);
+	// Returns true if the camera moved, so accumulated frames can be thrown away (CameraInput.cpp)
+	bool OnUpdate(float ts);
 	void OnResize(uint32_t width, uint32_t height);
 
+	void SetView(const glm::vec3& position, const glm::vec3& direction);
+	void SetVerticalFOV(float verticalFOV);
+
 	const glm::mat4& GetProjection() const { return m_Projection; }
 	const glm::mat4& GetInverseProjection() const { return m_InverseProjection; }
 	const glm::mat4& GetView() const { return m_View; }
@@ -18,10 +23,30 @@ public:
 
 	const glm::vec3& GetPosition() const { return m_Position; }
 	const glm::vec3& GetDirection() const { return m_ForwardDirection; }
+	const glm::vec3& GetRightDirection() const { return m_RightDirection; }
+	const glm::vec3& GetUpDirection() const { return m_UpDirection; }
+	float GetVerticalFOV() const { return m_VerticalFOV; }
+
+	uint32_t GetViewportWidth() const { return m_ViewportWidth; }
+	uint32_t GetViewportHeight() const { return m_ViewportHeight; }
+
+	// Goes up whenever the view or projection is recalculated, copies keep it
+	uint64_t GetVersion() const { return m_Version; }
+
+	// Empty while caching is off, CalculateRayDirection gives the same directions bit for bit
+	const PixelBuffer<glm::vec3>& GetRayDirections() const { return m_RayDirections; }
 
-	const std::vector<glm::vec3>& GetRayDirections() const { return m_RayDirections; }
+	// The cache is 12 bytes per pixel and rebuilt on every move, renderers generating rays from the basis do not need it
+	void SetRayDirectionCaching(bool enabled);
+	bool IsRayDirectionCaching() const { return m_CacheRayDirections; }
+
+	// World space direction through a point of the viewport given in pixels (not cached, fractional pixels allowed)
+	glm::vec3 CalculateRayDirection(const glm::vec2& pixel) const;
 
 	float GetRotationSpeed();
+
+	// CpuRaytracerBench times RecalculateRayDirections directly
+	friend struct BenchmarkAccess;
 private:
 	void RecalculateProjection();
 	void RecalculateView();
@@ -39,10 +64,17 @@ private:
 	glm::vec3 m_Position{ 0.0f, 0.0f, 0.0f };
 	glm::vec3 m_ForwardDirection{ 0.0f, 0.0f, 0.0f };
 
-	// Cached ray directions
-	std::vector<glm::vec3> m_RayDirections;
+	// Orthonormal basis of the view, matches m_View
+	glm::vec3 m_RightDirection{ 1.0f, 0.0f, 0.0f };
+	glm::vec3 m_UpDirection{ 0.0f, 1.0f, 0.0f };
+
+	// Cached ray directions, the buffer is kept while the viewport shrinks
+	PixelBuffer<glm::vec3> m_RayDirections;
+	bool m_CacheRayDirections = true;
 
 	glm::vec2 m_LastMousePosition{ 0.0f, 0.0f };
 
 	uint32_t m_ViewportWidth = 0, m_ViewportHeight = 0;
+
+	uint64_t m_Version = 0;
 };
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "Camera.h"
+
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include "Walnut/Input/Input.h"
+
+using namespace Walnut;
+
+// Kept apart from Camera.cpp, so headless builds can use the camera without Walnut's input
+
+bool Camera::OnUpdate(float ts)
+{
+	glm::vec2 mousePos = Input::GetMousePosition();
+	glm::vec2 delta = (mousePos - m_LastMousePosition) * 0.002f;
+	m_LastMousePosition = mousePos;
+
+	bool moved = false;
+
+	constexpr glm::vec3 upDirection(0.0f, 1.0f, 0.0f);
+	glm::vec3 rightDirection = glm::cross(m_ForwardDirection, upDirection);
+
+	float speed = 5.0f;
+
+	if (Input::IsMouseButtonDown(MouseButton::Right))
+	{
+		Input::SetCursorMode(CursorMode::Locked);
+
+		// Rotation
+		if (delta.x != 0.0f || delta.y != 0.0f)
+		{
+			float pitchDelta = delta.y * GetRotationSpeed();
+			float yawDelta = delta.x * GetRotationSpeed();
+
+			glm::quat q = glm::normalize(glm::cross(glm::angleAxis(-pitchDelta, rightDirection), glm::angleAxis(-yawDelta, glm::vec3(0.f, 1.0f, 0.0f))));
+			m_ForwardDirection = glm::rotate(q, m_ForwardDirection);
+
+			moved = true;
+		}
+
+	}
+
+	Input::SetCursorMode(CursorMode::Normal);
+
+	// Movement
+	if (Input::IsKeyDown(KeyCode::W))
+	{
+		m_Position += m_ForwardDirection * speed * ts;
+		moved = true;
+	}
+	else if (Input::IsKeyDown(KeyCode::S))
+	{
+		m_Position -= m_ForwardDirection * speed * ts;
+		moved = true;
+	}
+	if (Input::IsKeyDown(KeyCode::A))
+	{
+		m_Position -= rightDirection * speed * ts;
+		moved = true;
+	}
+	else if (Input::IsKeyDown(KeyCode::D))
+	{
+		m_Position += rightDirection * speed * ts;
+		moved = true;
+	}
+	if (Input::IsKeyDown(KeyCode::Q))
+	{
+		m_Position -= upDirection * speed * ts;
+		moved = true;
+	}
+	else if (Input::IsKeyDown(KeyCode::E))
+	{
+		m_Position += upDirection * speed * ts;
+		moved = true;
+	}
+
+	if (moved)
+	{
+		RecalculateView();
+		RecalculateRayDirections();
+	}
+
+	return moved;
+}
@@ -0,0 +1,90 @@
+#include "DynamicResolution.h"
+
+#include <glm/glm.hpp>
+
+float DynamicResolution::Update(const DynamicResolutionSettings& settings, float frameTime, float timeSinceMotion)
+{
+	if (!settings.Enabled || timeSinceMotion >= settings.SettleTime)
+	{
+		m_Scale = 1.0f;
+		return m_Scale;
+	}
+
+	// Cost goes with the pixel count, so the square root of the time ratio gets to the budget in one step.
+	// Coming back up is slower than going down, a frame over budget hurts more than a slightly soft one
+	float target = settings.TargetFrameTime;
+	float scale = m_Scale;
+	if (frameTime > target)
+		scale *= glm::sqrt(target / frameTime);
+	else if (frameTime < target * 0.7f)
+		scale *= 1.1f;
+
+	float minScale = glm::clamp(settings.MinScale, ScaleStep, 1.0f);
+	scale = glm::clamp(scale, minScale, 1.0f);
+
+	// Round down when shrinking and up when growing, so a single frame never overshoots the other way
+	float steps = scale / ScaleStep;
+	steps = scale < m_Scale ? glm::floor(steps) : glm::ceil(steps - 0.01f);
+	m_Scale = glm::clamp(steps * ScaleStep, minScale, 1.0f);
+
+	return m_Scale;
+}
+
+// Blends two RGBA8 pixels with an 8 bit weight for q, two channels at a time in the low bytes of each 16 bit half
+static inline uint32_t Lerp(uint32_t p, uint32_t q, uint32_t weight)
+{
+	constexpr uint32_t mask = 0x00ff00ff;
+	uint32_t redBlue = (((p & mask) * (256 - weight) + (q & mask) * weight) >> 8) & mask;
+	uint32_t greenAlpha = ((((p >> 8) & mask) * (256 - weight) + ((q >> 8) & mask) * weight)) & ~mask;
+	return redBlue | greenAlpha;
+}
+
+void UpscaleColumns::Update(uint32_t sourceWidth, uint32_t width)
+{
+	if (sourceWidth == SourceWidth && width == Width)
+		return;
+
+	SourceWidth = sourceWidth;
+	Width = width;
+	Columns.resize(width);
+	Weights.resize(width);
+
+	if (sourceWidth == 0)
+		return;
+
+	float scaleX = (float)sourceWidth / (float)width;
+	for (uint32_t x = 0; x < width; x++)
+	{
+		float sourceX = glm::clamp(((float)x + 0.5f) * scaleX - 0.5f, 0.0f, (float)(sourceWidth - 1));
+		Columns[x] = (uint32_t)sourceX;
+		Weights[x] = (uint32_t)((sourceX - (float)Columns[x]) * 256.0f);
+	}
+}
+
+void UpscaleBilinear(const uint32_t* source, uint32_t sourceHeight, const UpscaleColumns& columns, uint32_t* destination, uint32_t height,
+	uint32_t minRow, uint32_t maxRow, uint32_t* blended)
+{
+	uint32_t sourceWidth = columns.SourceWidth, width = columns.Width;
+	if (sourceWidth == 0 || sourceHeight == 0)
+		return;
+
+	// Vertical blend first at source width, one padding pixel so the right tap never needs a clamp
+	float scaleY = (float)sourceHeight / (float)height;
+	for (uint32_t y = minRow; y < glm::min(maxRow, height); y++)
+	{
+		float sourceY = glm::clamp(((float)y + 0.5f) * scaleY - 0.5f, 0.0f, (float)(sourceHeight - 1));
+		uint32_t y0 = (uint32_t)sourceY;
+		uint32_t y1 = glm::min(y0 + 1, sourceHeight - 1);
+		uint32_t weightY = (uint32_t)((sourceY - (float)y0) * 256.0f);
+
+		const uint32_t* row0 = source + (size_t)y0 * sourceWidth;
+		const uint32_t* row1 = source + (size_t)y1 * sourceWidth;
+		for (uint32_t x = 0; x < sourceWidth; x++)
+			blended[x] = Lerp(row0[x], row1[x], weightY);
+		blended[sourceWidth] = blended[sourceWidth - 1];
+
+		uint32_t* out = destination + (size_t)y * width;
+		for (uint32_t x = 0; x < width; x++)
+			out[x] = Lerp(blended[columns.Columns[x]], blended[columns.Columns[x] + 1], columns.Weights[x]);
+	}
+}
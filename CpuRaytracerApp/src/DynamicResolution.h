@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct DynamicResolutionSettings
+{
+	bool Enabled = true;
+
+	// Frame time to stay under while the view moves, ms
+	float TargetFrameTime = 33.0f;
+
+	// Lowest fraction of the viewport size rendered
+	float MinScale = 0.25f;
+
+	// Time without camera moves or scene edits before going back to native resolution, ms
+	float SettleTime = 250.0f;
+};
+
+// Picks the internal render scale. While the view moves it follows the frame time budget, once it settles it goes back to 1.
+// The scale is quantized so small frame time jitter does not reallocate the framebuffers every frame
+class DynamicResolution
+{
+public:
+	static constexpr float ScaleStep = 1.0f / 16.0f;
+
+	// frameTime is the last rendered frame in ms, timeSinceMotion the time since the last camera move or scene edit in ms
+	float Update(const DynamicResolutionSettings& settings, float frameTime, float timeSinceMotion);
+
+	float GetScale() const { return m_Scale; }
+
+private:
+	float m_Scale = 1.0f;
+};
+
+// Source column and horizontal weight of every destination column, the same for every row and every frame of a size
+struct UpscaleColumns
+{
+	uint32_t SourceWidth = 0, Width = 0;
+	std::vector<uint32_t> Columns, Weights;
+
+	// Only recomputes when a width changed
+	void Update(uint32_t sourceWidth, uint32_t width);
+};
+
+// Bilinear RGBA8 upscale (or downscale), both images with row 0 at the bottom and as wide as columns says.
+// Sample positions are pixel centers, so the image does not shift when the scale changes.
+// Only writes destination rows minRow to maxRow - 1, so bands can go to different threads. blended is scratch for
+// one row of SourceWidth + 1 pixels, one per thread
+void UpscaleBilinear(const uint32_t* source, uint32_t sourceHeight, const UpscaleColumns& columns, uint32_t* destination, uint32_t height,
+	uint32_t minRow, uint32_t maxRow, uint32_t* blended);
@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <limits>
 #include <glm/exponential.hpp>
 
 inline uint32_t WangHash(uint32_t seed)
@@ -17,4 +18,11 @@ inline uint32_t PcgHash(uint32_t seed)
 	uint32_t state = seed * 747796405u + 2891336453u;
 	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
 	return (word >> 22u) ^ word;
+}
+
+// Advances the seed and maps it to [0, 1], thread safe since the state lives with the caller
+inline float RandomFloat(uint32_t& seed)
+{
+	seed = PcgHash(seed);
+	return (float)seed / (float)std::numeric_limits<uint32_t>::max();
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// 64 bit hash of a byte range for telling data apart, not for security. Four independent multiply-xorshift chains so
+// the multiplies overlap, it runs at about memory speed. seed chains hashes of several ranges together
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	size_t wordCount = size / sizeof(uint64_t);
+
+	uint64_t lanes[4] = {
+		0x9e3779b97f4a7c15ull ^ seed,
+		0xbf58476d1ce4e5b9ull ^ size,
+		0x94d049bb133111ebull,
+		0xff51afd7ed558ccdull
+	};
+
+	auto mix = [](uint64_t hash, uint64_t word)
+	{
+		hash = (hash ^ word) * 0xc4ceb9fe1a85ec53ull;
+		return hash ^ (hash >> 29);
+	};
+
+	size_t i = 0;
+	for (; i + 4 <= wordCount; i += 4)
+	{
+		uint64_t words[4];
+		memcpy(words, bytes + i * sizeof(uint64_t), sizeof(words));
+		for (int lane = 0; lane < 4; lane++)
+			lanes[lane] = mix(lanes[lane], words[lane]);
+	}
+
+	for (; i < wordCount; i++)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i * sizeof(uint64_t), sizeof(word));
+		lanes[0] = mix(lanes[0], word);
+	}
+
+	// Bytes past the last whole word, zero extended
+	size_t tail = size - wordCount * sizeof(uint64_t);
+	if (tail > 0)
+	{
+		uint64_t word = 0;
+		memcpy(&word, bytes + wordCount * sizeof(uint64_t), tail);
+		lanes[1] = mix(lanes[1], word);
+	}
+
+	uint64_t hash = 0;
+	for (int lane = 0; lane < 4; lane++)
+		hash = mix(hash, lanes[lane]);
+	return hash;
+}
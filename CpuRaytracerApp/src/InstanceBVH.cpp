@@ -0,0 +1,251 @@
+#include "InstanceBVH.h"
+
+#include <algorithm>
+
+// Directions are not renormalized, so distances along the ray stay the same in both spaces.
+// Summed in the same order as TransformPacket, so packets and single rays agree bit for bit
+static Ray TransformRay(const glm::mat4& m, const Ray& ray)
+{
+	const glm::vec3& o = ray.Origin;
+	const glm::vec3& d = ray.Direction;
+
+	Ray result;
+	result.Origin.x = m[3][0] + o.x * m[0][0] + o.y * m[1][0] + o.z * m[2][0];
+	result.Origin.y = m[3][1] + o.x * m[0][1] + o.y * m[1][1] + o.z * m[2][1];
+	result.Origin.z = m[3][2] + o.x * m[0][2] + o.y * m[1][2] + o.z * m[2][2];
+	result.Direction.x = d.x * m[0][0] + d.y * m[1][0] + d.z * m[2][0];
+	result.Direction.y = d.x * m[0][1] + d.y * m[1][1] + d.z * m[2][1];
+	result.Direction.z = d.x * m[0][2] + d.y * m[1][2] + d.z * m[2][2];
+	return result;
+}
+
+static RayPacket TransformPacket(const glm::mat4& m, const RayPacket& packet)
+{
+	RayPacket result;
+	result.OriginX = Simd::Float(m[3][0]) + packet.OriginX * m[0][0] + packet.OriginY * m[1][0] + packet.OriginZ * m[2][0];
+	result.OriginY = Simd::Float(m[3][1]) + packet.OriginX * m[0][1] + packet.OriginY * m[1][1] + packet.OriginZ * m[2][1];
+	result.OriginZ = Simd::Float(m[3][2]) + packet.OriginX * m[0][2] + packet.OriginY * m[1][2] + packet.OriginZ * m[2][2];
+	result.DirectionX = packet.DirectionX * m[0][0] + packet.DirectionY * m[1][0] + packet.DirectionZ * m[2][0];
+	result.DirectionY = packet.DirectionX * m[0][1] + packet.DirectionY * m[1][1] + packet.DirectionZ * m[2][1];
+	result.DirectionZ = packet.DirectionX * m[0][2] + packet.DirectionY * m[1][2] + packet.DirectionZ * m[2][2];
+	return result;
+}
+
+static void GrowByRoot(AABB& bounds, const BVH& bvh)
+{
+	if (bvh.IsEmpty())
+		return;
+
+	bounds.Grow(bvh.GetNodes()[0].Min);
+	bounds.Grow(bvh.GetNodes()[0].Max);
+}
+
+void InstanceBVH::BottomLevel::Build(const std::shared_ptr<const GeometryBlock>& block, BVHCache& cache)
+{
+	Block = block;
+	if (!Block)
+		return;
+
+	Spheres.Build(Block->Spheres, cache);
+	GrowByRoot(Bounds, Spheres.GetBVH());
+
+	Meshes.resize(Block->Meshes.size());
+	MeshFirstPrimitives.resize(Block->Meshes.size());
+
+	uint32_t firstPrimitive = (uint32_t)Block->Spheres.size();
+	for (size_t i = 0; i < Meshes.size(); i++)
+	{
+		Meshes[i].Build(*Block->Meshes[i], cache);
+		GrowByRoot(Bounds, Meshes[i].GetBVH());
+
+		MeshFirstPrimitives[i] = firstPrimitive;
+		firstPrimitive += Block->Meshes[i]->GetTriangleCount();
+	}
+}
+
+void InstanceBVH::BottomLevel::Intersect(const Ray& ray, float& hitDistance, int& closestPrimitive, TraversalStats& stats) const
+{
+	Spheres.Intersect(ray, hitDistance, closestPrimitive, stats);
+
+	if (Meshes.empty())
+		return;
+
+	TriangleRay triangleRay;
+	triangleRay.Prepare(ray);
+
+	for (size_t i = 0; i < Meshes.size(); i++)
+		Meshes[i].Intersect(triangleRay, ray, hitDistance, closestPrimitive, (int32_t)MeshFirstPrimitives[i], stats);
+}
+
+void InstanceBVH::BottomLevel::Intersect(const RayPacket& packet, Simd::Mask active, Simd::Float& hitDistances, Simd::Int& closestPrimitives,
+	TraversalStats& stats) const
+{
+	Spheres.Intersect(packet, active, hitDistances, closestPrimitives, stats);
+
+	if (Meshes.empty())
+		return;
+
+	TrianglePacket trianglePacket;
+	trianglePacket.Prepare(packet);
+
+	for (size_t i = 0; i < Meshes.size(); i++)
+		Meshes[i].Intersect(trianglePacket, packet, active, hitDistances, closestPrimitives, (int32_t)MeshFirstPrimitives[i], stats);
+}
+
+size_t InstanceBVH::BottomLevel::FindMesh(uint32_t primitive) const
+{
+	return std::upper_bound(MeshFirstPrimitives.begin(), MeshFirstPrimitives.end(), primitive) - MeshFirstPrimitives.begin() - 1;
+}
+
+AABB InstanceBVH::GetWorldBounds(const BottomLevel& geometry, const glm::mat4& transform)
+{
+	// Empty blocks become a point, they still need a leaf to keep instance indices and primitives in step
+	AABB bounds;
+	if (geometry.Bounds.Min.x > geometry.Bounds.Max.x)
+	{
+		bounds.Grow(glm::vec3(transform[3]));
+		return bounds;
+	}
+
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec3 point(
+			corner & 1 ? geometry.Bounds.Max.x : geometry.Bounds.Min.x,
+			corner & 2 ? geometry.Bounds.Max.y : geometry.Bounds.Min.y,
+			corner & 4 ? geometry.Bounds.Max.z : geometry.Bounds.Min.z);
+
+		bounds.Grow(glm::vec3(transform * glm::vec4(point, 1.0f)));
+	}
+	return bounds;
+}
+
+void InstanceBVH::Build(const std::vector<Instance>& instances, BVHCache& cache)
+{
+	std::unordered_map<const GeometryBlock*, std::unique_ptr<BottomLevel>> bottomLevels;
+
+	m_Instances.resize(instances.size());
+	std::vector<AABB> bounds(instances.size());
+
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		const Instance& instance = instances[i];
+
+		std::unique_ptr<BottomLevel>& geometry = bottomLevels[instance.Geometry.get()];
+		if (!geometry)
+		{
+			auto existing = m_BottomLevels.find(instance.Geometry.get());
+			if (existing != m_BottomLevels.end())
+			{
+				geometry = std::move(existing->second);
+			}
+			else
+			{
+				geometry = std::make_unique<BottomLevel>();
+				geometry->Build(instance.Geometry, cache);
+			}
+		}
+
+		m_Instances[i].WorldToObject = glm::inverse(instance.Transform);
+		m_Instances[i].Geometry = geometry.get();
+		bounds[i] = GetWorldBounds(*geometry, instance.Transform);
+	}
+
+	// Whatever was not moved over belongs to blocks that are gone
+	m_BottomLevels = std::move(bottomLevels);
+
+	// Cheap next to the bottom levels and different after every move, so it never goes through the cache
+	m_BVH.Build(bounds);
+}
+
+void InstanceBVH::UpdateInstance(uint32_t index, const glm::mat4& transform)
+{
+	InstanceData& instance = m_Instances[index];
+	instance.WorldToObject = glm::inverse(transform);
+
+	m_BVH.UpdatePrimitive(index, GetWorldBounds(*instance.Geometry, transform));
+}
+
+void InstanceBVH::Intersect(const Ray& ray, float& hitDistance, int& closestInstance, uint32_t& closestPrimitive, int32_t firstIndex,
+	TraversalStats& stats) const
+{
+	const uint32_t* indices = m_BVH.GetIndices();
+
+	m_BVH.Traverse(ray, hitDistance, [&](uint32_t first, uint32_t count, float& closestT)
+		{
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				const InstanceData& instance = m_Instances[indices[i]];
+
+				int primitive = -1;
+				instance.Geometry->Intersect(TransformRay(instance.WorldToObject, ray), closestT, primitive, stats);
+
+				if (primitive >= 0)
+				{
+					closestInstance = firstIndex + (int)indices[i];
+					closestPrimitive = (uint32_t)primitive;
+				}
+			}
+		}, stats);
+}
+
+void InstanceBVH::Intersect(const RayPacket& packet, Simd::Mask active, Simd::Float& hitDistances, Simd::Int& closestInstances,
+	Simd::Int& closestPrimitives, int32_t firstIndex, TraversalStats& stats) const
+{
+	const uint32_t* indices = m_BVH.GetIndices();
+
+	m_BVH.Traverse(packet, active, hitDistances, [&](uint32_t first, uint32_t count, Simd::Mask lanes, Simd::Float& closestT)
+		{
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				const InstanceData& instance = m_Instances[indices[i]];
+
+				// Lanes only get a primitive when this instance holds their closest hit so far
+				Simd::Int primitive = -1;
+				instance.Geometry->Intersect(TransformPacket(instance.WorldToObject, packet), lanes, closestT, primitive, stats);
+
+				Simd::Mask hit = Simd::Int(-1) < primitive;
+				closestInstances = Simd::Select(hit, Simd::Int(firstIndex + (int32_t)indices[i]), closestInstances);
+				closestPrimitives = Simd::Select(hit, primitive, closestPrimitives);
+			}
+		}, stats);
+}
+
+glm::vec3 InstanceBVH::GetNormal(const Ray& ray, float hitDistance, uint32_t instance, uint32_t primitive) const
+{
+	const InstanceData& data = m_Instances[instance];
+	const BottomLevel& geometry = *data.Geometry;
+
+	Ray local = TransformRay(data.WorldToObject, ray);
+	glm::vec3 position = local.Origin + local.Direction * hitDistance;
+
+	bool triangle = primitive >= geometry.Block->Spheres.size();
+
+	glm::vec3 normal;
+	if (!triangle)
+	{
+		normal = position - geometry.Block->Spheres[primitive].Position;
+	}
+	else
+	{
+		size_t mesh = geometry.FindMesh(primitive);
+		normal = geometry.Block->Meshes[mesh]->GetNormal(primitive - geometry.MeshFirstPrimitives[mesh], position);
+	}
+
+	// Normals go back to world space with the inverse transpose, which is just the transpose of what we already have
+	normal = glm::normalize(glm::transpose(glm::mat3(data.WorldToObject)) * normal);
+
+	if (triangle && glm::dot(normal, ray.Direction) > 0.0f)
+		normal = -normal;
+
+	return normal;
+}
+
+glm::vec3 InstanceBVH::GetAlbedo(uint32_t instance, uint32_t primitive) const
+{
+	const BottomLevel& geometry = *m_Instances[instance].Geometry;
+
+	if (primitive < geometry.Block->Spheres.size())
+		return geometry.Block->Spheres[primitive].Albedo;
+
+	return geometry.Block->Meshes[geometry.FindMesh(primitive)]->Albedo;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "BVH.h"
+#include "BVHCache.h"
+#include "MeshBVH.h"
+#include "Scene.h"
+#include "SphereBVH.h"
+
+// Two level hierarchy over Scene::Instances. Every geometry block gets bottom level hierarchies of its own, built once
+// and shared by all instances placing it, and the top level is a BVH over the world bounds of the instances.
+// Rays are moved into an instance's space on the way down, so an instance only costs its inverse transform and bounds
+class InstanceBVH
+{
+public:
+	// Top level from scratch. Blocks that already have bottom levels keep them, blocks no instance uses anymore are dropped
+	void Build(const std::vector<Instance>& instances, BVHCache& cache);
+
+	// One instance moved, only its top level leaf and the nodes above it are refit
+	void UpdateInstance(uint32_t index, const glm::mat4& transform);
+
+	bool IsEmpty() const { return m_Instances.empty(); }
+	uint32_t GetInstanceCount() const { return (uint32_t)m_Instances.size(); }
+	uint32_t GetGeometryCount() const { return (uint32_t)m_BottomLevels.size(); } // Unique blocks with bottom levels
+	const BVH& GetBVH() const { return m_BVH; }
+
+	// Closest hit closer than hitDistance. closestInstance becomes firstIndex + the instance's index,
+	// closestPrimitive the sphere or triangle inside its block (see GeometryBlock)
+	void Intersect(const Ray& ray, float& hitDistance, int& closestInstance, uint32_t& closestPrimitive, int32_t firstIndex, TraversalStats& stats) const;
+
+	void Intersect(const RayPacket& packet, Simd::Mask active, Simd::Float& hitDistances, Simd::Int& closestInstances, Simd::Int& closestPrimitives,
+		int32_t firstIndex, TraversalStats& stats) const;
+
+	// Of a hit found by Intersect. The normal is in world space and normalized, triangles have it facing the ray
+	glm::vec3 GetNormal(const Ray& ray, float hitDistance, uint32_t instance, uint32_t primitive) const;
+	glm::vec3 GetAlbedo(uint32_t instance, uint32_t primitive) const;
+
+private:
+	// Bottom levels of one block, in the block's own space
+	struct BottomLevel
+	{
+		std::shared_ptr<const GeometryBlock> Block; // Also keeps the key below from being reused by another block
+		SphereBVH Spheres;
+		std::vector<MeshBVH> Meshes;
+		std::vector<uint32_t> MeshFirstPrimitives; // Where each mesh's triangles start, after the spheres
+		AABB Bounds;
+
+		void Build(const std::shared_ptr<const GeometryBlock>& block, BVHCache& cache);
+
+		void Intersect(const Ray& ray, float& hitDistance, int& closestPrimitive, TraversalStats& stats) const;
+		void Intersect(const RayPacket& packet, Simd::Mask active, Simd::Float& hitDistances, Simd::Int& closestPrimitives, TraversalStats& stats) const;
+
+		// Mesh holding a primitive past the spheres
+		size_t FindMesh(uint32_t primitive) const;
+	};
+
+	struct InstanceData
+	{
+		glm::mat4 WorldToObject;
+		const BottomLevel* Geometry;
+	};
+
+	static AABB GetWorldBounds(const BottomLevel& geometry, const glm::mat4& transform);
+
+private:
+	std::unordered_map<const GeometryBlock*, std::unique_ptr<BottomLevel>> m_BottomLevels;
+
+	// In scene order, the top level's leaves go through its index list
+	std::vector<InstanceData> m_Instances;
+	BVH m_BVH;
+};
@@ -0,0 +1,236 @@
+#include "Memory.h"
+
+#include <atomic>
+#include <cstdlib>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static size_t RoundUp(size_t value, size_t multiple)
+{
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+#ifdef _WIN32
+
+// Large pages need SeLockMemoryPrivilege, without it the first try fails and we stop asking
+static std::atomic<size_t> s_LargePageSize{ GetLargePageMinimum() };
+
+void* Memory::AllocatePages(size_t size)
+{
+	size_t largePageSize = s_LargePageSize.load(std::memory_order_relaxed);
+	if (largePageSize > 0 && size >= HugePageSize)
+	{
+		void* pointer = VirtualAlloc(nullptr, RoundUp(size, largePageSize), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (pointer)
+			return pointer;
+
+		s_LargePageSize.store(0, std::memory_order_relaxed);
+	}
+
+	return VirtualAlloc(nullptr, size == 0 ? 1 : size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void Memory::FreePages(void* pointer, size_t)
+{
+	if (pointer)
+		VirtualFree(pointer, 0, MEM_RELEASE);
+}
+
+#else
+
+static size_t GetPageSize()
+{
+	static const size_t s_PageSize = (size_t)sysconf(_SC_PAGESIZE);
+	return s_PageSize;
+}
+
+// Small blocks stay in normal pages, big ones are padded to whole huge pages so the last one can be huge too
+static size_t GetMappingSize(size_t size)
+{
+	return size >= Memory::HugePageSize ? RoundUp(size, Memory::HugePageSize) : RoundUp(size, GetPageSize());
+}
+
+void* Memory::AllocatePages(size_t size)
+{
+	if (size == 0)
+		size = 1;
+
+	size_t mappingSize = GetMappingSize(size);
+	if (mappingSize < HugePageSize)
+	{
+		void* pointer = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return pointer == MAP_FAILED ? nullptr : pointer;
+	}
+
+	// mmap only aligns to pages, map one huge page more and cut the ends off so the range starts on a huge page
+	size_t paddedSize = mappingSize + HugePageSize;
+	void* mapping = mmap(nullptr, paddedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED)
+		return nullptr;
+
+	uint8_t* start = (uint8_t*)mapping;
+	uint8_t* aligned = (uint8_t*)RoundUp((size_t)start, HugePageSize);
+	if (aligned > start)
+		munmap(start, aligned - start);
+	if (start + paddedSize > aligned + mappingSize)
+		munmap(aligned + mappingSize, start + paddedSize - (aligned + mappingSize));
+
+#ifdef MADV_HUGEPAGE
+	// Only a hint, with transparent huge pages off (or set to never) this is a plain mapping
+	madvise(aligned, mappingSize, MADV_HUGEPAGE);
+#endif
+	return aligned;
+}
+
+void Memory::FreePages(void* pointer, size_t size)
+{
+	if (pointer)
+		munmap(pointer, GetMappingSize(size == 0 ? 1 : size));
+}
+
+#endif
+
+Arena::~Arena()
+{
+	Reset();
+	if (m_Data)
+		Memory::FreePages(m_Data, m_Capacity);
+}
+
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+	size_t offset = RoundUp(m_Offset, alignment);
+	if (m_Data && offset + size <= m_Capacity)
+	{
+		m_Offset = offset + size;
+		return m_Data + offset;
+	}
+
+	// Pages are aligned enough for anything we ask for
+	void* block = Memory::AllocatePages(size);
+	if (!block)
+		throw std::bad_alloc();
+
+	m_Overflow.emplace_back(block, size);
+	m_OverflowBytes += RoundUp(size, alignment);
+	return block;
+}
+
+void Arena::Reset()
+{
+	if (!m_Overflow.empty())
+	{
+		for (const auto& [block, size] : m_Overflow)
+			Memory::FreePages(block, size);
+
+		// Room for everything this round needed, and some growth so a slowly rising high water mark does not reallocate
+		// every round
+		size_t capacity = std::max(m_Offset + m_OverflowBytes, m_Capacity + m_Capacity / 2);
+		if (m_Data)
+			Memory::FreePages(m_Data, m_Capacity);
+
+		m_Data = (uint8_t*)Memory::AllocatePages(capacity);
+		m_Capacity = m_Data ? capacity : 0;
+
+		m_Overflow.clear();
+		m_OverflowBytes = 0;
+	}
+
+	m_Offset = 0;
+}
+
+void Arena::Swap(Arena& other)
+{
+	std::swap(m_Data, other.m_Data);
+	std::swap(m_Capacity, other.m_Capacity);
+	std::swap(m_Offset, other.m_Offset);
+	std::swap(m_Overflow, other.m_Overflow);
+	std::swap(m_OverflowBytes, other.m_OverflowBytes);
+}
+
+#if RT_COUNT_ALLOCATIONS
+
+static std::atomic<uint64_t> s_AllocationCount{ 0 };
+static std::atomic<uint64_t> s_AllocatedBytes{ 0 };
+static std::atomic<uint64_t> s_TrackedAllocationCount{ 0 };
+
+// Constant initialized, so reading it from operator new never runs a TLS constructor
+static thread_local bool s_TrackThread = false;
+
+uint64_t Memory::GetHeapAllocationCount() { return s_AllocationCount.load(std::memory_order_relaxed); }
+uint64_t Memory::GetHeapAllocatedBytes() { return s_AllocatedBytes.load(std::memory_order_relaxed); }
+uint64_t Memory::GetTrackedAllocationCount() { return s_TrackedAllocationCount.load(std::memory_order_relaxed); }
+
+bool Memory::TrackThreadAllocations(bool enabled)
+{
+	bool previous = s_TrackThread;
+	s_TrackThread = enabled;
+	return previous;
+}
+
+static void* CountedAlloc(size_t size, size_t alignment)
+{
+	s_AllocationCount.fetch_add(1, std::memory_order_relaxed);
+	s_AllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	if (s_TrackThread)
+		s_TrackedAllocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	if (size == 0)
+		size = 1;
+
+	void* pointer = nullptr;
+	if (alignment <= alignof(std::max_align_t))
+	{
+		pointer = malloc(size);
+	}
+	else
+	{
+#ifdef _WIN32
+		pointer = _aligned_malloc(size, alignment);
+#else
+		// aligned_alloc wants the size to be a multiple of the alignment
+		pointer = aligned_alloc(alignment, RoundUp(size, alignment));
+#endif
+	}
+
+	if (!pointer)
+		throw std::bad_alloc();
+
+	return pointer;
+}
+
+// Only Windows frees aligned blocks differently, free() takes both elsewhere
+static void CountedFree(void* pointer, [[maybe_unused]] size_t alignment)
+{
+#ifdef _WIN32
+	if (alignment > alignof(std::max_align_t))
+	{
+		_aligned_free(pointer);
+		return;
+	}
+#endif
+	free(pointer);
+}
+
+void* operator new(size_t size) { return CountedAlloc(size, 0); }
+void* operator new[](size_t size) { return CountedAlloc(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment) { return CountedAlloc(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return CountedAlloc(size, (size_t)alignment); }
+
+void operator delete(void* pointer) noexcept { CountedFree(pointer, 0); }
+void operator delete[](void* pointer) noexcept { CountedFree(pointer, 0); }
+void operator delete(void* pointer, size_t) noexcept { CountedFree(pointer, 0); }
+void operator delete[](void* pointer, size_t) noexcept { CountedFree(pointer, 0); }
+void operator delete(void* pointer, std::align_val_t alignment) noexcept { CountedFree(pointer, (size_t)alignment); }
+void operator delete[](void* pointer, std::align_val_t alignment) noexcept { CountedFree(pointer, (size_t)alignment); }
+void operator delete(void* pointer, size_t, std::align_val_t alignment) noexcept { CountedFree(pointer, (size_t)alignment); }
+void operator delete[](void* pointer, size_t, std::align_val_t alignment) noexcept { CountedFree(pointer, (size_t)alignment); }
+
+#endif
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Replaces the global operator new with one that counts, see Memory::GetHeapAllocationCount(). On in Debug builds and in
+// the benchmarks, Renderer::Render then asserts that steady state frames do not touch the heap
+#ifndef RT_COUNT_ALLOCATIONS
+	#define RT_COUNT_ALLOCATIONS 0
+#endif
+
+// Allocator handing out Alignment aligned blocks, so SIMD loads over std::vector data start on a cache line
+template<typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+	using value_type = T;
+
+	template<typename U>
+	struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+	AlignedAllocator() = default;
+
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(size_t count) { return (T*)::operator new(count * sizeof(T), std::align_val_t(Alignment)); }
+	void deallocate(T* pointer, size_t) { ::operator delete(pointer, std::align_val_t(Alignment)); }
+
+	template<typename U>
+	bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+	template<typename U>
+	bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+namespace Memory
+{
+	// Whole pages straight from the OS, zeroed and at least page aligned. From HugePageSize on they are aligned to it and
+	// asked to be backed by huge pages (transparent huge pages on Linux, large pages on Windows if the process may lock
+	// memory), so walking a framebuffer does not miss the TLB every 4 KB. nullptr when the OS is out of memory
+	static constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+	void* AllocatePages(size_t size);
+
+	// size has to be the one the pages were allocated with
+	void FreePages(void* pointer, size_t size);
+
+#if RT_COUNT_ALLOCATIONS
+	// Every operator new of the process so far
+	uint64_t GetHeapAllocationCount();
+	uint64_t GetHeapAllocatedBytes();
+
+	// Only those made on threads that track their allocations, so a UI thread allocating next to the renderer is not
+	// blamed on it. Returns whether the calling thread tracked before
+	bool TrackThreadAllocations(bool enabled);
+	uint64_t GetTrackedAllocationCount();
+#endif
+}
+
+// Array of trivially copyable T for framebuffer sized data, in pages from Memory::AllocatePages. Shrinking keeps the
+// memory and growing takes at least 1.5 times the old capacity, so resizing a window back and forth soon stops
+// allocating. Contents are not kept when it grows. Copies reuse the memory the target already has, like vectors
+template<typename T>
+class PixelBuffer
+{
+public:
+	static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value, "PixelBuffer never runs constructors or destructors");
+
+	PixelBuffer() = default;
+	~PixelBuffer() { Release(); }
+
+	PixelBuffer(const PixelBuffer& other) { *this = other; }
+	PixelBuffer& operator=(const PixelBuffer& other)
+	{
+		if (this != &other)
+		{
+			Resize(other.m_Count);
+			if (m_Count > 0)
+				memcpy(m_Data, other.m_Data, m_Count * sizeof(T));
+		}
+		return *this;
+	}
+
+	PixelBuffer(PixelBuffer&& other) noexcept { Swap(other); }
+	PixelBuffer& operator=(PixelBuffer&& other) noexcept { Swap(other); return *this; }
+
+	// Returns whether the memory moved
+	bool Resize(size_t count)
+	{
+		m_Count = count;
+		if (count <= m_Capacity)
+			return false;
+
+		// Release() forgets the capacity, the growth is based on the old one
+		size_t capacity = std::max(count, m_Capacity + m_Capacity / 2);
+		Release();
+
+		m_Data = (T*)Memory::AllocatePages(capacity * sizeof(T));
+		if (!m_Data)
+			throw std::bad_alloc();
+
+		m_Count = count;
+		m_Capacity = capacity;
+		return true;
+	}
+
+	void Release()
+	{
+		if (m_Data)
+			Memory::FreePages(m_Data, m_Capacity * sizeof(T));
+
+		m_Data = nullptr;
+		m_Count = m_Capacity = 0;
+	}
+
+	T* GetData() { return m_Data; }
+	const T* GetData() const { return m_Data; }
+	size_t GetCount() const { return m_Count; }
+	size_t GetCapacity() const { return m_Capacity; }
+
+	T& operator[](size_t index) { return m_Data[index]; }
+	const T& operator[](size_t index) const { return m_Data[index]; }
+
+private:
+	void Swap(PixelBuffer& other)
+	{
+		std::swap(m_Data, other.m_Data);
+		std::swap(m_Count, other.m_Count);
+		std::swap(m_Capacity, other.m_Capacity);
+	}
+
+private:
+	T* m_Data = nullptr;
+	size_t m_Count = 0;
+	size_t m_Capacity = 0;
+};
+
+// Bump allocator for scratch memory that lives until the next Reset(), allocating is moving an offset. What does not
+// fit goes into blocks of its own, and Reset() trades all of them for one block that holds the whole high water mark.
+// Memory handed out is not initialized and destructors never run
+class Arena
+{
+public:
+	static constexpr size_t DefaultAlignment = 64;
+
+	Arena() = default;
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	Arena(Arena&& other) noexcept { Swap(other); }
+	Arena& operator=(Arena&& other) noexcept { Swap(other); return *this; }
+
+	void* Allocate(size_t size, size_t alignment = DefaultAlignment);
+
+	template<typename T>
+	T* Allocate(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Arenas never run destructors");
+		return (T*)Allocate(count * sizeof(T), std::max(alignof(T), DefaultAlignment));
+	}
+
+	// Frees everything at once, keeps the memory for the next round
+	void Reset();
+
+	size_t GetCapacity() const { return m_Capacity; }
+	size_t GetUsed() const { return m_Offset + m_OverflowBytes; }
+
+private:
+	void Swap(Arena& other);
+
+private:
+	uint8_t* m_Data = nullptr;
+	size_t m_Capacity = 0;
+	size_t m_Offset = 0;
+
+	// Blocks of what did not fit since the last Reset, (pointer, size)
+	std::vector<std::pair<void*, size_t>> m_Overflow;
+	size_t m_OverflowBytes = 0;
+};
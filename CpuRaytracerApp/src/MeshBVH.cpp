@@ -0,0 +1,60 @@
+#include "MeshBVH.h"
+
+void MeshBVH::Build(const Mesh& mesh, BVHCache& cache)
+{
+	uint32_t triangleCount = mesh.GetTriangleCount();
+
+	std::vector<AABB> bounds(triangleCount);
+	for (uint32_t i = 0; i < triangleCount; i++)
+	{
+		bounds[i].Grow(mesh.Positions[mesh.Indices[i * 3 + 0]]);
+		bounds[i].Grow(mesh.Positions[mesh.Indices[i * 3 + 1]]);
+		bounds[i].Grow(mesh.Positions[mesh.Indices[i * 3 + 2]]);
+	}
+
+	cache.LoadOrBuild(m_BVH, bounds);
+
+	const uint32_t* indices = m_BVH.GetIndices();
+	m_Triangles.resize(m_BVH.GetPrimitiveCount());
+	for (uint32_t i = 0; i < m_BVH.GetPrimitiveCount(); i++)
+	{
+		uint32_t triangle = indices[i];
+		m_Triangles[i].V0 = mesh.Positions[mesh.Indices[triangle * 3 + 0]];
+		m_Triangles[i].V1 = mesh.Positions[mesh.Indices[triangle * 3 + 1]];
+		m_Triangles[i].V2 = mesh.Positions[mesh.Indices[triangle * 3 + 2]];
+	}
+}
+
+void MeshBVH::Intersect(const TriangleRay& ray, const Ray& original, float& hitDistance, int& closestIndex, int32_t firstIndex, TraversalStats& stats) const
+{
+	const uint32_t* indices = m_BVH.GetIndices();
+
+	m_BVH.Traverse(original, hitDistance, [&](uint32_t first, uint32_t count, float& closestT)
+		{
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				const LeafTriangle& triangle = m_Triangles[i];
+				float t = IntersectTriangle(ray, triangle.V0, triangle.V1, triangle.V2);
+				if (t > 0.0f && t < closestT)
+				{
+					closestT = t;
+					closestIndex = firstIndex + (int)indices[i];
+				}
+			}
+		}, stats);
+}
+
+void MeshBVH::Intersect(const TrianglePacket& packet, const RayPacket& original, Simd::Mask active, Simd::Float& hitDistances, Simd::Int& closestIndices,
+	int32_t firstIndex, TraversalStats& stats) const
+{
+	const uint32_t* indices = m_BVH.GetIndices();
+
+	m_BVH.Traverse(original, active, hitDistances, [&](uint32_t first, uint32_t count, Simd::Mask lanes, Simd::Float& closestT)
+		{
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				const LeafTriangle& triangle = m_Triangles[i];
+				IntersectTriangle(packet, triangle.V0, triangle.V1, triangle.V2, firstIndex + (int32_t)indices[i], lanes, closestT, closestIndices);
+			}
+		}, stats);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include "BVH.h"
+#include "BVHCache.h"
+#include "Scene.h"
+#include "Triangle.h"
+
+// One mesh ready for tracing, a BVH over its triangles plus their vertices copied out in leaf order.
+// Leaves then read one contiguous range instead of going through the index buffer into scattered vertices
+class MeshBVH
+{
+public:
+	// Big meshes go through the cache like the sphere BVH does
+	void Build(const Mesh& mesh, BVHCache& cache);
+
+	uint32_t GetTriangleCount() const { return (uint32_t)m_Triangles.size(); }
+	const BVH& GetBVH() const { return m_BVH; }
+
+	// Closest hit closer than hitDistance, closestIndex becomes firstIndex + the triangle's index in the mesh
+	void Intersect(const TriangleRay& ray, const Ray& original, float& hitDistance, int& closestIndex, int32_t firstIndex, TraversalStats& stats) const;
+
+	void Intersect(const TrianglePacket& packet, const RayPacket& original, Simd::Mask active, Simd::Float& hitDistances, Simd::Int& closestIndices,
+		int32_t firstIndex, TraversalStats& stats) const;
+
+private:
+	struct LeafTriangle
+	{
+		glm::vec3 V0, V1, V2;
+	};
+
+	BVH m_BVH;
+	std::vector<LeafTriangle> m_Triangles;
+};
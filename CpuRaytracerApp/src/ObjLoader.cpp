@@ -0,0 +1,331 @@
+#include "ObjLoader.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include "MappedFile.h"
+
+// Below this a chunk is not worth a job of its own
+static constexpr size_t s_MinChunkSize = 1 << 20;
+
+struct ObjChunk
+{
+	const char* Begin = nullptr;
+	const char* End = nullptr;
+
+	// Counted by the first pass
+	uint32_t Lines = 0, Positions = 0, Normals = 0, Triangles = 0;
+
+	// Sums over the chunks before this one, where its lines start and its elements go
+	uint32_t FirstLine = 0, FirstPosition = 0, FirstNormal = 0, FirstTriangle = 0;
+
+	// First problem found by the second pass
+	const char* Error = nullptr;
+	uint32_t ErrorLine = 0;
+};
+
+enum class ObjLineType
+{
+	Other = 0, Position, Normal, Face
+};
+
+// Calls func(begin, end) for every line without its line break, stops early when func returns false
+template<typename LineFunc>
+static void ForEachLine(const char* begin, const char* end, LineFunc&& func)
+{
+	while (begin < end)
+	{
+		const char* lineEnd = (const char*)memchr(begin, '\n', end - begin);
+		if (!lineEnd)
+			lineEnd = end;
+
+		const char* next = lineEnd < end ? lineEnd + 1 : end;
+		if (lineEnd > begin && lineEnd[-1] == '\r')
+			lineEnd--;
+
+		if (!func(begin, lineEnd))
+			return;
+
+		begin = next;
+	}
+}
+
+static bool IsSpace(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static const char* SkipSpaces(const char* p, const char* end)
+{
+	while (p < end && IsSpace(*p))
+		p++;
+	return p;
+}
+
+// Moves p past the keyword
+static ObjLineType GetLineType(const char*& p, const char* end)
+{
+	p = SkipSpaces(p, end);
+
+	if (end - p >= 2 && p[0] == 'v' && IsSpace(p[1])) { p += 2; return ObjLineType::Position; }
+	if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && IsSpace(p[2])) { p += 3; return ObjLineType::Normal; }
+	if (end - p >= 2 && p[0] == 'f' && IsSpace(p[1])) { p += 2; return ObjLineType::Face; }
+
+	return ObjLineType::Other;
+}
+
+static uint32_t CountTokens(const char* p, const char* end)
+{
+	uint32_t count = 0;
+	while ((p = SkipSpaces(p, end)) < end)
+	{
+		count++;
+		while (p < end && !IsSpace(*p))
+			p++;
+	}
+	return count;
+}
+
+static bool ParseFloat(const char*& p, const char* end, float& value)
+{
+	p = SkipSpaces(p, end);
+
+	// from_chars takes a minus but no plus
+	if (p < end && *p == '+')
+		p++;
+
+	auto result = std::from_chars(p, end, value);
+	if (result.ec != std::errc())
+		return false;
+
+	p = result.ptr;
+	return true;
+}
+
+static bool ParseVec3(const char* p, const char* end, glm::vec3& value)
+{
+	return ParseFloat(p, end, value.x) && ParseFloat(p, end, value.y) && ParseFloat(p, end, value.z);
+}
+
+// 1 based, negative counts back from the last element defined so far. Returns false for 0 or anything out of range
+static bool ResolveIndex(int64_t index, uint32_t definedSoFar, uint32_t total, uint32_t& result)
+{
+	int64_t resolved = index > 0 ? index - 1 : (int64_t)definedSoFar + index;
+	if (index == 0 || resolved < 0 || resolved >= (int64_t)total)
+		return false;
+
+	result = (uint32_t)resolved;
+	return true;
+}
+
+ObjLoader::ObjLoader(Mesh& mesh, ThreadPool& threadPool)
+	: m_Mesh(mesh), m_ThreadPool(threadPool)
+{
+}
+
+bool ObjLoader::Load(const std::string& filepath)
+{
+	MappedFile file;
+	if (!file.Open(filepath))
+	{
+		// Nothing to map in an empty file, it still is a valid mesh without triangles
+		std::error_code error;
+		if (std::filesystem::is_regular_file(filepath, error) && std::filesystem::file_size(filepath, error) == 0 && !error)
+		{
+			Mesh mesh;
+			mesh.Albedo = m_Mesh.Albedo;
+			mesh.Filepath = filepath;
+			m_Mesh = std::move(mesh);
+			return true;
+		}
+
+		std::cerr << "Could not open mesh " << filepath << std::endl;
+		return false;
+	}
+
+
+	const char* data = (const char*)file.GetData();
+	size_t size = file.GetSize();
+
+	// Cut at line breaks, a line never spans two chunks
+	size_t chunkCount = std::clamp(size / s_MinChunkSize, (size_t)1, (size_t)m_ThreadPool.GetThreadCount() * 8);
+	std::vector<ObjChunk> chunks(chunkCount);
+
+	const char* begin = data;
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		const char* end = data + size * (i + 1) / chunkCount;
+		if (end < begin)
+			end = begin;
+
+		const char* lineEnd = end < data + size ? (const char*)memchr(end, '\n', data + size - end) : nullptr;
+		end = lineEnd ? lineEnd + 1 : data + size;
+
+		chunks[i].Begin = begin;
+		chunks[i].End = end;
+		begin = end;
+	}
+
+	m_ThreadPool.ParallelFor((uint32_t)chunkCount, [&](uint32_t chunkIndex, uint32_t)
+		{
+			ObjChunk& chunk = chunks[chunkIndex];
+			ForEachLine(chunk.Begin, chunk.End, [&](const char* p, const char* end)
+				{
+					chunk.Lines++;
+					switch (GetLineType(p, end))
+					{
+					case ObjLineType::Position: chunk.Positions++; break;
+					case ObjLineType::Normal: chunk.Normals++; break;
+					case ObjLineType::Face:
+					{
+						uint32_t corners = CountTokens(p, end);
+						if (corners >= 3)
+							chunk.Triangles += corners - 2;
+						break;
+					}
+					default: break;
+					}
+					return true;
+				});
+		});
+
+	uint32_t lineCount = 0, positionCount = 0, normalCount = 0, triangleCount = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.FirstLine = lineCount;
+		chunk.FirstPosition = positionCount;
+		chunk.FirstNormal = normalCount;
+		chunk.FirstTriangle = triangleCount;
+
+		lineCount += chunk.Lines;
+		positionCount += chunk.Positions;
+		normalCount += chunk.Normals;
+		triangleCount += chunk.Triangles;
+	}
+
+	Mesh mesh;
+	mesh.Positions.resize(positionCount);
+	mesh.Normals.resize(normalCount);
+	mesh.Indices.resize((size_t)triangleCount * 3);
+	if (normalCount > 0)
+		mesh.NormalIndices.resize((size_t)triangleCount * 3);
+
+	m_ThreadPool.ParallelFor((uint32_t)chunkCount, [&](uint32_t chunkIndex, uint32_t)
+		{
+			ObjChunk& chunk = chunks[chunkIndex];
+
+			uint32_t line = chunk.FirstLine;
+			uint32_t position = chunk.FirstPosition;
+			uint32_t normal = chunk.FirstNormal;
+			uint32_t triangle = chunk.FirstTriangle;
+
+			auto fail = [&](const char* error)
+			{
+				chunk.Error = error;
+				chunk.ErrorLine = line;
+				return false;
+			};
+
+			ForEachLine(chunk.Begin, chunk.End, [&](const char* p, const char* end)
+				{
+					line++;
+					switch (GetLineType(p, end))
+					{
+					case ObjLineType::Position:
+						if (!ParseVec3(p, end, mesh.Positions[position++]))
+							return fail("expected v x y z");
+						break;
+
+					case ObjLineType::Normal:
+						if (!ParseVec3(p, end, mesh.Normals[normal++]))
+							return fail("expected vn x y z");
+						break;
+
+					case ObjLineType::Face:
+					{
+						// Fanned around the first corner, each corner after the second closes one triangle
+						uint32_t first[2] = {}, previous[2] = {};
+						uint32_t corners = 0;
+
+						while ((p = SkipSpaces(p, end)) < end)
+						{
+							// v, v/vt, v//vn or v/vt/vn, texture coordinates are skipped
+							int64_t indices[3] = { 0, 0, 0 };
+							for (int element = 0; element < 3; element++)
+							{
+								if (element > 0)
+								{
+									if (p >= end || *p != '/')
+										break;
+									p++;
+								}
+
+								auto result = std::from_chars(p, end, indices[element]);
+								if (result.ec != std::errc() && (element == 0 || (p < end && !IsSpace(*p) && *p != '/')))
+									return fail("invalid face index");
+								p = result.ptr;
+							}
+
+							if (p < end && !IsSpace(*p))
+								return fail("invalid face index");
+
+							uint32_t corner[2] = { 0, Mesh::NoNormal };
+							if (!ResolveIndex(indices[0], position, positionCount, corner[0]))
+								return fail("face references a vertex that does not exist");
+							if (indices[2] != 0 && !ResolveIndex(indices[2], normal, normalCount, corner[1]))
+								return fail("face references a normal that does not exist");
+
+							if (corners == 0)
+							{
+								first[0] = corner[0];
+								first[1] = corner[1];
+							}
+							else if (corners >= 2)
+							{
+								size_t offset = (size_t)triangle++ * 3;
+								mesh.Indices[offset + 0] = first[0];
+								mesh.Indices[offset + 1] = previous[0];
+								mesh.Indices[offset + 2] = corner[0];
+
+								if (!mesh.NormalIndices.empty())
+								{
+									mesh.NormalIndices[offset + 0] = first[1];
+									mesh.NormalIndices[offset + 1] = previous[1];
+									mesh.NormalIndices[offset + 2] = corner[1];
+								}
+							}
+
+							previous[0] = corner[0];
+							previous[1] = corner[1];
+							corners++;
+						}
+
+						if (corners < 3)
+							return fail("faces need at least 3 corners");
+						break;
+					}
+
+					default:
+						break;
+					}
+					return true;
+				});
+		});
+
+	for (const ObjChunk& chunk : chunks)
+	{
+		if (chunk.Error)
+		{
+			std::cerr << filepath << ":" << chunk.ErrorLine << ": " << chunk.Error << std::endl;
+			return false;
+		}
+	}
+
+	mesh.Albedo = m_Mesh.Albedo;
+	mesh.Filepath = filepath;
+	m_Mesh = std::move(mesh);
+	return true;
+}
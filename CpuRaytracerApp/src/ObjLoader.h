@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+#include "Scene.h"
+#include "ThreadPool.h"
+
+// Wavefront OBJ meshes, only what tracing needs. v, vn and f lines are read (polygons are fanned into triangles,
+// negative indices count back from the end), everything else is skipped.
+//
+// The file is memory mapped and cut into chunks at line breaks. A first parallel pass only counts the elements of
+// every chunk, which tells each chunk exactly where its data goes, the buffers are allocated once and a second
+// parallel pass parses straight into them. No line is ever copied. Both passes run on the caller's pool, so loading many
+// meshes does not start threads for every one
+class ObjLoader
+{
+public:
+	ObjLoader(Mesh& mesh, ThreadPool& threadPool);
+
+	// Replaces the mesh's geometry, problems are reported to stderr with their line number. An empty file is an empty mesh
+	bool Load(const std::string& filepath);
+
+private:
+	Mesh& m_Mesh;
+	ThreadPool& m_ThreadPool;
+};
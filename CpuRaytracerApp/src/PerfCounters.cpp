@@ -0,0 +1,203 @@
+#include "PerfCounters.h"
+
+#include <atomic>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+static std::atomic<const char*> s_Error{ nullptr };
+
+const char* GetPerfEventName(PerfEvent event)
+{
+	switch (event)
+	{
+	case PerfEvent::Cycles: return "Cycles";
+	case PerfEvent::Instructions: return "Instructions";
+	case PerfEvent::BranchMisses: return "Branch Misses";
+	case PerfEvent::CacheReferences: return "Cache References";
+	case PerfEvent::CacheMisses: return "Cache Misses";
+	case PerfEvent::TLBMisses: return "TLB Misses";
+	case PerfEvent::PageFaults: return "Page Faults";
+	default: return "Unknown";
+	}
+}
+
+const char* PerfCounters::GetError()
+{
+	return s_Error.load(std::memory_order_relaxed);
+}
+
+#ifdef __linux__
+
+struct PerfEventConfig
+{
+	PerfEvent Event;
+	uint32_t Type;
+	uint64_t Config;
+};
+
+// Cores have only a handful of programmable counters and a group is scheduled all or nothing, so events that are read
+// against each other share a group and everything else gets its own
+static const PerfEventConfig s_Groups[][3] = {
+	{
+		{ PerfEvent::Cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PerfEvent::Instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PerfEvent::BranchMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	},
+	{
+		{ PerfEvent::CacheReferences, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+		{ PerfEvent::CacheMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PerfEvent::TLBMisses, PERF_TYPE_HW_CACHE,
+			PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	},
+	{
+		{ PerfEvent::PageFaults, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+		{ PerfEvent::Count, 0, 0 },
+		{ PerfEvent::Count, 0, 0 },
+	},
+};
+
+static constexpr size_t s_GroupCount = sizeof(s_Groups) / sizeof(s_Groups[0]);
+static constexpr size_t s_MaxGroupSize = sizeof(s_Groups[0]) / sizeof(s_Groups[0][0]);
+
+static const char* GetOpenError(int error)
+{
+	switch (error)
+	{
+	case ENOENT:
+	case EOPNOTSUPP: return "Event not supported by this CPU or hypervisor";
+	case ENODEV: return "No performance monitoring unit";
+	case EACCES:
+	case EPERM: return "Not permitted, see /proc/sys/kernel/perf_event_paranoid";
+	case ENOSYS: return "Kernel without perf_event_open";
+	default: return "perf_event_open failed";
+	}
+}
+
+static int OpenEvent(const PerfEventConfig& config, int groupFd)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = config.Type;
+	attr.config = config.Config;
+	attr.exclude_kernel = 1; // All that perf_event_paranoid 2 allows, and traversal never enters the kernel anyway
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+	if (fd < 0)
+		s_Error.store(GetOpenError(errno), std::memory_order_relaxed);
+	return fd;
+}
+
+struct PerfEventGroup
+{
+	int Fd = -1; // The leader, the first event that opened
+	PerfEvent Events[s_MaxGroupSize];
+	uint32_t EventCount = 0;
+};
+
+// Opened on first use by the owning thread, closed when it exits
+struct ThreadCounters
+{
+	PerfEventGroup Groups[s_GroupCount];
+	int Fds[(size_t)PerfEvent::Count];
+	uint32_t FdCount = 0;
+	uint32_t AvailableMask = 0;
+	bool Opened = false;
+
+	void Open()
+	{
+		Opened = true;
+
+		for (size_t i = 0; i < s_GroupCount; i++)
+		{
+			PerfEventGroup& group = Groups[i];
+			for (const PerfEventConfig& config : s_Groups[i])
+			{
+				if (config.Event == PerfEvent::Count)
+					continue;
+
+				int fd = OpenEvent(config, group.Fd);
+				if (fd < 0)
+					continue;
+
+				if (group.Fd < 0)
+					group.Fd = fd;
+
+				Fds[FdCount++] = fd;
+				group.Events[group.EventCount++] = config.Event;
+				AvailableMask |= 1u << (uint32_t)config.Event;
+			}
+		}
+	}
+
+	~ThreadCounters()
+	{
+		for (uint32_t i = 0; i < FdCount; i++)
+			close(Fds[i]);
+	}
+};
+
+static ThreadCounters& GetThreadCounters()
+{
+	thread_local ThreadCounters counters;
+	if (!counters.Opened)
+		counters.Open();
+	return counters;
+}
+
+PerfCounterValues PerfCounters::Read()
+{
+	ThreadCounters& counters = GetThreadCounters();
+
+	PerfCounterValues values;
+	for (const PerfEventGroup& group : counters.Groups)
+	{
+		if (group.Fd < 0)
+			continue;
+
+		// nr, time enabled, time running, then one value per event in the order they were opened
+		uint64_t data[3 + s_MaxGroupSize];
+		ssize_t size = read(group.Fd, data, sizeof(data));
+		if (size < (ssize_t)((3 + group.EventCount) * sizeof(uint64_t)) || data[2] == 0)
+			continue;
+
+		// More groups than counters get multiplexed, what was not counted while scheduled out is extrapolated
+		double scale = data[2] < data[1] ? (double)data[1] / (double)data[2] : 1.0;
+		for (uint32_t i = 0; i < group.EventCount; i++)
+		{
+			PerfEvent event = group.Events[i];
+			values.Counts[(size_t)event] = scale == 1.0 ? data[3 + i] : (uint64_t)((double)data[3 + i] * scale);
+			values.AvailableMask |= 1u << (uint32_t)event;
+		}
+	}
+	return values;
+}
+
+bool PerfCounters::IsAvailable()
+{
+	return GetThreadCounters().AvailableMask != 0;
+}
+
+#else
+
+PerfCounterValues PerfCounters::Read()
+{
+	return PerfCounterValues();
+}
+
+bool PerfCounters::IsAvailable()
+{
+	s_Error.store("Only supported on Linux", std::memory_order_relaxed);
+	return false;
+}
+
+#endif
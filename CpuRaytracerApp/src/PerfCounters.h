@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Profiler.h"
+
+enum class PerfEvent
+{
+	Cycles = 0,
+	Instructions,
+	BranchMisses,
+	CacheReferences, // Last level cache
+	CacheMisses,
+	TLBMisses, // Data TLB loads
+	PageFaults, // Software counter, still there when the hardware ones are not
+	Count
+};
+
+const char* GetPerfEventName(PerfEvent event);
+
+// User space counts of the events that could be opened, the rest stay 0 and are left out of the mask
+struct PerfCounterValues
+{
+	uint64_t Counts[(size_t)PerfEvent::Count] = {};
+	uint32_t AvailableMask = 0;
+
+	bool IsAvailable(PerfEvent event) const { return (AvailableMask >> (uint32_t)event) & 1; }
+	bool IsEmpty() const { return AvailableMask == 0; }
+
+	uint64_t operator[](PerfEvent event) const { return Counts[(size_t)event]; }
+
+	// Per cycle and per reference, 0 when either side is missing
+	double GetIPC() const { return GetRatio(PerfEvent::Instructions, PerfEvent::Cycles); }
+	double GetCacheMissRate() const { return GetRatio(PerfEvent::CacheMisses, PerfEvent::CacheReferences); }
+
+	double GetRatio(PerfEvent event, PerfEvent base) const
+	{
+		return IsAvailable(event) && IsAvailable(base) && Counts[(size_t)base] > 0 ? (double)Counts[(size_t)event] / (double)Counts[(size_t)base] : 0.0;
+	}
+
+	PerfCounterValues& operator+=(const PerfCounterValues& other)
+	{
+		for (size_t i = 0; i < (size_t)PerfEvent::Count; i++)
+			Counts[i] += other.Counts[i];
+		AvailableMask |= other.AvailableMask;
+		return *this;
+	}
+
+	PerfCounterValues operator-(const PerfCounterValues& other) const
+	{
+		// Multiplexed counts are estimates, a later one can come out a little lower
+		PerfCounterValues result;
+		for (size_t i = 0; i < (size_t)PerfEvent::Count; i++)
+			result.Counts[i] = Counts[i] > other.Counts[i] ? Counts[i] - other.Counts[i] : 0;
+		result.AvailableMask = AvailableMask & other.AvailableMask;
+		return result;
+	}
+};
+
+// What a frame cost in counters, Frame covers every tile traced and converted on any worker. Only the stages that run
+// as passes of their own get split out: the wavefront integrator's and conversion. The megakernel only counts into Frame
+struct PerfCounterStats
+{
+	PerfCounterValues Frame;
+	PerfCounterValues Stages[(size_t)ProfileStage::Count];
+
+	PerfCounterStats& operator+=(const PerfCounterStats& other)
+	{
+		Frame += other.Frame;
+		for (size_t i = 0; i < (size_t)ProfileStage::Count; i++)
+			Stages[i] += other.Stages[i];
+		return *this;
+	}
+};
+
+// Hardware counters through perf_event_open, Linux only. Every thread opens its own counter groups the first time it
+// reads and closes them when it exits, they count only that thread in user space. Events the CPU, the VM or
+// perf_event_paranoid do not allow are left out, if none open at all Read() returns empty values on every call.
+// A read is a few syscalls (~1us), fine per tile or per pass but not per ray
+namespace PerfCounters
+{
+	// Running totals of the calling thread since its counters were opened
+	PerfCounterValues Read();
+
+	// Whether the calling thread got at least one event, opens them if that did not happen yet
+	bool IsAvailable();
+
+	// Why the last event that failed to open did, nullptr if none failed so far
+	const char* GetError();
+}
+
+// Adds the counts of its lifetime to target, a null target turns it off without a single syscall
+class PerfCounterScope
+{
+public:
+	explicit PerfCounterScope(PerfCounterValues* target)
+		: m_Target(target)
+	{
+		if (m_Target)
+			m_Start = PerfCounters::Read();
+	}
+
+	PerfCounterScope(PerfCounterStats* target, ProfileStage stage)
+		: PerfCounterScope(target ? &target->Stages[(size_t)stage] : nullptr) {}
+
+	~PerfCounterScope()
+	{
+		if (m_Target)
+			*m_Target += PerfCounters::Read() - m_Start;
+	}
+
+	PerfCounterScope(const PerfCounterScope&) = delete;
+	PerfCounterScope& operator=(const PerfCounterScope&) = delete;
+
+private:
+	PerfCounterValues* m_Target;
+	PerfCounterValues m_Start;
+};
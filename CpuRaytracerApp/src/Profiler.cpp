@@ -0,0 +1,211 @@
+#include "Profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct ProfileEvent
+{
+	const char* Name;
+	uint64_t Start, End; // Counters keep their value in End
+	bool Counter;
+};
+
+// One per thread that ever recorded something, never freed so totals of finished threads still count
+struct ProfileThread
+{
+	uint32_t Id = 0;
+	std::string Name;
+
+	// Only the owning thread adds, relaxed is enough for readers that just want a recent sum
+	std::atomic<uint64_t> StageTime[(size_t)ProfileStage::Count] = {};
+
+	// Locked by the owner per event and by EndCapture, so uncontended unless a capture is being written
+	std::mutex EventMutex;
+	std::vector<ProfileEvent> Events;
+};
+
+// A long capture stops growing at this many events per thread instead of eating the memory
+static constexpr size_t s_MaxEventsPerThread = 1 << 22;
+
+static std::mutex s_ThreadsMutex;
+static std::vector<std::unique_ptr<ProfileThread>> s_Threads;
+
+static std::atomic<bool> s_Capturing{ false };
+static uint64_t s_CaptureStart = 0;
+
+static const auto s_ClockStart = std::chrono::steady_clock::now();
+
+static ProfileThread& GetThreadData()
+{
+	thread_local ProfileThread* data = nullptr;
+	if (!data)
+	{
+		std::lock_guard<std::mutex> lock(s_ThreadsMutex);
+		s_Threads.push_back(std::make_unique<ProfileThread>());
+		data = s_Threads.back().get();
+		data->Id = (uint32_t)s_Threads.size();
+	}
+	return *data;
+}
+
+static void WriteEscaped(FILE* file, const std::string& text)
+{
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			fputc('\\', file);
+		fputc(c, file);
+	}
+}
+
+const char* GetProfileStageName(ProfileStage stage)
+{
+	switch (stage)
+	{
+	case ProfileStage::RayGeneration: return "Ray Generation";
+	case ProfileStage::Traversal: return "Traversal";
+	case ProfileStage::Shading: return "Shading";
+	case ProfileStage::Sorting: return "Sorting";
+	case ProfileStage::Conversion: return "Conversion";
+	case ProfileStage::Upload: return "Upload";
+	default: return "Unknown";
+	}
+}
+
+uint64_t Profiler::Now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_ClockStart).count();
+}
+
+void Profiler::SetThreadName(const std::string& name)
+{
+	ProfileThread& data = GetThreadData();
+
+	std::lock_guard<std::mutex> lock(data.EventMutex);
+	if (data.Name.empty())
+		data.Name = name;
+}
+
+void Profiler::AddStageTime(ProfileStage stage, uint64_t nanoseconds)
+{
+	GetThreadData().StageTime[(size_t)stage].fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+void Profiler::AddEvent(const char* name, uint64_t start, uint64_t end)
+{
+	if (!s_Capturing.load(std::memory_order_relaxed))
+		return;
+
+	ProfileThread& data = GetThreadData();
+
+	std::lock_guard<std::mutex> lock(data.EventMutex);
+	if (data.Events.size() < s_MaxEventsPerThread)
+		data.Events.push_back({ name, start, end, false });
+}
+
+void Profiler::AddCounter(const char* name, double value)
+{
+	if (!s_Capturing.load(std::memory_order_relaxed))
+		return;
+
+	ProfileThread& data = GetThreadData();
+
+	// The value travels in End as raw bits
+	uint64_t bits;
+	static_assert(sizeof(bits) == sizeof(value), "");
+	memcpy(&bits, &value, sizeof(bits));
+
+	std::lock_guard<std::mutex> lock(data.EventMutex);
+	if (data.Events.size() < s_MaxEventsPerThread)
+		data.Events.push_back({ name, Now(), bits, true });
+}
+
+ProfileStageTimes Profiler::GetStageTimes()
+{
+	ProfileStageTimes times;
+
+	std::lock_guard<std::mutex> lock(s_ThreadsMutex);
+	for (const auto& data : s_Threads)
+	{
+		for (size_t i = 0; i < (size_t)ProfileStage::Count; i++)
+			times.Milliseconds[i] += (double)data->StageTime[i].load(std::memory_order_relaxed) * 1e-6;
+	}
+	return times;
+}
+
+void Profiler::BeginCapture()
+{
+	std::lock_guard<std::mutex> lock(s_ThreadsMutex);
+	for (const auto& data : s_Threads)
+	{
+		std::lock_guard<std::mutex> eventLock(data->EventMutex);
+		data->Events.clear();
+	}
+
+	s_CaptureStart = Now();
+	s_Capturing = true;
+}
+
+bool Profiler::IsCapturing()
+{
+	return s_Capturing.load(std::memory_order_relaxed);
+}
+
+bool Profiler::EndCapture(const std::string& filepath)
+{
+	if (!s_Capturing.exchange(false))
+		return false;
+
+	FILE* file = fopen(filepath.c_str(), "w");
+	if (!file)
+		return false;
+
+	// Complete events ("X") with microsecond timestamps, counters ("C") and one thread_name record per thread
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	bool first = true;
+	auto separator = [&]() { fputs(first ? "" : ",\n", file); first = false; };
+
+	std::lock_guard<std::mutex> lock(s_ThreadsMutex);
+	for (const auto& data : s_Threads)
+	{
+		std::lock_guard<std::mutex> eventLock(data->EventMutex);
+
+		separator();
+		fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"", data->Id);
+		WriteEscaped(file, data->Name.empty() ? "Thread " + std::to_string(data->Id) : data->Name);
+		fprintf(file, "\"}}");
+
+		for (const ProfileEvent& event : data->Events)
+		{
+			// Scopes still open when the capture started are clipped to it
+			uint64_t start = event.Start > s_CaptureStart ? event.Start - s_CaptureStart : 0;
+
+			separator();
+			if (event.Counter)
+			{
+				double value;
+				memcpy(&value, &event.End, sizeof(value));
+				fprintf(file, "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%g}}",
+					event.Name, data->Id, start * 1e-3, value);
+			}
+			else
+			{
+				uint64_t end = event.End > s_CaptureStart ? event.End - s_CaptureStart : 0;
+				fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					event.Name, data->Id, start * 1e-3, (end - start) * 1e-3);
+			}
+		}
+
+		data->Events.clear();
+		data->Events.shrink_to_fit();
+	}
+
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Instrumentation is compiled in by default. Define RT_PROFILE=0 and the RT_PROFILE_* macros below expand to nothing,
+// not even the clock gets read
+#ifndef RT_PROFILE
+	#define RT_PROFILE 1
+#endif
+
+enum class ProfileStage
+{
+	RayGeneration = 0,
+	Traversal,
+	Shading, // Hits, colors and reflected rays. The megakernel traces its bounces in here too, without packets whole paths
+	Sorting,
+	Conversion, // Tonemapping to RGBA8 and the upscale to the viewport
+	Upload, // Into the image the viewport draws, on the UI thread
+	Count
+};
+
+const char* GetProfileStageName(ProfileStage stage);
+
+// Time spent per stage in ms, summed over every thread
+struct ProfileStageTimes
+{
+	double Milliseconds[(size_t)ProfileStage::Count] = {};
+
+	double& operator[](ProfileStage stage) { return Milliseconds[(size_t)stage]; }
+	double operator[](ProfileStage stage) const { return Milliseconds[(size_t)stage]; }
+
+	ProfileStageTimes operator-(const ProfileStageTimes& other) const
+	{
+		ProfileStageTimes result;
+		for (size_t i = 0; i < (size_t)ProfileStage::Count; i++)
+			result.Milliseconds[i] = Milliseconds[i] - other.Milliseconds[i];
+		return result;
+	}
+};
+
+// Process wide, every thread records into its own slot and never waits on another one. Stage time only ever adds up,
+// the difference between two GetStageTimes() calls is what happened in between. While a capture runs, scopes also
+// leave trace events that EndCapture writes as Chrome trace_event JSON (chrome://tracing or ui.perfetto.dev)
+namespace Profiler
+{
+	// ns on a steady clock
+	uint64_t Now();
+
+	// Shows up as the thread's name in traces, the first call per thread wins
+	void SetThreadName(const std::string& name);
+
+	void AddStageTime(ProfileStage stage, uint64_t nanoseconds);
+
+	// name has to outlive the capture, string literals only. Dropped unless a capture is running
+	void AddEvent(const char* name, uint64_t start, uint64_t end);
+	void AddCounter(const char* name, double value);
+
+	ProfileStageTimes GetStageTimes();
+
+	void BeginCapture();
+	bool IsCapturing();
+
+	// Stops the capture and writes every event since BeginCapture, false if nothing was capturing or the file failed
+	bool EndCapture(const std::string& filepath);
+}
+
+// Trace event for its lifetime, also counted as stage time when it has one
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name, ProfileStage stage = ProfileStage::Count)
+		: m_Name(name), m_Stage(stage), m_Start(Profiler::Now()) {}
+	explicit ProfileScope(ProfileStage stage)
+		: ProfileScope(GetProfileStageName(stage), stage) {}
+
+	~ProfileScope()
+	{
+		uint64_t end = Profiler::Now();
+		if (m_Stage != ProfileStage::Count)
+			Profiler::AddStageTime(m_Stage, end - m_Start);
+		Profiler::AddEvent(m_Name, m_Start, end);
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char* m_Name;
+	ProfileStage m_Stage;
+	uint64_t m_Start;
+};
+
+// Splits a stretch of time between stages with one clock read per switch and no trace events, for loops where a scope
+// per stage would cost more than the stage. Reported when it goes out of scope
+class ProfileLaps
+{
+public:
+	ProfileLaps() : m_Last(Profiler::Now()) {}
+
+	// Everything since the last lap belonged to stage
+	void Lap(ProfileStage stage)
+	{
+		uint64_t now = Profiler::Now();
+		m_Times[(size_t)stage] += now - m_Last;
+		m_Last = now;
+	}
+
+	~ProfileLaps()
+	{
+		for (size_t i = 0; i < (size_t)ProfileStage::Count; i++)
+		{
+			if (m_Times[i] > 0)
+				Profiler::AddStageTime((ProfileStage)i, m_Times[i]);
+		}
+	}
+
+	ProfileLaps(const ProfileLaps&) = delete;
+	ProfileLaps& operator=(const ProfileLaps&) = delete;
+
+private:
+	uint64_t m_Times[(size_t)ProfileStage::Count] = {};
+	uint64_t m_Last;
+};
+
+#define RT_PROFILE_CONCAT_INNER(a, b) a##b
+#define RT_PROFILE_CONCAT(a, b) RT_PROFILE_CONCAT_INNER(a, b)
+
+#if RT_PROFILE
+	// A name (string literal) or a ProfileStage, to the end of the enclosing block
+	#define RT_PROFILE_SCOPE(...) ProfileScope RT_PROFILE_CONCAT(profileScope, __LINE__)(__VA_ARGS__)
+	#define RT_PROFILE_LAPS(laps) ProfileLaps laps
+	#define RT_PROFILE_LAP(laps, stage) laps.Lap(stage)
+	#define RT_PROFILE_THREAD(name) Profiler::SetThreadName(name)
+	#define RT_PROFILE_COUNTER(name, value) Profiler::AddCounter(name, value)
+#else
+	#define RT_PROFILE_SCOPE(...)
+	#define RT_PROFILE_LAPS(laps)
+	#define RT_PROFILE_LAP(laps, stage)
+	#define RT_PROFILE_THREAD(name)
+	#define RT_PROFILE_COUNTER(name, value)
+#endif
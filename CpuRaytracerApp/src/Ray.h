@@ -2,8 +2,17 @@
 
 #include <glm/glm.hpp>
 
+#include "Simd.h"
+
 struct Ray
 {
 	glm::vec3 Origin;
 	glm::vec3 Direction;
+};
+
+// Simd::Width rays traced together, one ray per lane
+struct RayPacket
+{
+	Simd::Float OriginX, OriginY, OriginZ;
+	Simd::Float DirectionX, DirectionY, DirectionZ;
 };
\ No newline at end of file
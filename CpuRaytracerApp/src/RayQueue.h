@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Memory.h"
+#include "Ray.h"
+#include "Simd.h"
+
+// Paths of the wavefront integrator, one array per component so Simd::Width consecutive paths load straight into a
+// RayPacket. Paths that end are compacted away between bounces, every stage runs over the first Count entries only.
+// Capacity is padded to a multiple of Simd::Width, so the last packet never reads past the end
+struct RayQueue
+{
+	AlignedVector<float> OriginX, OriginY, OriginZ;
+	AlignedVector<float> DirectionX, DirectionY, DirectionZ;
+
+	// Written by the extend stage, read by shading
+	AlignedVector<float> HitDistance;
+	AlignedVector<int32_t> ObjectIndex, PrimitiveIndex;
+
+	// Travels with the path when the queue is compacted
+	AlignedVector<uint32_t> Pixel; // x + y * width
+	AlignedVector<float> ColorR, ColorG, ColorB;
+
+	uint32_t Count = 0;
+
+	// Only ever grows, so a queue reused every frame stops allocating after the first one
+	void Reserve(uint32_t capacity)
+	{
+		capacity = (capacity + Simd::Width - 1) / Simd::Width * Simd::Width;
+		if (capacity <= OriginX.size())
+			return;
+
+		for (AlignedVector<float>* values : { &OriginX, &OriginY, &OriginZ, &DirectionX, &DirectionY, &DirectionZ, &HitDistance, &ColorR, &ColorG, &ColorB })
+			values->resize(capacity);
+
+		ObjectIndex.resize(capacity);
+		PrimitiveIndex.resize(capacity);
+		Pixel.resize(capacity);
+	}
+
+	void Push(const Ray& ray, uint32_t pixel)
+	{
+		SetRay(Count, ray);
+		Pixel[Count] = pixel;
+		ColorR[Count] = ColorG[Count] = ColorB[Count] = 0.0f;
+		Count++;
+	}
+
+	Ray GetRay(uint32_t index) const
+	{
+		Ray ray;
+		ray.Origin = { OriginX[index], OriginY[index], OriginZ[index] };
+		ray.Direction = { DirectionX[index], DirectionY[index], DirectionZ[index] };
+		return ray;
+	}
+
+	void SetRay(uint32_t index, const Ray& ray)
+	{
+		OriginX[index] = ray.Origin.x; OriginY[index] = ray.Origin.y; OriginZ[index] = ray.Origin.z;
+		DirectionX[index] = ray.Direction.x; DirectionY[index] = ray.Direction.y; DirectionZ[index] = ray.Direction.z;
+	}
+
+	// Paths first to first + Simd::Width - 1, lanes past Count hold stale data and have to be masked out
+	RayPacket LoadPacket(uint32_t first) const
+	{
+		RayPacket packet;
+		packet.OriginX = Simd::Load(OriginX.data() + first);
+		packet.OriginY = Simd::Load(OriginY.data() + first);
+		packet.OriginZ = Simd::Load(OriginZ.data() + first);
+		packet.DirectionX = Simd::Load(DirectionX.data() + first);
+		packet.DirectionY = Simd::Load(DirectionY.data() + first);
+		packet.DirectionZ = Simd::Load(DirectionZ.data() + first);
+		return packet;
+	}
+
+	// Keeps the path at from in slot to, from >= to so compacting in place never overwrites a path still to be read
+	void Move(uint32_t from, uint32_t to)
+	{
+		if (from == to)
+			return;
+
+		Pixel[to] = Pixel[from];
+		ColorR[to] = ColorR[from];
+		ColorG[to] = ColorG[from];
+		ColorB[to] = ColorB[from];
+	}
+};
@@ -0,0 +1,110 @@
+#include "RaySorter.h"
+
+#include <algorithm>
+
+// A tile's queue holds a few thousand paths, 32 cells per axis already puts most of them in a cell of their own.
+// With the octant below the key has 18 bits, two radix passes
+static constexpr uint32_t s_MortonBits = 5;
+static constexpr uint32_t s_KeyBits = s_MortonBits * 3 + 3;
+static constexpr uint32_t s_DigitBits = (s_KeyBits + 1) / 2;
+
+// abcde -> a00b00c00d00e, so three of them interleave into a Morton code
+static uint32_t SpreadBits(uint32_t value)
+{
+	value &= 0x1f;
+	value = (value | (value << 8)) & 0x0300f00f;
+	value = (value | (value << 4)) & 0x030c30c3;
+	value = (value | (value << 2)) & 0x09249249;
+	return value;
+}
+
+void RaySorter::Sort(RayQueue& queue, Arena& scratch)
+{
+	uint32_t count = queue.Count;
+	if (count < 2)
+		return;
+
+	uint32_t* keys = scratch.Allocate<uint32_t>(count);
+	uint32_t* indices = scratch.Allocate<uint32_t>(count);
+	uint32_t* tempKeys = scratch.Allocate<uint32_t>(count);
+	uint32_t* tempIndices = scratch.Allocate<uint32_t>(count);
+	m_Sorted.Reserve((uint32_t)queue.OriginX.size());
+
+	const float* originX = queue.OriginX.data();
+	const float* originY = queue.OriginY.data();
+	const float* originZ = queue.OriginZ.data();
+
+	float minX = originX[0], minY = originY[0], minZ = originZ[0];
+	float maxX = minX, maxY = minY, maxZ = minZ;
+	for (uint32_t i = 1; i < count; i++)
+	{
+		minX = std::min(minX, originX[i]); maxX = std::max(maxX, originX[i]);
+		minY = std::min(minY, originY[i]); maxY = std::max(maxY, originY[i]);
+		minZ = std::min(minZ, originZ[i]); maxZ = std::max(maxZ, originZ[i]);
+	}
+
+	// Just under the cell count, so the far end of the bounds still lands in the last cell
+	constexpr float cells = (float)(1 << s_MortonBits) - 0.01f;
+	float scaleX = cells / std::max(maxX - minX, 1e-20f);
+	float scaleY = cells / std::max(maxY - minY, 1e-20f);
+	float scaleZ = cells / std::max(maxZ - minZ, 1e-20f);
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t morton = SpreadBits((uint32_t)((originX[i] - minX) * scaleX))
+			| (SpreadBits((uint32_t)((originY[i] - minY) * scaleY)) << 1)
+			| (SpreadBits((uint32_t)((originZ[i] - minZ) * scaleZ)) << 2);
+
+		uint32_t octant = (queue.DirectionX[i] < 0.0f ? 1 : 0) | (queue.DirectionY[i] < 0.0f ? 2 : 0) | (queue.DirectionZ[i] < 0.0f ? 4 : 0);
+
+		// Origin first, packets whose lanes start far apart visit the union of their paths through the BVH. Octant first
+		// made the directions more coherent but saved fewer nodes, most reflected rays end on something close by
+		keys[i] = (morton << 3) | octant;
+		indices[i] = i;
+	}
+
+	// LSD radix sort. Stable, so paths with equal keys keep their order
+	constexpr uint32_t digits = 1 << s_DigitBits;
+	for (uint32_t shift = 0; shift < s_KeyBits; shift += s_DigitBits)
+	{
+		uint32_t offsets[digits] = {};
+		for (uint32_t i = 0; i < count; i++)
+			offsets[(keys[i] >> shift) & (digits - 1)]++;
+
+		// A digit every key shares would only copy
+		if (offsets[(keys[0] >> shift) & (digits - 1)] == count)
+			continue;
+
+		uint32_t sum = 0;
+		for (uint32_t& offset : offsets)
+		{
+			uint32_t digitCount = offset;
+			offset = sum;
+			sum += digitCount;
+		}
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint32_t target = offsets[(keys[i] >> shift) & (digits - 1)]++;
+			tempKeys[target] = keys[i];
+			tempIndices[target] = indices[i];
+		}
+
+		std::swap(keys, tempKeys);
+		std::swap(indices, tempIndices);
+	}
+
+	// Hit records are not carried over, the next extend overwrites them anyway
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t from = indices[i];
+		m_Sorted.SetRay(i, queue.GetRay(from));
+		m_Sorted.Pixel[i] = queue.Pixel[from];
+		m_Sorted.ColorR[i] = queue.ColorR[from];
+		m_Sorted.ColorG[i] = queue.ColorG[from];
+		m_Sorted.ColorB[i] = queue.ColorB[from];
+	}
+
+	m_Sorted.Count = count;
+	std::swap(queue, m_Sorted);
+}
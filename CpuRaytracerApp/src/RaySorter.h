@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Memory.h"
+#include "RayQueue.h"
+
+// Reorders the paths of a wavefront queue so neighbours in the queue, and with them the lanes of a packet, start close
+// together and head the same way. The key is a Morton code of the origin, quantized within the bounds of the queue's
+// own origins, with the direction octant in the low bits. A radix sort over the keys, then every path is gathered into
+// a second queue that is swapped in. Keys and indices come from scratch, so sorting allocates nothing once the second
+// queue and the arena are big enough
+class RaySorter
+{
+public:
+	void Sort(RayQueue& queue, Arena& scratch);
+
+private:
+	RayQueue m_Sorted;
+};
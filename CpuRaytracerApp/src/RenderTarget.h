@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+// A finished frame as the renderer hands it out, the pointers are only valid until the next Render or OnResize.
+// Row 0 is the bottom of the image
+struct FrameView
+{
+	uint32_t Width = 0, Height = 0;
+
+	const uint32_t* Pixels = nullptr; // RGBA8, clamped to 0 - 1
+
+	// HDR running sum, divide by SampleCount for the average
+	const glm::vec4* Accumulation = nullptr;
+	uint32_t SampleCount = 0;
+};
+
+// Where finished frames go, so the renderer does not need to know about Vulkan images or files
+class RenderTarget
+{
+public:
+	virtual ~RenderTarget() = default;
+
+	virtual void Present(const FrameView& frame) = 0;
+};
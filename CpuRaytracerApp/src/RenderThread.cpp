@@ -0,0 +1,218 @@
+#include "RenderThread.h"
+
+#include <chrono>
+
+RenderThread::RenderThread()
+{
+	m_Thread = std::thread(&RenderThread::Run, this);
+}
+
+RenderThread::~RenderThread()
+{
+	m_Running = false;
+	m_Thread.join();
+}
+
+void RenderThread::Submit(const RenderState& state)
+{
+	// Only settings and the scene edits the render thread has not seen yet, assigning reuses the back buffer's vectors
+	m_States.GetWriteBuffer() = state;
+	m_States.Publish();
+}
+
+void RenderThread::Run()
+{
+	RT_PROFILE_THREAD("Render Thread");
+
+	while (m_Running)
+	{
+		if (m_States.Acquire())
+		{
+			ApplyState(m_States.GetReadBuffer());
+			m_HasState = true;
+		}
+
+		if (!m_HasState || m_State.ViewportWidth == 0 || m_State.ViewportHeight == 0)
+		{
+			// Nothing to draw yet, do not spin on a core the UI might want
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		UpdateRenderSize();
+
+		auto start = std::chrono::steady_clock::now();
+
+		if (!m_Renderer.Render(m_Scene, m_State.CameraData))
+		{
+			// Still image and nothing left to accumulate, wait for the UI to change something
+			m_SkippedFrameCount.store(m_Renderer.GetSkippedFrameCount(), std::memory_order_relaxed);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		m_LastRenderTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		PublishFrame(m_LastRenderTime);
+	}
+}
+
+void RenderThread::ApplyState(RenderState& next)
+{
+	// The renderer compares camera and scene versions itself, only resets and geometry edits need to be passed on
+	if (next.ResetCount != m_State.ResetCount)
+		m_Renderer.ResetFrameIndex();
+
+	const SceneEdits& edits = next.SceneChanges;
+	bool sceneEdited = !m_HasState || edits.Version != m_Scene.Version;
+
+	// Camera moves and scene edits drop to a lower render scale until things settle again
+	if (!m_HasState || next.CameraData.GetVersion() != m_CameraVersion || sceneEdited)
+		m_LastMotion = std::chrono::steady_clock::now();
+	m_CameraVersion = next.CameraData.GetVersion();
+
+	// A replaced scene is copied once, everything after it comes as single edits
+	if (edits.NewScene && (!m_HasState || edits.NewScene->Version > m_Scene.Version))
+	{
+		m_Scene = *edits.NewScene;
+		m_Renderer.OnSceneChanged();
+		m_Renderer.OnInstancesChanged();
+	}
+
+	if (sceneEdited)
+	{
+		// Only moved or resized spheres and moved instances touch the hierarchies, a new albedo is just read from the scene
+		for (const auto& [index, sphere] : edits.Spheres)
+		{
+			Sphere& current = m_Scene.Spheres[index];
+			if (sphere.Position != current.Position || sphere.Radius != current.Radius)
+				m_Renderer.OnSphereChanged(index);
+			current = sphere;
+		}
+
+		for (const auto& [index, transform] : edits.InstanceTransforms)
+		{
+			Instance& current = m_Scene.Instances[index];
+			if (transform != current.Transform)
+				m_Renderer.OnInstanceMoved(index);
+			current.Transform = transform;
+		}
+
+		m_Scene.Version = edits.Version;
+	}
+
+	m_Renderer.GetSettings() = next.Settings;
+	m_Renderer.SetBounces(next.Bounces);
+	m_Renderer.SetThreadCount(next.ThreadCount);
+	m_Renderer.SetTileSize(next.TileSize);
+	m_Renderer.SetBVHCacheDirectory(next.BVHCacheDirectory);
+
+	// Swapped rather than copied, the read buffer is ours until the next Acquire and gets overwritten by the UI anyway
+	std::swap(m_State, next);
+
+	// Our copy is taken, the UI drops its own reference once it sees the version
+	m_State.SceneChanges.NewScene.reset();
+	m_AppliedSceneVersion.store(m_Scene.Version, std::memory_order_release);
+}
+
+void RenderThread::UpdateRenderSize()
+{
+	float timeSinceMotion = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_LastMotion).count();
+	float scale = m_DynamicResolution.Update(m_State.Resolution, m_LastRenderTime, timeSinceMotion);
+
+	uint32_t width = glm::max((uint32_t)((float)m_State.ViewportWidth * scale + 0.5f), 1u);
+	uint32_t height = glm::max((uint32_t)((float)m_State.ViewportHeight * scale + 0.5f), 1u);
+
+	// Both return early if the size did not change, otherwise accumulation restarts at the new size
+	m_State.CameraData.OnResize(width, height);
+	m_Renderer.OnResize(width, height);
+}
+
+void RenderThread::PublishFrame(float renderTime)
+{
+	RenderedFrame& frame = m_Frames.GetWriteBuffer();
+	RT_PROFILE_SCOPE("Publish");
+
+	FrameView view = m_Renderer.GetFrame();
+	frame.Width = m_State.ViewportWidth;
+	frame.Height = m_State.ViewportHeight;
+	frame.RenderWidth = view.Width;
+	frame.RenderHeight = view.Height;
+
+	// Scoped so it is counted before the stage times are read below
+	{
+		RT_PROFILE_SCOPE(ProfileStage::Conversion);
+
+		if (view.Width == frame.Width && view.Height == frame.Height)
+		{
+			frame.Pixels.assign(view.Pixels, view.Pixels + (size_t)view.Width * view.Height);
+		}
+		else
+		{
+			frame.Pixels.resize((size_t)frame.Width * frame.Height);
+			m_UpscaleColumns.Update(view.Width, frame.Width);
+
+			ThreadPool& threadPool = m_Renderer.GetThreadPool();
+			m_WorkerArenas.resize(threadPool.GetThreadCount());
+
+			// One capture for all of it, so the job fits into std::function without a heap allocation
+			struct UpscaleJob
+			{
+				const uint32_t* Source;
+				uint32_t SourceHeight;
+				uint32_t* Destination;
+				uint32_t Height;
+			} job{ view.Pixels, view.Height, frame.Pixels.data(), frame.Height };
+
+			// Touches every viewport pixel, so it is split into bands on the renderer's workers
+			constexpr uint32_t bandHeight = 32;
+			uint32_t bandCount = (frame.Height + bandHeight - 1) / bandHeight;
+			threadPool.ParallelFor(bandCount, [this, &job](uint32_t band, uint32_t workerIndex)
+				{
+					Arena& scratch = m_WorkerArenas[workerIndex];
+					scratch.Reset();
+
+					uint32_t* blended = scratch.Allocate<uint32_t>(m_UpscaleColumns.SourceWidth + 1);
+					UpscaleBilinear(job.Source, job.SourceHeight, m_UpscaleColumns, job.Destination, job.Height, band * bandHeight,
+						(band + 1) * bandHeight, blended);
+				});
+		}
+	}
+
+	frame.SampleCount = view.SampleCount;
+	frame.RenderTime = renderTime;
+	frame.ThreadCount = m_Renderer.GetThreadCount();
+	frame.Stats = m_Renderer.GetTraversalStats();
+	frame.WorkerStats = m_Renderer.GetWorkerStats();
+	frame.Counters = m_Renderer.GetPerfCounters();
+	frame.WorkerCounters = m_Renderer.GetWorkerPerfCounters();
+	frame.CounterError = PerfCounters::GetError();
+
+	ProfileStageTimes stageTimes = Profiler::GetStageTimes();
+	frame.StageTimes = stageTimes - m_LastStageTimes;
+	m_LastStageTimes = stageTimes;
+
+	float raysPerSecond = (float)frame.Stats.Rays / glm::max(renderTime, 1e-3f) * 1e-3f;
+	if (m_RaysPerSecond.size() == RaysPerSecondHistory)
+		m_RaysPerSecond.erase(m_RaysPerSecond.begin());
+	m_RaysPerSecond.push_back(raysPerSecond);
+	frame.RaysPerSecond = m_RaysPerSecond;
+	RT_PROFILE_COUNTER("Mrays/s", raysPerSecond);
+
+	const BVH& bvh = m_Renderer.GetBVH();
+	frame.BVHActive = m_Renderer.IsBVHActive();
+	frame.BVHNodeCount = bvh.GetNodeCount();
+	frame.BVHBuildTime = bvh.GetBuildTime();
+	frame.BVHCost = frame.BVHActive ? bvh.GetCost() : 0.0f;
+	frame.BVHCostRatio = bvh.GetCostRatio();
+	frame.BVHRefitCount = bvh.GetRefitCount();
+	frame.BVHBuildCount = m_Renderer.GetBVHBuildCount();
+	frame.BVHCache = m_Renderer.GetBVHCacheStats();
+
+	const InstanceBVH& instances = m_Renderer.GetInstanceBVH();
+	frame.InstanceCount = instances.GetInstanceCount();
+	frame.InstanceGeometryCount = instances.GetGeometryCount();
+	frame.InstanceNodeCount = instances.GetBVH().GetNodeCount();
+	frame.InstanceRefitCount = instances.GetBVH().GetRefitCount();
+
+	m_Frames.Publish();
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DynamicResolution.h"
+#include "Profiler.h"
+#include "Renderer.h"
+#include "TripleBuffer.h"
+
+// What the UI changed in its scene since the version the render thread last reported as applied. Skipped states are
+// covered that way, and entries hold the latest values so applying one twice does nothing
+struct SceneEdits
+{
+	// Set after the UI replaced its scene as a whole (loaded one, made it editable) until the render thread has copied it
+	std::shared_ptr<const Scene> NewScene;
+
+	std::vector<std::pair<uint32_t, Sphere>> Spheres;
+	std::vector<std::pair<uint32_t, glm::mat4>> InstanceTransforms;
+
+	// Of the UI's scene, the render thread's copy has it once these are applied
+	uint64_t Version = 0;
+};
+
+// Everything a frame depends on. The UI edits its own copy and submits it whenever something changed
+struct RenderState
+{
+	SceneEdits SceneChanges; // The first submitted state has a NewScene
+	Camera CameraData{ 45.0f, 0.1f, 100.0f };
+
+	Renderer::Settings Settings;
+	uint32_t Bounces = 3;
+	uint32_t ThreadCount = 0; // 0 means one per hardware thread
+	uint32_t TileSize = 32;
+
+	// Where built BVHs of large scenes are kept between runs, empty always builds
+	std::string BVHCacheDirectory;
+
+	uint32_t ViewportWidth = 0, ViewportHeight = 0;
+
+	// Renders below the viewport size while the view moves, frames are upscaled before they are published
+	DynamicResolutionSettings Resolution;
+
+	// Bump it instead of calling into the renderer to restart accumulation.
+	// Camera moves are found through the camera version and scene edits through SceneChanges.Version
+	uint64_t ResetCount = 0;
+};
+
+// Published after every frame, together with the stats the UI shows
+struct RenderedFrame
+{
+	uint32_t Width = 0, Height = 0; // Always the viewport size
+	std::vector<uint32_t> Pixels; // RGBA8
+
+	// Size it was traced at before the upscale
+	uint32_t RenderWidth = 0, RenderHeight = 0;
+
+	uint32_t SampleCount = 0;
+	float RenderTime = 0.0f; // ms
+	uint32_t ThreadCount = 0;
+
+	TraversalStats Stats;
+	std::vector<TraversalStats> WorkerStats;
+
+	// Stage time recorded by any thread since the previous frame, uploads of earlier frames by the UI included
+	ProfileStageTimes StageTimes;
+
+	// Empty while Settings::HardwareCounters is off, CounterError says why when it is on and still empty
+	PerfCounterStats Counters;
+	std::vector<PerfCounterStats> WorkerCounters;
+	const char* CounterError = nullptr;
+
+	// Mrays/s of the last RaysPerSecondHistory frames, oldest first
+	std::vector<float> RaysPerSecond;
+
+	bool BVHActive = false;
+	uint32_t BVHNodeCount = 0;
+	float BVHBuildTime = 0.0f;
+	float BVHCost = 0.0f;
+	float BVHCostRatio = 1.0f;
+	uint32_t BVHRefitCount = 0;
+	uint32_t BVHBuildCount = 0;
+	BVHCacheStats BVHCache;
+
+	// Top level over the instances, built over InstanceGeometryCount unique blocks
+	uint32_t InstanceCount = 0;
+	uint32_t InstanceGeometryCount = 0;
+	uint32_t InstanceNodeCount = 0;
+	uint32_t InstanceRefitCount = 0;
+};
+
+// Owns a Renderer and keeps tracing on its own thread. States come in and frames go out through triple buffers,
+// so the UI never waits for a frame and always gets the latest finished one
+class RenderThread
+{
+public:
+	static constexpr uint32_t RaysPerSecondHistory = 120;
+
+	RenderThread();
+	~RenderThread();
+
+	RenderThread(const RenderThread&) = delete;
+	RenderThread& operator=(const RenderThread&) = delete;
+
+	// Copies the state, the render thread switches to it before its next frame. Never blocks
+	void Submit(const RenderState& state);
+
+	// Scene version of the last state the render thread picked up, edits up to it no longer need to be sent along
+	uint64_t GetAppliedSceneVersion() const { return m_AppliedSceneVersion.load(std::memory_order_acquire); }
+
+	// True if a frame finished since the last call, GetFrame() then returns it
+	bool AcquireFrame() { return m_Frames.Acquire(); }
+	const RenderedFrame& GetFrame() const { return m_Frames.GetReadBuffer(); }
+
+	// Iterations where the renderer found nothing to do and no frame was published
+	uint64_t GetSkippedFrameCount() const { return m_SkippedFrameCount.load(std::memory_order_relaxed); }
+
+private:
+	void Run();
+
+	// Tells the renderer what changed between m_State and next, then takes next over
+	void ApplyState(RenderState& next);
+
+	// Sizes the renderer and the camera copy for the current render scale
+	void UpdateRenderSize();
+
+	void PublishFrame(float renderTime);
+
+private:
+	Renderer m_Renderer;
+	RenderState m_State; // What is being rendered, only touched by the render thread
+	Scene m_Scene; // Kept up to date through SceneChanges, the renderer holds on to its address
+	bool m_HasState = false;
+
+	DynamicResolution m_DynamicResolution;
+	uint64_t m_CameraVersion = 0; // Of the submitted camera, the copy gets resized to the render scale
+	std::chrono::steady_clock::time_point m_LastMotion;
+	float m_LastRenderTime = 0.0f;
+
+	// Upscaling to the viewport, column taps only change with the sizes and every worker blends its rows in its own arena
+	UpscaleColumns m_UpscaleColumns;
+	std::vector<Arena> m_WorkerArenas;
+
+	ProfileStageTimes m_LastStageTimes;
+	std::vector<float> m_RaysPerSecond;
+
+	TripleBuffer<RenderState> m_States;
+	TripleBuffer<RenderedFrame> m_Frames;
+
+	std::atomic<uint64_t> m_SkippedFrameCount{ 0 };
+	std::atomic<uint64_t> m_AppliedSceneVersion{ 0 };
+
+	std::atomic<bool> m_Running{ true };
+	std::thread m_Thread;
+};
@@ -1,70 +1,937 @@
 #include "Renderer.h"
-#include <Walnut/Random.h>
 
+#include <algorithm>
+#include <cassert>
 
-void Renderer::Render(const Scene& scene, const Camera& camera)
+#include "Profiler.h"
+#include "SphereIntersection.h"
+
+
+// Grayscale, white for pixels that took a sample every frame
+static void WriteSampleCountView(const uint32_t* sampleCounts, uint32_t* rgba, uint32_t count, uint32_t frameSamples)
+{
+	float scale = 255.0f / (float)glm::max(frameSamples, 1u);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t value = (uint32_t)glm::min((float)sampleCounts[i] * scale + 0.5f, 255.0f);
+		rgba[i] = 0xff000000 | (value << 16) | (value << 8) | value;
+	}
+}
+
+static bool IsCostView(Renderer::DebugView view)
+{
+	return view >= Renderer::DebugView::IntersectionTests;
+}
+
+// Per sample, what a cost view shows of the pixel
+static float GetPixelCostValue(const PixelCost& cost, uint32_t samples, Renderer::DebugView view)
+{
+	if (samples == 0)
+		return 0.0f;
+
+	float scale = 1.0f / (float)samples;
+	switch (view)
+	{
+	case Renderer::DebugView::IntersectionTests: return cost.PrimitivesTested * scale;
+	case Renderer::DebugView::NodesVisited: return cost.NodesVisited * scale;
+	case Renderer::DebugView::BounceDepth: return glm::max(cost.Rays * scale - 1.0f, 0.0f);
+	case Renderer::DebugView::Time: return cost.Nanoseconds * scale;
+	default: return 0.0f;
+	}
+}
+
+// Polynomial fit of the Turbo colormap, dark blue over cyan, green and yellow to dark red. Unlike a rainbow it stays
+// perceptually even enough that equal steps in cost look like equal steps in color
+static glm::vec3 GetCostRampColor(float t)
+{
+	t = glm::clamp(t, 0.0f, 1.0f);
+	glm::vec4 t4(1.0f, t, t * t, t * t * t);
+	glm::vec2 t2 = glm::vec2(t4.z, t4.w) * t4.z;
+
+	glm::vec3 color(
+		glm::dot(t4, glm::vec4(0.13572138f, 4.61539260f, -42.66032258f, 132.13108234f)) + glm::dot(t2, glm::vec2(-152.94239396f, 59.28637943f)),
+		glm::dot(t4, glm::vec4(0.09140261f, 2.19418839f, 4.84296658f, -14.18503333f)) + glm::dot(t2, glm::vec2(4.27729857f, 2.82956604f)),
+		glm::dot(t4, glm::vec4(0.10667330f, 12.64194608f, -60.58204836f, 110.36276771f)) + glm::dot(t2, glm::vec2(-89.90310912f, 27.34824973f)));
+	return glm::clamp(color, glm::vec3(0.0f), glm::vec3(1.0f));
+}
+
+static void WriteCostView(const PixelCost* costs, const uint32_t* sampleCounts, uint32_t* rgba, uint32_t count, Renderer::DebugView view, float maxCost)
+{
+	float scale = maxCost > 0.0f ? 1.0f / maxCost : 0.0f;
+	for (uint32_t i = 0; i < count; i++)
+		rgba[i] = Utils::ConvertToRGBA(glm::vec4(GetCostRampColor(GetPixelCostValue(costs[i], sampleCounts[i], view) * scale), 1.0f));
+}
+
+// The work between before and after, share splits a packet's over its lanes. Starts the clock over for the next pixel
+static PixelCost GetPixelCost(const TraversalStats& before, const TraversalStats& after, uint64_t& start, float share)
 {
+	uint64_t now = Profiler::Now();
+
+	PixelCost cost;
+	cost.PrimitivesTested = (float)(after.PrimitivesTested - before.PrimitivesTested) * share;
+	cost.NodesVisited = (float)(after.NodesVisited - before.NodesVisited) * share;
+	cost.Rays = (float)(after.Rays - before.Rays) * share;
+	cost.Nanoseconds = (float)(now - start) * share;
+
+	start = now;
+	return cost;
+}
+
+bool Renderer::Render(const Scene& scene, const Camera& camera)
+{
+	RT_PROFILE_SCOPE("Render");
+
+	if (&scene != m_ActiveScene || scene.Version != m_SceneVersion || &camera != m_ActiveCamera || camera.GetVersion() != m_CameraVersion
+		|| m_Settings.Accumulate != m_FrameAccumulate || (IsCostView(m_Settings.View) && !m_CollectCosts))
+		ResetFrameIndex();
+
+	// A still image only needs more samples while accumulating and while adaptive sampling still found pixels to trace,
+	// a new tonemap or debug view only needs the conversion pass
+	bool converged = m_Settings.AdaptiveThreshold > 0.0f && m_SampleCount > 0 && m_TraversalStats.Samples == 0;
+	bool trace = m_FrameDirty || (m_Settings.Accumulate && !converged && (m_Settings.MaxSamples == 0 || m_SampleCount < m_Settings.MaxSamples));
+	if (!trace && m_Settings.Tonemap == m_FrameTonemap && m_Settings.View == m_FrameView)
+	{
+		m_SkippedFrameCount++;
+		return false;
+	}
+
+	m_FrameArena.Reset();
+
+#if RT_COUNT_ALLOCATIONS
+	// One more sample onto an image the earlier ones already set up scratch for. Workers track their allocations
+	// themselves, this thread only while it renders
+	bool steadyState = m_FrameIndex > 2 && m_Settings.Integrator == m_FrameIntegrator && m_Settings.SortSecondaryRays == m_FrameSortRays
+		&& m_ThreadPool.GetThreadCount() == m_FrameThreadCount && m_TileSize == m_FrameTileSize && m_Settings.View == m_FrameView
+		&& !Profiler::IsCapturing();
+	bool tracked = Memory::TrackThreadAllocations(true);
+	uint64_t allocationCount = Memory::GetTrackedAllocationCount();
+#endif
+
+	m_WorkerPerfCounters.assign(m_ThreadPool.GetThreadCount(), PerfCounterStats());
+
+	if (trace)
+		TraceFrame(scene, camera);
+
+	bool costView = IsCostView(m_Settings.View);
+	float maxCost = costView ? GetMaxPixelCost(m_Settings.View) : 0.0f;
+
+	// Conversion to RGBA8 is its own pass over the finished sums, tracing only writes HDR
+	m_ThreadPool.ParallelFor((uint32_t)m_Tiles.size(), [this, costView, maxCost](uint32_t tileIndex, uint32_t workerIndex)
+		{
+			RT_PROFILE_SCOPE(ProfileStage::Conversion);
+			PerfCounterScope counterScope(m_Settings.HardwareCounters ? &m_WorkerPerfCounters[workerIndex] : nullptr, ProfileStage::Conversion);
+
+			const Tile& tile = m_Tiles[tileIndex];
+			for (uint32_t y = tile.MinY; y < tile.MaxY; y++)
+			{
+				uint32_t index = tile.MinX + y * m_Width;
+				uint32_t count = tile.MaxX - tile.MinX;
+
+				if (m_Settings.View == DebugView::SampleCount)
+					WriteSampleCountView(m_PixelSampleCounts.GetData() + index, m_ImageData.GetData() + index, count, m_SampleCount);
+				else if (costView)
+					WriteCostView(m_PixelCostData.GetData() + index, m_PixelSampleCounts.GetData() + index, m_ImageData.GetData() + index, count,
+						m_Settings.View, maxCost);
+				else
+					Tonemap(m_AccumulationData.GetData() + index, m_ImageData.GetData() + index, count, m_SampleCount, m_Settings.Tonemap);
+			}
+
+			if (m_TileCallback)
+				m_TileCallback(tile);
+		});
+
+	m_PerfCounters = PerfCounterStats();
+	for (PerfCounterStats& counters : m_WorkerPerfCounters)
+	{
+		// Conversion jobs only counted into their stage, they belong to the frame all the same
+		counters.Frame += counters.Stages[(size_t)ProfileStage::Conversion];
+		m_PerfCounters += counters;
+	}
+
+	m_FrameTonemap = m_Settings.Tonemap;
+	m_FrameView = m_Settings.View;
+
+#if RT_COUNT_ALLOCATIONS
+	m_FrameAllocationCount = Memory::GetTrackedAllocationCount() - allocationCount;
+	Memory::TrackThreadAllocations(tracked);
+
+	// Everything per frame comes from buffers that were sized before, see m_FrameArena and m_WorkerArenas
+	assert((!steadyState || m_FrameAllocationCount == 0) && "Steady state frame allocated on the heap");
+#endif
+
+	if (m_Target)
+	{
+		RT_PROFILE_SCOPE("Present");
+		m_Target->Present(GetFrame());
+	}
+
+	return true;
+}
+
+void Renderer::TraceFrame(const Scene& scene, const Camera& camera)
+{
+	RT_PROFILE_SCOPE("Trace");
+
+	UpdateSceneData(scene);
+
 	m_ActiveScene = &scene;
 	m_ActiveCamera = &camera;
+	m_SceneVersion = scene.Version;
+	m_CameraVersion = camera.GetVersion();
+	m_FrameAccumulate = m_Settings.Accumulate;
+	m_FrameIntegrator = m_Settings.Integrator;
+	m_FrameSortRays = m_Settings.SortSecondaryRays;
+	m_FrameThreadCount = m_ThreadPool.GetThreadCount();
+	m_FrameTileSize = m_TileSize;
+	m_FrameDirty = false;
+	m_CollectCosts = IsCostView(m_Settings.View);
 
-	const glm::vec3& rayOrigin = camera.GetPosition();
+	UpdatePrimaryRayBasis(camera);
 
-	uint32_t width = m_FinalImage->GetWidth(), height = m_FinalImage->GetHeight();
-	float aspectRatio = width / (float)height;
+	if (m_FrameIndex == 1)
+	{
+		std::fill_n(m_AccumulationData.GetData(), m_AccumulationData.GetCount(), glm::vec4(0.0f));
+		std::fill_n(m_PixelSampleCounts.GetData(), m_PixelSampleCounts.GetCount(), 0u);
+		std::fill_n(m_LuminanceSquaredData.GetData(), m_LuminanceSquaredData.GetCount(), 0.0f);
+		if (m_CollectCosts)
+			std::fill_n(m_PixelCostData.GetData(), m_PixelCostData.GetCount(), PixelCost{});
+	}
+
+	m_WorkerStats.assign(m_ThreadPool.GetThreadCount(), TraversalStats());
 
-	for (uint32_t y = 0; y < m_FinalImage->GetHeight(); y++)
+	bool wavefront = m_Settings.Integrator == IntegratorMode::Wavefront;
+	if (wavefront)
 	{
-		for (uint32_t x = 0; x < m_FinalImage->GetWidth(); x++)
+		m_WorkerQueues.resize(m_ThreadPool.GetThreadCount());
+		m_WorkerSorters.resize(m_ThreadPool.GetThreadCount());
+		m_WorkerArenas.resize(m_ThreadPool.GetThreadCount());
+		for (RayQueue& queue : m_WorkerQueues)
+			queue.Reserve(m_TileSize * m_TileSize);
+	}
+
+	// Every tile is a job, idle workers steal tiles from busy ones
+	m_ThreadPool.ParallelFor((uint32_t)m_Tiles.size(), [this, wavefront](uint32_t tileIndex, uint32_t workerIndex)
 		{
-			// Generate the rays on a Per Pixel base
-			glm::vec4 color = RayGen(x, y);
+			RT_PROFILE_SCOPE("Tile");
+
+			PerfCounterStats* counters = m_Settings.HardwareCounters ? &m_WorkerPerfCounters[workerIndex] : nullptr;
+			PerfCounterScope counterScope(counters ? &counters->Frame : nullptr);
+
+			// Counted locally so workers do not fight over the same cache line
+			TraversalStats tileStats;
 
-			// Limit color channels ranges to 0.0f - 1.0f (change it so you can have HDR color data if you need)
-			color = glm::clamp(color, glm::vec4(0.0f), glm::vec4(1.0f));
+			const Tile& tile = m_Tiles[tileIndex];
+			if (wavefront)
+				RenderTileWavefront(tile, m_WorkerQueues[workerIndex], m_WorkerSorters[workerIndex], m_WorkerArenas[workerIndex], tileStats, counters);
+			else
+				RenderTile(tile, tileStats);
 
-			// Put the resulting color into our Frame Buffer at a defined index
-			m_ImageData[x + y * m_FinalImage->GetWidth()] = Utils::ConvertToRGBA(color); // PS. In an RT pipeline you should be writing to your fb from your raygen shader
+			m_WorkerStats[workerIndex] += tileStats;
+		});
+
+	m_TraversalStats = TraversalStats();
+	for (const TraversalStats& stats : m_WorkerStats)
+		m_TraversalStats += stats;
+
+	m_SampleCount = m_FrameIndex;
+
+	if (m_Settings.Accumulate)
+		m_FrameIndex++;
+	else
+		m_FrameIndex = 1;
+}
+
+static AABB GetSphereBounds(const Sphere& sphere)
+{
+	// The radius can be dragged negative in the UI, the intersection only sees its square
+	glm::vec3 extent(glm::abs(sphere.Radius));
+
+	AABB bounds;
+	bounds.Min = sphere.Position - extent;
+	bounds.Max = sphere.Position + extent;
+	return bounds;
+}
+
+void Renderer::UpdateSceneData(const Scene& scene)
+{
+	RT_PROFILE_SCOPE("Update Scene");
+
+	if (scene.Meshes != m_Meshes)
+	{
+		UpdateMeshData(scene);
+		ResetFrameIndex();
+	}
+
+	// Instances never rebuild bottom levels of blocks that were already in use, moves only refit the top level
+	if (m_InstancesDirty || &scene != m_ActiveScene || m_InstanceBVH.GetInstanceCount() != scene.Instances.size())
+	{
+		m_InstanceBVH.Build(scene.Instances, m_BVHCache);
+		m_InstancesDirty = false;
+		m_MovedInstances.clear();
+		ResetFrameIndex();
+	}
+	else if (!m_MovedInstances.empty())
+	{
+		for (uint32_t index : m_MovedInstances)
+			m_InstanceBVH.UpdateInstance(index, scene.Instances[index].Transform);
+		m_MovedInstances.clear();
+
+		if (m_InstanceBVH.GetBVH().GetCostRatio() > m_Settings.BVHRebuildCostRatio)
+			m_InstanceBVH.Build(scene.Instances, m_BVHCache);
+	}
+
+	uint32_t sphereCount = scene.GetSphereCount();
+	bool useBVH = sphereCount >= m_Settings.BVHThreshold;
+
+	// A different scene, added/removed spheres or a different mapping also invalidate the derived data
+	if (m_SceneDirty || &scene != m_ActiveScene || m_SphereSoA.GetCount() != sphereCount || scene.Mapped != m_MappedSpheres || useBVH != m_BVHActive)
+	{
+		// Mapped spheres are traced right where they are, held on to here so the file stays mapped while they are in use
+		m_MappedSpheres = scene.Mapped;
+		if (m_MappedSpheres)
+			m_SphereSoA.Reference(*m_MappedSpheres);
+		else
+			m_SphereSoA.Build(scene.Spheres);
+
+		m_BVHActive = useBVH;
+		if (m_BVHActive)
+			BuildBVH(scene);
+		else
+			m_BVH.Clear();
+
+		m_SceneDirty = false;
+		m_DirtySpheres.clear();
+
+		ResetFrameIndex();
+		return;
+	}
+
+	if (m_DirtySpheres.empty())
+		return;
+
+	for (uint32_t index : m_DirtySpheres)
+	{
+		if (index >= sphereCount || m_MappedSpheres)
+			continue;
+
+		const Sphere& sphere = scene.Spheres[index];
+		m_SphereSoA.Update(index, sphere);
+
+		if (m_BVHActive)
+		{
+			m_BVH.UpdatePrimitive(index, GetSphereBounds(sphere));
+			m_BVHSpheres[m_BVH.GetEntry(index)] = glm::vec4(sphere.Position, sphere.Radius * sphere.Radius);
 		}
 	}
 
-	// Sends pixels data to VRAM
-	m_FinalImage->SetData(m_ImageData);
+	m_DirtySpheres.clear();
+
+	// Refits keep the topology, once spheres wandered far from where they were built a rebuild pays off again
+	if (m_BVHActive && m_BVH.GetCostRatio() > m_Settings.BVHRebuildCostRatio)
+		BuildBVH(scene);
+}
+
+void Renderer::BuildBVH(const Scene& scene)
+{
+	uint32_t sphereCount = scene.GetSphereCount();
+
+	std::vector<AABB> bounds(sphereCount);
+	for (uint32_t i = 0; i < sphereCount; i++)
+		bounds[i] = GetSphereBounds(scene.GetSphere(i));
+
+	if (!m_BVHCache.LoadOrBuild(m_BVH, bounds))
+		m_BVHBuildCount++;
+
+	const uint32_t* indices = m_BVH.GetIndices();
+	m_BVHSpheres.resize(m_BVH.GetPrimitiveCount());
+	for (uint32_t i = 0; i < m_BVH.GetPrimitiveCount(); i++)
+	{
+		Sphere sphere = scene.GetSphere(indices[i]);
+		m_BVHSpheres[i] = glm::vec4(sphere.Position, sphere.Radius * sphere.Radius);
+	}
+}
+
+void Renderer::UpdateMeshData(const Scene& scene)
+{
+	m_Meshes = scene.Meshes;
+
+	m_MeshBVHs.clear();
+	m_MeshBVHs.resize(m_Meshes.size());
+	m_MeshFirstTriangles.resize(m_Meshes.size());
+
+	uint32_t firstTriangle = 0;
+	for (size_t i = 0; i < m_Meshes.size(); i++)
+	{
+		m_MeshBVHs[i].Build(*m_Meshes[i], m_BVHCache);
+		m_MeshFirstTriangles[i] = firstTriangle;
+		firstTriangle += m_Meshes[i]->GetTriangleCount();
+	}
+	m_MeshTriangleCount = firstTriangle;
+}
+
+glm::vec3 Renderer::GetAlbedo(int objectIndex, uint32_t primitiveIndex) const
+{
+	uint32_t sphereCount = m_SphereSoA.GetCount();
+	if ((uint32_t)objectIndex < sphereCount)
+		return m_ActiveScene->GetAlbedo(objectIndex);
+
+	int32_t firstInstance = GetFirstInstanceIndex();
+	if (objectIndex >= firstInstance)
+		return m_InstanceBVH.GetAlbedo(objectIndex - firstInstance, primitiveIndex);
+
+	size_t mesh = std::upper_bound(m_MeshFirstTriangles.begin(), m_MeshFirstTriangles.end(), objectIndex - sphereCount) - m_MeshFirstTriangles.begin() - 1;
+	return m_Meshes[mesh]->Albedo;
+}
+
+void Renderer::RenderTile(const Tile& tile, TraversalStats& stats)
+{
+	// Stages alternate every few pixels here, far too often for a scope each
+	RT_PROFILE_LAPS(laps);
+
+	for (uint32_t y = tile.MinY; y < tile.MaxY; y++)
+	{
+		if (!m_Settings.RayPackets)
+		{
+			for (uint32_t x = tile.MinX; x < tile.MaxX; x++)
+			{
+				if (IsPixelConverged(x + y * m_Width))
+				{
+					RepeatPixelAverage(x + y * m_Width);
+					continue;
+				}
+
+				TraversalStats before;
+				uint64_t start = 0;
+				if (m_CollectCosts)
+				{
+					before = stats;
+					start = Profiler::Now();
+				}
+
+				// Generate the rays on a Per Pixel base
+				glm::vec4 color = RayGen(x, y, stats);
+				stats.Samples++;
+
+				if (m_CollectCosts)
+					m_PixelCostData[x + y * m_Width] += GetPixelCost(before, stats, start, 1.0f);
+
+				AccumulatePixel(x, y, color);
+				RT_PROFILE_LAP(laps, ProfileStage::Shading);
+			}
+			continue;
+		}
+
+		// Neighbouring primary rays are very coherent, so a row segment goes down as one packet
+		for (uint32_t x = tile.MinX; x < tile.MaxX; x += Simd::Width)
+		{
+			uint32_t laneCount = glm::min(Simd::Width, tile.MaxX - x);
+
+			// Converged lanes are masked out (-1 marks the active ones), a packet only goes down if any lane still needs samples
+			alignas(64) int32_t laneActive[Simd::Width] = {};
+			bool anyActive = false;
+			for (uint32_t lane = 0; lane < laneCount; lane++)
+			{
+				uint32_t index = x + lane + y * m_Width;
+				if (IsPixelConverged(index))
+				{
+					RepeatPixelAverage(index);
+					continue;
+				}
+
+				laneActive[lane] = -1;
+				anyActive = true;
+			}
+
+			if (!anyActive)
+				continue;
 
-	m_FrameIndex++;
+			RayPacket packet = GeneratePrimaryPacket(x, y, laneCount);
+			RT_PROFILE_LAP(laps, ProfileStage::RayGeneration);
+
+			Simd::Mask active = Simd::LoadInt(laneActive) < Simd::Int(0);
+
+			TraversalStats before;
+			uint64_t start = 0;
+			if (m_CollectCosts)
+			{
+				before = stats;
+				start = Profiler::Now();
+			}
+
+			alignas(64) float hitDistances[Simd::Width];
+			alignas(64) int32_t objectIndices[Simd::Width];
+			alignas(64) int32_t primitiveIndices[Simd::Width];
+			TracePacket(packet, active, hitDistances, objectIndices, primitiveIndices, stats);
+			RT_PROFILE_LAP(laps, ProfileStage::Traversal);
+
+			PixelCost packetCost;
+			if (m_CollectCosts)
+				packetCost = GetPixelCost(before, stats, start, 1.0f / (float)Simd::Count(active));
+
+			alignas(64) float direction[3][Simd::Width];
+			Simd::Store(direction[0], packet.DirectionX);
+			Simd::Store(direction[1], packet.DirectionY);
+			Simd::Store(direction[2], packet.DirectionZ);
+
+			for (uint32_t lane = 0; lane < laneCount; lane++)
+			{
+				if (!laneActive[lane])
+					continue;
+
+				Ray ray;
+				ray.Origin = m_ActiveCamera->GetPosition();
+				ray.Direction = { direction[0][lane], direction[1][lane], direction[2][lane] };
+
+				if (m_CollectCosts)
+					before = stats;
+
+				HitPayload payload = objectIndices[lane] < 0
+					? Miss(ray)
+					: ClosestHit(ray, hitDistances[lane], objectIndices[lane], (uint32_t)primitiveIndices[lane]);
+
+				glm::vec4 color = TracePath(ray, payload, stats);
+				stats.Samples++;
+
+				if (m_CollectCosts)
+				{
+					PixelCost& cost = m_PixelCostData[x + lane + y * m_Width];
+					cost += packetCost;
+					cost += GetPixelCost(before, stats, start, 1.0f);
+				}
+
+				AccumulatePixel(x + lane, y, color);
+			}
+			RT_PROFILE_LAP(laps, ProfileStage::Shading);
+		}
+	}
+}
+
+void Renderer::RenderTileWavefront(const Tile& tile, RayQueue& queue, RaySorter& sorter, Arena& scratch, TraversalStats& stats, PerfCounterStats* counters)
+{
+	// Generate: primary rays of every pixel that still needs a sample, a row segment at a time
+	queue.Count = 0;
+	{
+		RT_PROFILE_SCOPE(ProfileStage::RayGeneration);
+		PerfCounterScope counterScope(counters, ProfileStage::RayGeneration);
+
+		glm::vec3 origin = m_ActiveCamera->GetPosition();
+		for (uint32_t y = tile.MinY; y < tile.MaxY; y++)
+		{
+			for (uint32_t x = tile.MinX; x < tile.MaxX; x += Simd::Width)
+			{
+				uint32_t laneCount = glm::min(Simd::Width, tile.MaxX - x);
+				RayPacket packet = GeneratePrimaryPacket(x, y, laneCount);
+
+				alignas(64) float direction[3][Simd::Width];
+				Simd::Store(direction[0], packet.DirectionX);
+				Simd::Store(direction[1], packet.DirectionY);
+				Simd::Store(direction[2], packet.DirectionZ);
+
+				for (uint32_t lane = 0; lane < laneCount; lane++)
+				{
+					uint32_t index = x + lane + y * m_Width;
+					if (IsPixelConverged(index))
+					{
+						RepeatPixelAverage(index);
+						continue;
+					}
+
+					Ray ray;
+					ray.Origin = origin;
+					ray.Direction = { direction[0][lane], direction[1][lane], direction[2][lane] };
+					queue.Push(ray, index);
+				}
+			}
+		}
+	}
+
+	stats.Samples += queue.Count;
+
+	// Ends a path, its color goes to its pixel
+	auto finish = [&](uint32_t path)
+	{
+		uint32_t pixel = queue.Pixel[path];
+		AccumulatePixel(pixel % m_Width, pixel / m_Width, glm::vec4(queue.ColorR[path], queue.ColorG[path], queue.ColorB[path], 1.0f));
+	};
+
+	float multiplier = 1.0f;
+	for (uint32_t bounce = 0; bounce < m_Bounces && queue.Count > 0; bounce++)
+	{
+		// Primary rays are coherent as generated, reflections scatter and get binned back together first
+		bool secondary = bounce > 0;
+		if (secondary && m_Settings.SortSecondaryRays)
+		{
+			RT_PROFILE_SCOPE(ProfileStage::Sorting);
+			PerfCounterScope counterScope(counters, ProfileStage::Sorting);
+			scratch.Reset();
+			sorter.Sort(queue, scratch);
+		}
+
+		if (secondary)
+			stats.SecondaryRays += queue.Count;
+
+		// Extend: closest hits of the whole queue, packets past Count are masked out
+		{
+			RT_PROFILE_SCOPE(ProfileStage::Traversal);
+			PerfCounterScope counterScope(counters, ProfileStage::Traversal);
+
+			for (uint32_t first = 0; first < queue.Count; first += Simd::Width)
+			{
+				if (secondary)
+				{
+					uint32_t end = glm::min(first + Simd::Width, queue.Count);
+
+					glm::vec3 sum(0.0f);
+					for (uint32_t path = first; path < end; path++)
+						sum += glm::vec3(queue.DirectionX[path], queue.DirectionY[path], queue.DirectionZ[path]);
+
+					stats.SecondaryPackets++;
+					stats.DirectionCoherence += glm::length(sum) / (float)(end - first);
+				}
+
+				TraversalStats before;
+				uint64_t start = 0;
+				if (m_CollectCosts)
+				{
+					before = stats;
+					start = Profiler::Now();
+				}
+
+				Simd::Mask active = Simd::LaneIndices() < Simd::Int((int32_t)(queue.Count - first));
+				TracePacket(queue.LoadPacket(first), active, queue.HitDistance.data() + first, queue.ObjectIndex.data() + first,
+					queue.PrimitiveIndex.data() + first, stats);
+
+				if (m_CollectCosts)
+				{
+					uint32_t end = glm::min(first + Simd::Width, queue.Count);
+					PixelCost cost = GetPixelCost(before, stats, start, 1.0f / (float)(end - first));
+					for (uint32_t path = first; path < end; path++)
+						m_PixelCostData[queue.Pixel[path]] += cost;
+				}
+			}
+		}
+
+		// Shade and reflect, paths that missed end here and the rest move down so the next extend stays dense
+		RT_PROFILE_SCOPE(ProfileStage::Shading);
+		PerfCounterScope counterScope(counters, ProfileStage::Shading);
+
+		uint32_t alive = 0;
+		for (uint32_t path = 0; path < queue.Count; path++)
+		{
+			// The clear color is black, a miss adds nothing
+			if (queue.ObjectIndex[path] < 0)
+			{
+				finish(path);
+				continue;
+			}
+
+			uint64_t start = m_CollectCosts ? Profiler::Now() : 0;
+
+			Ray ray = queue.GetRay(path);
+			HitPayload payload = ClosestHit(ray, queue.HitDistance[path], queue.ObjectIndex[path], (uint32_t)queue.PrimitiveIndex[path]);
+
+			glm::vec3 color = Shade(payload) * multiplier;
+			queue.ColorR[path] += color.r;
+			queue.ColorG[path] += color.g;
+			queue.ColorB[path] += color.b;
+
+			ray.Origin = payload.WorldPosition + payload.WorldNormal * 0.0001f;
+			ray.Direction = glm::reflect(ray.Direction, payload.WorldNormal);
+
+			queue.Move(path, alive);
+			queue.SetRay(alive, ray);
+
+			// Misses end without shading, only hits take time here
+			if (m_CollectCosts)
+				m_PixelCostData[queue.Pixel[alive]].Nanoseconds += (float)(Profiler::Now() - start);
+			alive++;
+		}
+
+		queue.Count = alive;
+		multiplier *= 0.7f;
+	}
+
+	// Out of bounces
+	for (uint32_t path = 0; path < queue.Count; path++)
+		finish(path);
+}
+
+static float Luminance(const glm::vec4& color)
+{
+	return color.r * 0.2126f + color.g * 0.7152f + color.b * 0.0722f;
+}
+
+float Renderer::GetMaxPixelCost(DebugView view)
+{
+	size_t count = (size_t)m_Width * m_Height;
+	if (count == 0)
+		return 0.0f;
+
+	m_PixelCostValues = m_FrameArena.Allocate<float>(count);
+	m_ThreadPool.ParallelFor((uint32_t)m_Tiles.size(), [this, view](uint32_t tileIndex, uint32_t /*workerIndex*/)
+		{
+			const Tile& tile = m_Tiles[tileIndex];
+			for (uint32_t y = tile.MinY; y < tile.MaxY; y++)
+			{
+				for (uint32_t x = tile.MinX; x < tile.MaxX; x++)
+				{
+					uint32_t index = x + y * m_Width;
+					m_PixelCostValues[index] = GetPixelCostValue(m_PixelCostData[index], m_PixelSampleCounts[index], view);
+				}
+			}
+		});
+
+	// The 99th percentile rather than the maximum, single pixels whose worker got preempted would otherwise wash out
+	// the time view. The few above it saturate at the top of the ramp
+	size_t top = count - 1 - count / 100;
+	std::nth_element(m_PixelCostValues, m_PixelCostValues + top, m_PixelCostValues + count);
+	return m_PixelCostValues[top];
+}
+
+void Renderer::AccumulatePixel(uint32_t x, uint32_t y, const glm::vec4& color)
+{
+	uint32_t index = x + y * m_Width;
+
+	// Keep the HDR sum, the tonemap pass averages it, so a still view converges over frames
+	m_AccumulationData[index] += color;
+
+	float luminance = Luminance(color);
+	m_LuminanceSquaredData[index] += luminance * luminance;
+	m_PixelSampleCounts[index]++;
+}
+
+bool Renderer::IsPixelConverged(uint32_t index) const
+{
+	if (m_Settings.AdaptiveThreshold <= 0.0f || !m_Settings.Accumulate)
+		return false;
+
+	uint32_t samples = m_PixelSampleCounts[index];
+
+	// Stopped in an earlier frame, it stays stopped until the next reset
+	if (samples + 1 < m_FrameIndex)
+		return true;
+
+	if (samples < glm::max(m_Settings.AdaptiveMinSamples, 2u))
+		return false;
+
+	float mean = Luminance(m_AccumulationData[index]) / (float)samples;
+	float variance = glm::max(m_LuminanceSquaredData[index] / (float)samples - mean * mean, 0.0f) * (float)samples / (float)(samples - 1);
+
+	// Standard error of the mean, the small offset keeps black pixels from needing an exact zero
+	float error = glm::sqrt(variance / (float)samples);
+	return error <= m_Settings.AdaptiveThreshold * (mean + 0.001f);
+}
+
+void Renderer::RepeatPixelAverage(uint32_t index)
+{
+	// Only called once a pixel has samples, m_FrameIndex - 1 of them went into the sum so far
+	m_AccumulationData[index] += m_AccumulationData[index] / (float)(m_FrameIndex - 1);
 }
 
 void Renderer::OnResize(uint32_t width, uint32_t height)
 {
-	if (m_FinalImage)
+	// No resize is necessarry
+	if (m_ImageData.GetData() && m_Width == width && m_Height == height)
+		return;
+
+	m_Width = width;
+	m_Height = height;
+
+	// Nothing is kept, accumulation starts over and the image is written before it is shown
+	size_t count = (size_t)width * height;
+	m_ImageData.Resize(count);
+	m_AccumulationData.Resize(count);
+	m_PixelSampleCounts.Resize(count);
+	m_LuminanceSquaredData.Resize(count);
+	m_PixelCostData.Resize(count);
+
+	ResetFrameIndex();
+
+	RecalculateTiles();
+}
+
+FrameView Renderer::GetFrame() const
+{
+	FrameView frame;
+	frame.Width = m_Width;
+	frame.Height = m_Height;
+	frame.Pixels = m_ImageData.GetData();
+	frame.Accumulation = m_AccumulationData.GetData();
+	frame.SampleCount = m_SampleCount;
+	return frame;
+}
+
+void Renderer::SetBounces(uint32_t value)
+{
+	value = glm::clamp((int)value, 0, 10);
+	if (value == m_Bounces)
+		return;
+
+	m_Bounces = value;
+	ResetFrameIndex();
+}
+
+void Renderer::SetTileSize(uint32_t size)
+{
+	size = glm::max(size, 1u);
+	if (size == m_TileSize)
+		return;
+
+	m_TileSize = size;
+
+	if (m_ImageData.GetData())
+		RecalculateTiles();
+}
+
+void Renderer::RecalculateTiles()
+{
+	uint32_t width = m_Width, height = m_Height;
+
+	m_Tiles.clear();
+
+	for (uint32_t y = 0; y < height; y += m_TileSize)
 	{
-		// No resize is necessarry
-		if (m_FinalImage->GetWidth() == width && m_FinalImage->GetHeight() == height)
-			return;
+		for (uint32_t x = 0; x < width; x += m_TileSize)
+		{
+			Tile tile;
+			tile.MinX = x;
+			tile.MinY = y;
+			tile.MaxX = glm::min(x + m_TileSize, width);
+			tile.MaxY = glm::min(y + m_TileSize, height);
 
-		m_FinalImage->Resize(width, height);
+			m_Tiles.push_back(tile);
+		}
+	}
+}
+
+void Renderer::UpdatePrimaryRayBasis(const Camera& camera)
+{
+	// Same mapping as Camera::CalculateRayDirection, pixel / viewport * 2 - 1 spans the view plane at distance 1
+	float width = (float)camera.GetViewportWidth(), height = (float)camera.GetViewportHeight();
+	float halfHeight = glm::tan(glm::radians(camera.GetVerticalFOV()) * 0.5f);
+	float halfWidth = halfHeight * width / height;
+
+	m_PrimaryRayBasis.StepX = camera.GetRightDirection() * (2.0f * halfWidth / width);
+	m_PrimaryRayBasis.StepY = camera.GetUpDirection() * (2.0f * halfHeight / height);
+	m_PrimaryRayBasis.Base = camera.GetDirection() - camera.GetRightDirection() * halfWidth - camera.GetUpDirection() * halfHeight;
+}
+
+// Jitter inside the pixel footprint, every frame adds a different sample so the edges converge (anti aliasing)
+glm::vec2 Renderer::GetPixelJitter(const Sampler& sampler, uint32_t x, uint32_t y) const
+{
+	return sampler.Get2D(x, y, m_FrameIndex - 1, 0);
+}
+
+Ray Renderer::GeneratePrimaryRay(uint32_t x, uint32_t y)
+{
+	// Create rays from our perspective
+	Ray ray;
+	ray.Origin = m_ActiveCamera->GetPosition();
+
+	glm::vec2 pixel(x, y);
+	if (m_Settings.Accumulate)
+		pixel += GetPixelJitter(Sampler(m_Settings.Sampling, m_Width), x, y);
+
+	if (m_Settings.PrimaryRays == PrimaryRayMode::Analytic)
+	{
+		// Written out like GeneratePrimaryPacket does it, so packets and single rays agree
+		const PrimaryRayBasis& basis = m_PrimaryRayBasis;
+		glm::vec3 direction = basis.Base + pixel.x * basis.StepX + pixel.y * basis.StepY;
+		ray.Direction = direction / glm::sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+	}
+	else if (!m_Settings.Accumulate && m_ActiveCamera->GetRayDirections().GetCount() == (size_t)m_Width * m_Height)
+	{
+		ray.Direction = m_ActiveCamera->GetRayDirections()[x + y * m_Width];
 	}
 	else
 	{
-		m_FinalImage = std::make_shared<Walnut::Image>(width, height, Walnut::ImageFormat::RGBA);
+		ray.Direction = m_ActiveCamera->CalculateRayDirection(pixel);
+	}
+
+	return ray;
+}
+
+RayPacket Renderer::GeneratePrimaryPacket(uint32_t x, uint32_t y, uint32_t laneCount)
+{
+	RayPacket packet;
+
+	glm::vec3 origin = m_ActiveCamera->GetPosition();
+	packet.OriginX = origin.x;
+	packet.OriginY = origin.y;
+	packet.OriginZ = origin.z;
+
+	if (m_Settings.PrimaryRays == PrimaryRayMode::Camera)
+	{
+		alignas(64) float direction[3][Simd::Width];
+		for (uint32_t lane = 0; lane < Simd::Width; lane++)
+		{
+			// Lanes past the tile edge repeat the last pixel and are masked out
+			Ray ray = GeneratePrimaryRay(x + glm::min(lane, laneCount - 1), y);
+
+			for (int axis = 0; axis < 3; axis++)
+				direction[axis][lane] = ray.Direction[axis];
+		}
+
+		packet.DirectionX = Simd::Load(direction[0]);
+		packet.DirectionY = Simd::Load(direction[1]);
+		packet.DirectionZ = Simd::Load(direction[2]);
+		return packet;
+	}
+
+	// Lanes step one pixel to the right each, the ones past the tile edge are masked out later
+	Simd::Float pixelX = Simd::ToFloat(Simd::LaneIndices()) + Simd::Float((float)x);
+	Simd::Float pixelY = (float)y;
+
+	if (m_Settings.Accumulate)
+	{
+		Sampler sampler(m_Settings.Sampling, m_Width);
+
+		alignas(64) float jitter[2][Simd::Width];
+		for (uint32_t lane = 0; lane < Simd::Width; lane++)
+		{
+			glm::vec2 offset = GetPixelJitter(sampler, x + lane, y);
+			jitter[0][lane] = offset.x;
+			jitter[1][lane] = offset.y;
+		}
+
+		pixelX = pixelX + Simd::Load(jitter[0]);
+		pixelY = pixelY + Simd::Load(jitter[1]);
 	}
 
-	delete[] m_ImageData;
-	m_ImageData = new uint32_t[width * height];
+	const PrimaryRayBasis& basis = m_PrimaryRayBasis;
+	Simd::Float directionX = Simd::Float(basis.Base.x) + pixelX * basis.StepX.x + pixelY * basis.StepY.x;
+	Simd::Float directionY = Simd::Float(basis.Base.y) + pixelX * basis.StepX.y + pixelY * basis.StepY.y;
+	Simd::Float directionZ = Simd::Float(basis.Base.z) + pixelX * basis.StepX.z + pixelY * basis.StepY.z;
+
+	Simd::Float length = Simd::Sqrt(directionX * directionX + directionY * directionY + directionZ * directionZ);
+	packet.DirectionX = directionX / length;
+	packet.DirectionY = directionY / length;
+	packet.DirectionZ = directionZ / length;
+
+	return packet;
 }
 
-glm::vec4 Renderer::RayGen(uint32_t x, uint32_t y)
+glm::vec4 Renderer::RayGen(uint32_t x, uint32_t y, TraversalStats& stats)
 {
 	// Create and trace rays from our perspective
-	Ray ray;
-	ray.Origin = m_ActiveCamera->GetPosition();
-	ray.Direction = m_ActiveCamera->GetRayDirections()[x + y * m_FinalImage->GetWidth()];
+	Ray ray = GeneratePrimaryRay(x, y);
 
+	return TracePath(ray, TraceRay(ray, stats), stats);
+}
+
+glm::vec4 Renderer::TracePath(Ray ray, HitPayload payload, TraversalStats& stats)
+{
 	glm::vec3 color(0.0f);
 	float multiplier = 1.0f;
 
 	for (uint32_t i = 0; i < m_Bounces; i++)
 	{
-		HitPayload payload = TraceRay(ray);
+		// The first hit is handed in, so it can come from a packet
+		if (i > 0)
+		{
+			stats.SecondaryRays++;
+			payload = TraceRay(ray, stats);
+		}
 
 		// If we didn't hit anything then return the "clear color"
 		if (payload.HitDistance < 0)
@@ -74,17 +941,7 @@ glm::vec4 Renderer::RayGen(uint32_t x, uint32_t y)
 			break;
 		}	
 
-		// Calculate lighting
-		glm::vec3 lightDirection(-1, -1, -0.75);
-		lightDirection = glm::normalize(lightDirection);
-		float diffuseTerm = glm::max(glm::dot(payload.WorldNormal, -lightDirection), 0.0f);
-
-		// Determine objects colors
-		const Sphere& sphete = m_ActiveScene->Spheres[payload.ObjectIndex];
-		glm::vec3 sphereColor = sphete.Albedo;
-		sphereColor *= diffuseTerm;
-
-		color += sphereColor * multiplier;
+		color += Shade(payload) * multiplier;
 
 		multiplier *= 0.7f;
 
@@ -95,20 +952,61 @@ glm::vec4 Renderer::RayGen(uint32_t x, uint32_t y)
 	return glm::vec4(color, 1.0f);
 }
 
-HitPayload Renderer::ClosestHit(const Ray& ray, float hitDistance, int objectIndex)
+glm::vec3 Renderer::Shade(const HitPayload& payload) const
+{
+	// Calculate lighting
+	glm::vec3 lightDirection(-1, -1, -0.75);
+	lightDirection = glm::normalize(lightDirection);
+	float diffuseTerm = glm::max(glm::dot(payload.WorldNormal, -lightDirection), 0.0f);
+
+	// Determine objects colors
+	glm::vec3 objectColor = GetAlbedo(payload.ObjectIndex, payload.PrimitiveIndex);
+	objectColor *= diffuseTerm;
+
+	return objectColor;
+}
+
+HitPayload Renderer::ClosestHit(const Ray& ray, float hitDistance, int objectIndex, uint32_t primitiveIndex)
 {
 	HitPayload payload;
 
 	payload.HitDistance = hitDistance;
 	payload.ObjectIndex = objectIndex;
+	payload.PrimitiveIndex = primitiveIndex;
+
+	int32_t firstInstance = GetFirstInstanceIndex();
+	if (objectIndex >= firstInstance)
+	{
+		payload.WorldPosition = ray.Origin + ray.Direction * hitDistance;
+		payload.WorldNormal = m_InstanceBVH.GetNormal(ray, hitDistance, objectIndex - firstInstance, primitiveIndex);
+		return payload;
+	}
+
+	uint32_t sphereCount = m_SphereSoA.GetCount();
+	if ((uint32_t)objectIndex >= sphereCount)
+	{
+		uint32_t triangle = objectIndex - sphereCount;
+		size_t meshIndex = std::upper_bound(m_MeshFirstTriangles.begin(), m_MeshFirstTriangles.end(), triangle) - m_MeshFirstTriangles.begin() - 1;
+		const Mesh& mesh = *m_Meshes[meshIndex];
+		triangle -= m_MeshFirstTriangles[meshIndex];
 
-	const Sphere& closestSphere = m_ActiveScene->Spheres[objectIndex];
+		payload.WorldPosition = ray.Origin + ray.Direction * hitDistance;
 
-	glm::vec3 origin = ray.Origin - closestSphere.Position;
+		// Triangles are two sided, bounces have to leave on the side the ray came from
+		payload.WorldNormal = glm::normalize(mesh.GetNormal(triangle, payload.WorldPosition));
+		if (glm::dot(payload.WorldNormal, ray.Direction) > 0.0f)
+			payload.WorldNormal = -payload.WorldNormal;
+
+		return payload;
+	}
+
+	glm::vec3 position = m_ActiveScene->GetPosition(objectIndex);
+
+	glm::vec3 origin = ray.Origin - position;
 	payload.WorldPosition = origin + ray.Direction * hitDistance;
 	payload.WorldNormal = glm::normalize(payload.WorldPosition);
 
-	payload.WorldPosition += closestSphere.Position;
+	payload.WorldPosition += position;
 
 	return payload ;
 }
@@ -122,35 +1020,181 @@ HitPayload Renderer::Miss(const Ray& ray)
 	return payload;
 }
 
-HitPayload Renderer::TraceRay(const Ray& ray)
+HitPayload Renderer::TraceRay(const Ray& ray, TraversalStats& stats)
 {
+	stats.Rays++;
+
+	float hitDistance = std::numeric_limits<float>::max();
 	int closestSphere = -1;
-	float hitDistance = std::numeric_limits<float>::max();;
 
-	for (size_t i = 0; i < m_ActiveScene->Spheres.size(); i++)
+	if (m_BVHActive)
+	{
+		const uint32_t* indices = m_BVH.GetIndices();
+
+		m_BVH.Traverse(ray, hitDistance, [&](uint32_t first, uint32_t count, float& closestT)
+			{
+				for (uint32_t i = first; i < first + count; i++)
+				{
+					float t = IntersectSphere(ray, m_BVHSpheres[i]);
+					if (t > 0.0f && t < closestT)
+					{
+						closestT = t;
+						closestSphere = (int)indices[i];
+					}
+				}
+			}, stats);
+	}
+	else
+	{
+		IntersectAllSpheres(ray, hitDistance, closestSphere, stats);
+	}
+
+	IntersectMeshes(ray, hitDistance, closestSphere, stats);
+
+	uint32_t closestPrimitive = 0;
+	if (!m_InstanceBVH.IsEmpty())
+		m_InstanceBVH.Intersect(ray, hitDistance, closestSphere, closestPrimitive, GetFirstInstanceIndex(), stats);
+
+	if (closestSphere < 0)
+	{
+		stats.Misses++;
+		return Miss(ray);
+	}
+
+	return ClosestHit(ray, hitDistance, closestSphere, closestPrimitive);
+}
+
+void Renderer::IntersectMeshes(const Ray& ray, float& closestDistance, int& closestIndex, TraversalStats& stats)
+{
+	if (m_MeshBVHs.empty())
+		return;
+
+	TriangleRay triangleRay;
+	triangleRay.Prepare(ray);
+
+	// Each mesh BVH starts with a root box test against the closest hit so far, so hidden meshes cost one box
+	int32_t firstIndex = (int32_t)m_SphereSoA.GetCount();
+	for (size_t i = 0; i < m_MeshBVHs.size(); i++)
+		m_MeshBVHs[i].Intersect(triangleRay, ray, closestDistance, closestIndex, firstIndex + (int32_t)m_MeshFirstTriangles[i], stats);
+}
+
+void Renderer::IntersectMeshes(const RayPacket& packet, Simd::Mask active, Simd::Float& hitDistances, Simd::Int& closestIndices, TraversalStats& stats)
+{
+	if (m_MeshBVHs.empty())
+		return;
+
+	TrianglePacket trianglePacket;
+	trianglePacket.Prepare(packet);
+
+	int32_t firstIndex = (int32_t)m_SphereSoA.GetCount();
+	for (size_t i = 0; i < m_MeshBVHs.size(); i++)
+		m_MeshBVHs[i].Intersect(trianglePacket, packet, active, hitDistances, closestIndices, firstIndex + (int32_t)m_MeshFirstTriangles[i], stats);
+}
+
+void Renderer::IntersectAllSpheres(const Ray& ray, float& closestDistance, int& closestIndex, TraversalStats& stats)
+{
+	stats.PrimitivesTested += m_SphereSoA.GetPaddedCount();
+
+	// One ray against Simd::Width spheres at a time, padding lanes can never hit
+	Simd::Float hitDistance = closestDistance;
+	Simd::Int closestSphere = -1;
+
+	Simd::Float originX = ray.Origin.x, originY = ray.Origin.y, originZ = ray.Origin.z;
+	Simd::Float directionX = ray.Direction.x, directionY = ray.Direction.y, directionZ = ray.Direction.z;
+
+	Simd::Float a = glm::dot(ray.Direction, ray.Direction);
+
+	const float* positionX = m_SphereSoA.GetX();
+	const float* positionY = m_SphereSoA.GetY();
+	const float* positionZ = m_SphereSoA.GetZ();
+	const float* radiusSquared = m_SphereSoA.GetRadiusSquared();
+
+	for (uint32_t i = 0; i < m_SphereSoA.GetPaddedCount(); i += Simd::Width)
 	{
-		const Sphere& sphere = m_ActiveScene->Spheres[i];
-		glm::vec3 origin = ray.Origin - sphere.Position;
+		Simd::Float x = originX - Simd::Load(positionX + i);
+		Simd::Float y = originY - Simd::Load(positionY + i);
+		Simd::Float z = originZ - Simd::Load(positionZ + i);
 
-		float a = glm::dot(ray.Direction, ray.Direction);
-		float b = 2.0f * glm::dot(origin, ray.Direction);
-		float c = glm::dot(origin, origin) - sphere.Radius * sphere.Radius;
+		Simd::Float b = 2.0f * (x * directionX + y * directionY + z * directionZ);
+		Simd::Float c = (x * x + y * y + z * z) - Simd::Load(radiusSquared + i);
 
-		float discriminant = b * b - 4.0f * a * c;
-		if (discriminant < 0.0f)
+		Simd::Float discriminant = b * b - 4.0f * a * c;
+
+		Simd::Mask hit = discriminant >= 0.0f;
+		if (!Simd::Any(hit))
 			continue;
 
-		float closestT = (-b - glm::sqrt(discriminant)) / (2.0f * a);
+		Simd::Float closestT = (Simd::Float(0.0f) - b - Simd::Sqrt(Simd::Max(discriminant, 0.0f))) / (2.0f * a);
 
-		if (closestT > 0.0f && closestT < hitDistance)
+		Simd::Mask closer = hit & (closestT > 0.0f) & (closestT < hitDistance);
+		hitDistance = Simd::Select(closer, closestT, hitDistance);
+		closestSphere = Simd::Select(closer, Simd::LaneIndices() + Simd::Int((int32_t)i), closestSphere);
+	}
+
+	// Every lane kept its own closest sphere, pick the nearest (lowest index on ties, like a serial loop would)
+	alignas(64) float laneDistances[Simd::Width];
+	alignas(64) int32_t laneSpheres[Simd::Width];
+	Simd::Store(laneDistances, hitDistance);
+	Simd::Store(laneSpheres, closestSphere);
+
+	float nearest = Simd::HorizontalMin(hitDistance);
+
+	for (uint32_t lane = 0; lane < Simd::Width; lane++)
+	{
+		if (laneSpheres[lane] >= 0 && laneDistances[lane] == nearest && (closestIndex < 0 || laneSpheres[lane] < closestIndex))
 		{
-			hitDistance = closestT;
-			closestSphere = (int)i;
+			closestDistance = nearest;
+			closestIndex = laneSpheres[lane];
 		}
 	}
+}
 
-	if (closestSphere < 0)
-		return Miss(ray);
+void Renderer::TracePacket(const RayPacket& packet, Simd::Mask active, float* hitDistances, int32_t* objectIndices, int32_t* primitiveIndices,
+	TraversalStats& stats)
+{
+	stats.Rays += Simd::Count(active);
+
+	// Same math as TraceRay, but every sphere is tested against all the lanes at once
+	Simd::Float hitDistance = std::numeric_limits<float>::max();
+	Simd::Int closestSphere = -1;
+
+	Simd::Float a = packet.DirectionX * packet.DirectionX + packet.DirectionY * packet.DirectionY + packet.DirectionZ * packet.DirectionZ;
+
+	if (m_BVHActive)
+	{
+		const uint32_t* indices = m_BVH.GetIndices();
+
+		m_BVH.Traverse(packet, active, hitDistance, [&](uint32_t first, uint32_t count, Simd::Mask lanes, Simd::Float& closestT)
+			{
+				for (uint32_t i = first; i < first + count; i++)
+				{
+					const glm::vec4& sphere = m_BVHSpheres[i];
+					IntersectSphere(packet, a, sphere.x, sphere.y, sphere.z, sphere.w, (int32_t)indices[i], lanes, closestT, closestSphere);
+				}
+			}, stats);
+	}
+	else
+	{
+		stats.PrimitivesTested += m_SphereSoA.GetCount();
+
+		const float* positionX = m_SphereSoA.GetX();
+		const float* positionY = m_SphereSoA.GetY();
+		const float* positionZ = m_SphereSoA.GetZ();
+		const float* radiusSquared = m_SphereSoA.GetRadiusSquared();
+
+		for (uint32_t i = 0; i < m_SphereSoA.GetCount(); i++)
+			IntersectSphere(packet, a, positionX[i], positionY[i], positionZ[i], radiusSquared[i], (int32_t)i, active, hitDistance, closestSphere);
+	}
+
+	IntersectMeshes(packet, active, hitDistance, closestSphere, stats);
+
+	Simd::Int closestPrimitive = 0;
+	if (!m_InstanceBVH.IsEmpty())
+		m_InstanceBVH.Intersect(packet, active, hitDistance, closestSphere, closestPrimitive, GetFirstInstanceIndex(), stats);
+
+	stats.Misses += Simd::Count(active & (closestSphere < Simd::Int(0)));
 
-	return ClosestHit(ray, hitDistance, closestSphere);
+	Simd::Store(hitDistances, hitDistance);
+	Simd::Store(objectIndices, closestSphere);
+	Simd::Store(primitiveIndices, closestPrimitive);
 }
\ No newline at end of file
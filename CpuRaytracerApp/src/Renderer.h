@@ -1,16 +1,29 @@
 #pragma once
 
-#include "Walnut/Image.h"
-#include "Walnut/Random.h"
 #include  "../../Walnut/vendor/glm/glm/glm.hpp"
 
 #include <iostream>
 
+#include <functional>
 #include <memory>
+#include <vector>
 #include "FastRandom.h"
+#include "BVH.h"
+#include "BVHCache.h"
 #include "Camera.h"
+#include "InstanceBVH.h"
+#include "Memory.h"
+#include "MeshBVH.h"
+#include "PerfCounters.h"
 #include "Ray.h"
+#include "RayQueue.h"
+#include "RaySorter.h"
+#include "RenderTarget.h"
+#include "Sampler.h"
 #include "Scene.h"
+#include "SphereSoA.h"
+#include "ThreadPool.h"
+#include "Tonemap.h"
 
 struct HitPayload
 {
@@ -19,46 +32,368 @@ struct HitPayload
 	glm::vec3 WorldNormal;
 
 	int ObjectIndex;
+	uint32_t PrimitiveIndex; // Sphere or triangle inside the geometry block of an instance
+};
+
+// Work summed over the samples of one pixel, only counted while a cost view is shown. Packets split theirs evenly
+// over the lanes, so these are floats
+struct PixelCost
+{
+	float PrimitivesTested = 0.0f;
+	float NodesVisited = 0.0f;
+	float Rays = 0.0f; // Primary ones included
+	float Nanoseconds = 0.0f;
+
+	PixelCost& operator+=(const PixelCost& other)
+	{
+		PrimitivesTested += other.PrimitivesTested;
+		NodesVisited += other.NodesVisited;
+		Rays += other.Rays;
+		Nanoseconds += other.Nanoseconds;
+		return *this;
+	}
+};
+
+// Rectangle of the framebuffer traced as one job, max is exclusive
+struct Tile
+{
+	uint32_t MinX, MinY;
+	uint32_t MaxX, MaxY;
+};
+
+// Primary ray directions as normalize(Base + x * StepX + y * StepY), x and y in (fractional) pixels
+struct PrimaryRayBasis
+{
+	glm::vec3 Base{ 0.0f };
+	glm::vec3 StepX{ 0.0f }, StepY{ 0.0f };
 };
 
 class Renderer
 {
 public:
 
+	enum class PrimaryRayMode
+	{
+		// Stepped per pixel from the camera basis and FOV, Simd::Width pixels at a time. No matrices, no cache
+		Analytic = 0,
+
+		// Camera::CalculateRayDirection or its cache, bit for bit what older builds traced. For regression tests
+		Camera
+	};
+
+	enum class IntegratorMode
+	{
+		// Every pixel runs its whole path in RayGen/TracePath, depth first
+		Megakernel = 0,
+
+		// One stage per bounce over all paths of a tile: generate, extend (closest hit in packets), shade and reflect.
+		// Paths live in SoA queues that are compacted as they end, so secondary rays are traced Simd::Width at a time too
+		Wavefront
+	};
+
+	enum class DebugView
+	{
+		None = 0,
+
+		// Samples each pixel actually took over samples per pixel so far, black pixels stopped early
+		SampleCount,
+
+		// Cost per sample on a color ramp from the cheapest (dark blue) to the most expensive pixel of the frame (dark red).
+		// Switching to one of them restarts accumulation, costs are only counted while one is shown
+		IntersectionTests, // Spheres and triangles
+		NodesVisited,
+		BounceDepth, // Bounces the path took before it missed or ran out
+		Time // Tracing and shading, a packet's traversal split evenly over its lanes
+	};
+
+	struct Settings
+	{
+		// Average samples across frames while nothing moves, one jittered sample per pixel per frame
+		bool Accumulate = true;
+
+		// Trace coherent primary rays Simd::Width at a time, bounces stay per pixel
+		bool RayPackets = true;
+
+		PrimaryRayMode PrimaryRays = PrimaryRayMode::Analytic;
+
+		// Where in its pixel every frame's sample lands. Switching restarts accumulation, Sobol is only stratified from
+		// its first sample on
+		SamplerType Sampling = SamplerType::PCG;
+
+		// Same image either way, RayPackets only applies to the megakernel
+		IntegratorMode Integrator = IntegratorMode::Megakernel;
+
+		// Wavefront only. Reorders the paths by origin and direction before every bounce after the first, so the lanes
+		// of a packet take the same way through the BVH. Same image, but it only pays off once traversal dominates,
+		// small scenes lose more to the sort than they save
+		bool SortSecondaryRays = false;
+
+		// Once this many samples are accumulated frames are skipped until something changes, 0 keeps accumulating forever
+		uint32_t MaxSamples = 0;
+
+		// Adaptive sampling while accumulating. A pixel stops taking samples once the standard error of its luminance
+		// falls under this fraction of the luminance, and keeps its average until the next reset. 0 samples every pixel
+		float AdaptiveThreshold = 0.0f;
+		uint32_t AdaptiveMinSamples = 16; // Before the variance estimate is trusted
+
+		DebugView View = DebugView::None;
+
+		// HDR to RGBA8 conversion, changing it does not restart accumulation
+		TonemapSettings Tonemap;
+
+		// Spheres needed before the BVH replaces the linear intersection loop
+		uint32_t BVHThreshold = 64;
+
+		// Edited spheres only refit the BVH, it gets rebuilt once its SAH cost grew by this factor since the last build
+		float BVHRebuildCostRatio = 1.5f;
+
+		// Reads the hardware counters of every worker around each tile, conversion job and wavefront pass. A few syscalls
+		// each, so it stays off unless somebody looks at GetPerfCounters()
+		bool HardwareCounters = false;
+	};
+
+	// Called from worker threads as soon as a tile is written to the framebuffer
+	using TileCallback = std::function<void(const Tile&)>;
+
 	Renderer() = default;
 
-	void Render(const Scene& scene, const Camera& camera);
+	// Returns false if nothing the image depends on changed and there is nothing left to accumulate, the frame is skipped.
+	// Camera and scene versions are compared against the last frame, so moving or editing them restarts accumulation by itself
+	bool Render(const Scene& scene, const Camera& camera);
 
 	void OnResize(uint32_t width, uint32_t height);
 
-	std::shared_ptr<Walnut::Image> GetFinalImage() const { return m_FinalImage; }
+	uint32_t GetWidth() const { return m_Width; }
+	uint32_t GetHeight() const { return m_Height; }
+
+	// Every finished frame is presented to the target, leave it empty to only read GetFrame()
+	void SetTarget(const std::shared_ptr<RenderTarget>& target) { m_Target = target; }
+
+	// The framebuffer as of the last Render
+	FrameView GetFrame() const;
+
+	void SetBounces(uint32_t value);
+
+	// Restarts accumulation. Camera moves and Scene::Version bumps are noticed by Render, this is for anything else
+	void ResetFrameIndex() { m_FrameIndex = 1; m_FrameDirty = true; }
+	uint32_t GetFrameIndex() const { return m_FrameIndex; }
 
-	void SetBounces(uint32_t value) { m_Bounces = glm::clamp((int)value, 0, 10); }
+	// Render calls that had nothing to do
+	uint64_t GetSkippedFrameCount() const { return m_SkippedFrameCount; }
+
+	// Spheres were added, removed or replaced, the intersection data is rebuilt on the next Render
+	void OnSceneChanged() { m_SceneDirty = true; ResetFrameIndex(); }
+
+	// Position or radius of one sphere changed, only its entries and the BVH nodes above it get updated
+	void OnSphereChanged(uint32_t index) { m_DirtySpheres.push_back(index); ResetFrameIndex(); }
+
+	// Instances were added, removed or given other geometry. Only the top level is rebuilt, blocks keep their bottom levels
+	void OnInstancesChanged() { m_InstancesDirty = true; ResetFrameIndex(); }
+
+	// Transform of one instance changed, its top level leaf gets refit
+	void OnInstanceMoved(uint32_t index) { m_MovedInstances.push_back(index); ResetFrameIndex(); }
+
+	Settings& GetSettings() { return m_Settings; }
+
+	// 0 means one thread per hardware thread
+	void SetThreadCount(uint32_t count) { m_ThreadPool.SetThreadCount(count); }
+	uint32_t GetThreadCount() const { return m_ThreadPool.GetThreadCount(); }
+
+	// For passes over the finished frame that should use the same workers
+	ThreadPool& GetThreadPool() { return m_ThreadPool; }
+
+	void SetTileSize(uint32_t size);
+	uint32_t GetTileSize() const { return m_TileSize; }
+
+	void SetTileCallback(const TileCallback& callback) { m_TileCallback = callback; }
+
+	const BVH& GetBVH() const { return m_BVH; }
+	bool IsBVHActive() const { return m_BVHActive; }
+	uint32_t GetBVHBuildCount() const { return m_BVHBuildCount; } // Real builds, cache hits are not counted
+
+	// Large scenes load their BVH from here instead of building it, empty (the default) always builds
+	void SetBVHCacheDirectory(const std::string& directory) { m_BVHCache.SetDirectory(directory); }
+	const BVHCacheStats& GetBVHCacheStats() const { return m_BVHCache.GetStats(); }
+
+	const InstanceBVH& GetInstanceBVH() const { return m_InstanceBVH; }
+
+	// Summed over every worker during the last Render
+	const TraversalStats& GetTraversalStats() const { return m_TraversalStats; }
+
+	// The same per worker, indexed like the thread pool's workers
+	const std::vector<TraversalStats>& GetWorkerStats() const { return m_WorkerStats; }
+
+	// Counters of the last Render, summed over every worker and per worker. Empty unless Settings::HardwareCounters
+	// is on and the platform has counters, see PerfCounters::GetError() for why not
+	const PerfCounterStats& GetPerfCounters() const { return m_PerfCounters; }
+	const std::vector<PerfCounterStats>& GetWorkerPerfCounters() const { return m_WorkerPerfCounters; }
+
+	// Heap allocations the last Render made on its own thread and the workers, always 0 unless RT_COUNT_ALLOCATIONS
+	uint64_t GetFrameAllocationCount() const { return m_FrameAllocationCount; }
 
 private:
 
-	glm::vec4 RayGen(uint32_t x, uint32_t y); // Per pixel
+	// Traces one more sample per pixel into m_AccumulationData
+	void TraceFrame(const Scene& scene, const Camera& camera);
+
+	void UpdateSceneData(const Scene& scene);
+
+	void BuildBVH(const Scene& scene);
+
+	// Meshes are never edited in place, so their BVHs are only rebuilt when the list of meshes changes
+	void UpdateMeshData(const Scene& scene);
+
+	// Instances are numbered after every sphere and mesh triangle
+	int32_t GetFirstInstanceIndex() const { return (int32_t)(m_SphereSoA.GetCount() + m_MeshTriangleCount); }
 
-	HitPayload TraceRay(const Ray& ray);
+	// Sphere, mesh or instance color behind the indices of HitPayload
+	glm::vec3 GetAlbedo(int objectIndex, uint32_t primitiveIndex) const;
 
-	HitPayload ClosestHit(const Ray& ray, float hitDistance, int objectIndex);
+	void RenderTile(const Tile& tile, TraversalStats& stats);
+
+	// IntegratorMode::Wavefront, queue, sorter and scratch belong to the worker and are reused for every tile it takes.
+	// counters gets every pass, null when hardware counters are off
+	void RenderTileWavefront(const Tile& tile, RayQueue& queue, RaySorter& sorter, Arena& scratch, TraversalStats& stats, PerfCounterStats* counters);
+
+	void RecalculateTiles();
+
+	void AccumulatePixel(uint32_t x, uint32_t y, const glm::vec4& color);
+
+	// Cost per sample at the top of the color ramp, about the highest of the frame
+	float GetMaxPixelCost(DebugView view);
+
+	// Adaptive sampling, true if the pixel can skip this frame
+	bool IsPixelConverged(uint32_t index) const;
+
+	// Adds the pixel's current average as this frame's sample, so the sum stays consistent with the common sample count
+	void RepeatPixelAverage(uint32_t index);
+
+	void UpdatePrimaryRayBasis(const Camera& camera);
+
+	// Offset inside the pixel for this frame's sample, the first two sampler dimensions
+	glm::vec2 GetPixelJitter(const Sampler& sampler, uint32_t x, uint32_t y) const;
+
+	Ray GeneratePrimaryRay(uint32_t x, uint32_t y);
+
+	// Pixels x to x + Simd::Width - 1 of row y, lanes from laneCount on are not traced
+	RayPacket GeneratePrimaryPacket(uint32_t x, uint32_t y, uint32_t laneCount);
+
+	glm::vec4 RayGen(uint32_t x, uint32_t y, TraversalStats& stats); // Per pixel
+
+	glm::vec4 TracePath(Ray ray, HitPayload payload, TraversalStats& stats); // Bounces starting from an already traced primary hit
+
+	// Light one hit adds to its path, before the multiplier of its bounce
+	glm::vec3 Shade(const HitPayload& payload) const;
+
+	HitPayload TraceRay(const Ray& ray, TraversalStats& stats);
+
+	// Linear SIMD loop over m_SphereSoA, only takes hits closer than closestDistance
+	void IntersectAllSpheres(const Ray& ray, float& closestDistance, int& closestIndex, TraversalStats& stats);
+
+	void IntersectMeshes(const Ray& ray, float& closestDistance, int& closestIndex, TraversalStats& stats);
+	void IntersectMeshes(const RayPacket& packet, Simd::Mask active, Simd::Float& hitDistances, Simd::Int& closestIndices, TraversalStats& stats);
+
+	// Closest hit for every active lane, misses come back with index -1
+	void TracePacket(const RayPacket& packet, Simd::Mask active, float* hitDistances, int32_t* objectIndices, int32_t* primitiveIndices,
+		TraversalStats& stats);
+
+	HitPayload ClosestHit(const Ray& ray, float hitDistance, int objectIndex, uint32_t primitiveIndex);
 
 	HitPayload Miss(const Ray& ray);
 
 	// HitPayload AnyHit(const Ray& ray); might be good for transluscent objects
 
+	// CpuRaytracerBench times the kernels above directly
+	friend struct BenchmarkAccess;
+
 private:
 
-	std::shared_ptr<Walnut::Image> m_FinalImage;
+	std::shared_ptr<RenderTarget> m_Target;
+	uint32_t m_Width = 0, m_Height = 0;
 
 	const Scene* m_ActiveScene = nullptr;
 	const Camera* m_ActiveCamera = nullptr;
-
-	uint32_t* m_ImageData = nullptr;
+	PrimaryRayBasis m_PrimaryRayBasis;
+
+	// Derived from m_ActiveScene->Spheres, only what the intersection loops read
+	SphereSoA m_SphereSoA;
+	std::shared_ptr<const SphereArrays> m_MappedSpheres;
+	bool m_SceneDirty = true;
+	std::vector<uint32_t> m_DirtySpheres;
+
+	// Used instead of the linear loops once the scene reaches Settings::BVHThreshold spheres.
+	// m_BVHSpheres holds (position, radius squared) in leaf order, so a leaf reads one contiguous range
+	BVH m_BVH;
+	AlignedVector<glm::vec4> m_BVHSpheres;
+	bool m_BVHActive = false;
+	uint32_t m_BVHBuildCount = 0;
+	BVHCache m_BVHCache;
+
+	// Object indices past the spheres are triangles, m_MeshFirstTriangles holds where each mesh starts in that range
+	std::vector<std::shared_ptr<const Mesh>> m_Meshes;
+	std::vector<MeshBVH> m_MeshBVHs;
+	std::vector<uint32_t> m_MeshFirstTriangles;
+	uint32_t m_MeshTriangleCount = 0;
+
+	// Scene::Instances, traced after the meshes
+	InstanceBVH m_InstanceBVH;
+	bool m_InstancesDirty = true;
+	std::vector<uint32_t> m_MovedInstances;
+
+	std::vector<TraversalStats> m_WorkerStats;
+	std::vector<RayQueue> m_WorkerQueues; // Wavefront only
+	std::vector<RaySorter> m_WorkerSorters;
+	std::vector<Arena> m_WorkerArenas; // Scratch of one pass of a worker, reset before every use
+	TraversalStats m_TraversalStats;
+	std::vector<PerfCounterStats> m_WorkerPerfCounters;
+	PerfCounterStats m_PerfCounters;
+
+	// Framebuffers keep their memory when the viewport shrinks and grow geometrically, so dragging a window edge
+	// reallocates only now and then
+	PixelBuffer<uint32_t> m_ImageData;
+
+	// HDR running sum of every sample since the last reset, divided by m_FrameIndex on output
+	PixelBuffer<glm::vec4> m_AccumulationData;
+
+	// Per pixel samples actually traced and the sum of their squared luminance, for the variance estimate
+	PixelBuffer<uint32_t> m_PixelSampleCounts;
+	PixelBuffer<float> m_LuminanceSquaredData;
+
+	// Cost views only, summed since the last reset like m_AccumulationData
+	PixelBuffer<PixelCost> m_PixelCostData;
+	bool m_CollectCosts = false; // While tracing, the frames since the last reset all collected when set
+
+	// Scratch that lives for one Render, reset when it starts
+	Arena m_FrameArena;
+	float* m_PixelCostValues = nullptr; // The ramp's range, from m_FrameArena
+
+	Settings m_Settings;
 
 	uint32_t m_Bounces = 3;
 
-	uint32_t m_FrameIndex = 0;
+	uint32_t m_FrameIndex = 1;
+	uint32_t m_SampleCount = 0; // Samples in m_AccumulationData as of the last Render
+
+	// What the current image was made from, a frame is only traced or tonemapped again once one of them is out of date
+	bool m_FrameDirty = true;
+	uint64_t m_SceneVersion = 0;
+	uint64_t m_CameraVersion = 0;
+	bool m_FrameAccumulate = true;
+	TonemapSettings m_FrameTonemap;
+	DebugView m_FrameView = DebugView::None;
+	uint64_t m_SkippedFrameCount = 0;
+
+	// Scratch is sized for these, a frame set up like the one before must not allocate
+	IntegratorMode m_FrameIntegrator = IntegratorMode::Megakernel;
+	bool m_FrameSortRays = false;
+	uint32_t m_FrameThreadCount = 0, m_FrameTileSize = 0;
+	uint64_t m_FrameAllocationCount = 0; // Heap allocations of the last Render, RT_COUNT_ALLOCATIONS only
+
+	// Persistent workers, tiles are scheduled with work stealing since reflective spheres make their cost very uneven
+	ThreadPool m_ThreadPool;
+	std::vector<Tile> m_Tiles;
+	uint32_t m_TileSize = 32;
+	TileCallback m_TileCallback;
 
 };
 
@@ -75,8 +410,7 @@ inline uint32_t ShowScreenUvCoords(glm::vec2 coord)
 inline uint32_t ShowRandom(uint32_t seed)
 {
 	//uint32_t result = WangHash(seed);
-	//uint32_t result = PcgHash(seed);
-	uint32_t result = Walnut::Random::UInt();
+	uint32_t result = PcgHash(seed);
 
 	result |= 0xff000000;
 	return result;
@@ -0,0 +1,239 @@
+#include "Sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "FastRandom.h"
+
+static constexpr uint32_t s_BlueNoiseSize = 64; // Power of two, coordinates wrap with a mask
+
+// R2 sequence steps in 32 bit fixed point, 1 / plastic number and its square
+static constexpr uint32_t s_R2StepX = 3242174889u;
+static constexpr uint32_t s_R2StepY = 2447445414u;
+
+static float ToFloat(uint32_t value)
+{
+	// The top 24 bits, so the result never rounds up to 1
+	return (float)(value >> 8) * (1.0f / 16777216.0f);
+}
+
+static uint32_t HashCombine(uint32_t seed, uint32_t value)
+{
+	return seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+static uint32_t ReverseBits(uint32_t value)
+{
+	value = (value << 16) | (value >> 16);
+	value = ((value & 0x00ff00ffu) << 8) | ((value & 0xff00ff00u) >> 8);
+	value = ((value & 0x0f0f0f0fu) << 4) | ((value & 0xf0f0f0f0u) >> 4);
+	value = ((value & 0x33333333u) << 2) | ((value & 0xccccccccu) >> 2);
+	value = ((value & 0x55555555u) << 1) | ((value & 0xaaaaaaaau) >> 1);
+	return value;
+}
+
+// Burley's improved Laine-Karras hash, every bit only depends on the bits below it
+static uint32_t LaineKarrasPermutation(uint32_t value, uint32_t seed)
+{
+	value += seed;
+	value ^= value * 0x6c50b47cu;
+	value ^= value * 0xb82f1e52u;
+	value ^= value * 0xc7afe638u;
+	value ^= value * 0x8d22f6e6u;
+	return value;
+}
+
+// Owen scrambling, every bit is flipped depending on the bits above it. Keeps the sequence stratified
+static uint32_t NestedUniformScramble(uint32_t value, uint32_t seed)
+{
+	return ReverseBits(LaineKarrasPermutation(ReverseBits(value), seed));
+}
+
+// Second Sobol dimension, the first is just the bit reversed index
+static uint32_t SobolSecond(uint32_t index)
+{
+	uint32_t result = 0;
+	for (uint32_t direction = 1u << 31; index; index >>= 1, direction ^= direction >> 1)
+	{
+		if (index & 1)
+			result ^= direction;
+	}
+	return result;
+}
+
+// Dimensions 2 * pair and 2 * pair + 1, every pair of every pixel is its own shuffled, scrambled (0,2) sequence
+static glm::vec2 SobolOwen(uint32_t x, uint32_t y, uint32_t sampleIndex, uint32_t pair)
+{
+	uint32_t seed = HashCombine(HashCombine(PcgHash(x), PcgHash(y)), pair);
+
+	uint32_t index = NestedUniformScramble(sampleIndex, HashCombine(seed, 0));
+	uint32_t u = NestedUniformScramble(ReverseBits(index), HashCombine(seed, 1));
+	uint32_t v = NestedUniformScramble(SobolSecond(index), HashCombine(seed, 2));
+	return { ToFloat(u), ToFloat(v) };
+}
+
+// Void and cluster (Ulichney 1993) over a torus, every cell gets its rank in [0, size * size)
+static std::vector<uint16_t> GenerateBlueNoise()
+{
+	constexpr uint32_t size = s_BlueNoiseSize;
+	constexpr uint32_t count = size * size;
+
+	// Gaussian with sigma 1.5 by wrapped distance
+	std::vector<float> kernel(count);
+	for (uint32_t y = 0; y < size; y++)
+	{
+		for (uint32_t x = 0; x < size; x++)
+		{
+			float dx = (float)std::min(x, size - x);
+			float dy = (float)std::min(y, size - y);
+			kernel[x + y * size] = std::exp(-(dx * dx + dy * dy) / (2.0f * 1.5f * 1.5f));
+		}
+	}
+
+	std::vector<float> energy(count, 0.0f);
+	std::vector<uint8_t> pattern(count, 0);
+
+	auto toggle = [&](uint32_t cell)
+	{
+		pattern[cell] ^= 1;
+		float sign = pattern[cell] ? 1.0f : -1.0f;
+
+		uint32_t cellX = cell % size, cellY = cell / size;
+		for (uint32_t y = 0; y < size; y++)
+		{
+			const float* row = &kernel[((y - cellY) & (size - 1)) * size];
+			for (uint32_t x = 0; x < size; x++)
+				energy[x + y * size] += sign * row[(x - cellX) & (size - 1)];
+		}
+	};
+
+	// Densest set cell and emptiest free cell
+	auto tightestCluster = [&]()
+	{
+		uint32_t best = 0;
+		float bestEnergy = -1.0f;
+		for (uint32_t cell = 0; cell < count; cell++)
+		{
+			if (pattern[cell] && energy[cell] > bestEnergy)
+			{
+				best = cell;
+				bestEnergy = energy[cell];
+			}
+		}
+		return best;
+	};
+	auto largestVoid = [&]()
+	{
+		uint32_t best = 0;
+		float bestEnergy = std::numeric_limits<float>::max();
+		for (uint32_t cell = 0; cell < count; cell++)
+		{
+			if (!pattern[cell] && energy[cell] < bestEnergy)
+			{
+				best = cell;
+				bestEnergy = energy[cell];
+			}
+		}
+		return best;
+	};
+
+	// A tenth of the cells at random, then points move from clusters into voids until the tightest cluster is the void
+	uint32_t initialCount = count / 10;
+	for (uint32_t placed = 0, seed = 1; placed < initialCount; seed++)
+	{
+		uint32_t cell = PcgHash(seed) % count;
+		if (!pattern[cell])
+		{
+			toggle(cell);
+			placed++;
+		}
+	}
+
+	for (uint32_t iteration = 0; iteration < count; iteration++)
+	{
+		uint32_t cluster = tightestCluster();
+		toggle(cluster);
+
+		uint32_t hole = largestVoid();
+		toggle(hole);
+
+		if (hole == cluster)
+			break;
+	}
+
+	std::vector<uint16_t> ranks(count);
+
+	// Ranks below the initial pattern take its points away again, tightest cluster first
+	std::vector<float> initialEnergy = energy;
+	std::vector<uint8_t> initialPattern = pattern;
+	for (uint32_t rank = initialCount; rank-- > 0;)
+	{
+		uint32_t cluster = tightestCluster();
+		toggle(cluster);
+		ranks[cluster] = (uint16_t)rank;
+	}
+	energy = std::move(initialEnergy);
+	pattern = std::move(initialPattern);
+
+	// Ranks above fill the largest void. Past half full Ulichney ranks the tightest cluster of free cells instead, with
+	// a kernel that sums to the same everywhere that is the same cell
+	for (uint32_t rank = initialCount; rank < count; rank++)
+	{
+		uint32_t hole = largestVoid();
+		toggle(hole);
+		ranks[hole] = (uint16_t)rank;
+	}
+
+	return ranks;
+}
+
+static float BlueNoise(uint32_t x, uint32_t y, uint32_t sampleIndex, uint32_t dimension)
+{
+	// Built by whichever thread asks first, tens of milliseconds once per process
+	static const std::vector<uint16_t> s_Ranks = GenerateBlueNoise();
+
+	// Every dimension looks at the mask through its own offset, so they are not correlated with each other
+	uint32_t offset = PcgHash(dimension + 1);
+	uint32_t maskX = (x + offset) & (s_BlueNoiseSize - 1);
+	uint32_t maskY = (y + (offset >> 8)) & (s_BlueNoiseSize - 1);
+
+	// Rank to the middle of its interval in 32 bit fixed point, then one R2 step per sample wrapping around
+	constexpr uint32_t rankShift = 32 - 12;
+	static_assert(s_BlueNoiseSize * s_BlueNoiseSize == 1 << 12, "rankShift assumes a 64x64 mask");
+
+	uint32_t value = ((uint32_t)s_Ranks[maskX + maskY * s_BlueNoiseSize] << rankShift) + (1u << (rankShift - 1));
+	value += sampleIndex * ((dimension & 1) ? s_R2StepY : s_R2StepX);
+	return ToFloat(value);
+}
+
+float Sampler::Get1D(uint32_t x, uint32_t y, uint32_t sampleIndex, uint32_t dimension) const
+{
+	switch (m_Type)
+	{
+	case SamplerType::Sobol:
+	{
+		glm::vec2 pair = SobolOwen(x, y, sampleIndex, dimension / 2);
+		return (dimension & 1) ? pair.y : pair.x;
+	}
+	case SamplerType::BlueNoise:
+		return BlueNoise(x, y, sampleIndex, dimension);
+	default:
+	{
+		// Older builds counted frames from 1 and hashed once more per dimension
+		uint32_t seed = PcgHash(x + y * m_Width) + sampleIndex + 1;
+		for (uint32_t i = 0; i < dimension; i++)
+			seed = PcgHash(seed);
+		return RandomFloat(seed);
+	}
+	}
+}
+
+glm::vec2 Sampler::Get2D(uint32_t x, uint32_t y, uint32_t sampleIndex, uint32_t dimension) const
+{
+	if (m_Type == SamplerType::Sobol && (dimension & 1) == 0)
+		return SobolOwen(x, y, sampleIndex, dimension / 2);
+
+	return { Get1D(x, y, sampleIndex, dimension), Get1D(x, y, sampleIndex, dimension + 1) };
+}
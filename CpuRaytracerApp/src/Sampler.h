@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+enum class SamplerType
+{
+	// Hashed white noise, the seeds older builds used so their images stay bit for bit the same
+	PCG = 0,
+
+	// Sobol (0,2) sequence with hash based Owen scrambling (Burley 2020), shuffled and scrambled per pixel and per pair
+	// of dimensions. Every power of two of samples is stratified, so a pixel converges faster than with white noise
+	Sobol,
+
+	// 64x64 void and cluster mask offset per dimension, stepped through the R2 sequence from sample to sample.
+	// Neighbouring pixels get samples far apart, what error is left looks like fine grain instead of blotches
+	BlueNoise
+};
+
+// Samples are a pure function of (pixel, sample index, dimension), nothing is stored between calls. Any thread gets the
+// same values for the same pixel, so images do not depend on the thread count or on which worker traced which tile
+class Sampler
+{
+public:
+	// width is only read by PCG, its seeds are pixel indices
+	Sampler(SamplerType type, uint32_t width) : m_Type(type), m_Width(width) {}
+
+	// In [0, 1], only PCG ever returns 1
+	float Get1D(uint32_t x, uint32_t y, uint32_t sampleIndex, uint32_t dimension) const;
+
+	// Dimensions dimension and dimension + 1, stratified together when dimension is even
+	glm::vec2 Get2D(uint32_t x, uint32_t y, uint32_t sampleIndex, uint32_t dimension) const;
+
+	SamplerType GetType() const { return m_Type; }
+
+private:
+	SamplerType m_Type;
+	uint32_t m_Width;
+};
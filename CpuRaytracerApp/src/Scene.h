@@ -1,8 +1,13 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 #include <glm/glm.hpp>
 
+#include "MappedFile.h"
+
 struct Sphere
 {
 	glm::vec3 Position{0.0f};
@@ -11,7 +16,160 @@ struct Sphere
 	glm::vec3 Albedo{1.0f};
 };
 
+// Read only spheres with one array per component, laid out the way SphereSoA traces them.
+// Binary scenes point these straight into their file mapping. PaddedCount is a multiple of 16 and padding has
+// a radius squared of the lowest float, so any SIMD width can run over the padded range
+struct SphereArrays
+{
+	uint32_t Count = 0;
+	uint32_t PaddedCount = 0;
+
+	const float* X = nullptr;
+	const float* Y = nullptr;
+	const float* Z = nullptr;
+	const float* RadiusSquared = nullptr;
+
+	const float* AlbedoR = nullptr;
+	const float* AlbedoG = nullptr;
+	const float* AlbedoB = nullptr;
+
+	// Keeps the memory behind the pointers alive
+	std::shared_ptr<const MappedFile> File;
+};
+
+// Indexed triangles. Meshes are shared between copies of a scene and never change after loading, replace them instead
+struct Mesh
+{
+	static constexpr uint32_t NoNormal = 0xffffffff;
+
+	std::vector<glm::vec3> Positions;
+	std::vector<uint32_t> Indices; // 3 per triangle into Positions
+
+	// Optional smooth shading, 3 per triangle into Normals. NoNormal where a face had none, it gets the face normal
+	std::vector<glm::vec3> Normals;
+	std::vector<uint32_t> NormalIndices;
+
+	glm::vec3 Albedo{ 0.8f };
+
+	// Where it was loaded from, text scenes refer to meshes by their file
+	std::string Filepath;
+
+	uint32_t GetTriangleCount() const { return (uint32_t)(Indices.size() / 3); }
+
+	// Shading normal at a point on the triangle, interpolated where all three corners have one. Not normalized and
+	// not flipped towards the ray, triangles are two sided
+	glm::vec3 GetNormal(uint32_t triangle, const glm::vec3& position) const
+	{
+		glm::vec3 v0 = Positions[Indices[triangle * 3 + 0]];
+		glm::vec3 v1 = Positions[Indices[triangle * 3 + 1]];
+		glm::vec3 v2 = Positions[Indices[triangle * 3 + 2]];
+
+		glm::vec3 edge1 = v1 - v0, edge2 = v2 - v0;
+		glm::vec3 normal = glm::cross(edge1, edge2);
+
+		if (NormalIndices.empty())
+			return normal;
+
+		uint32_t n0 = NormalIndices[triangle * 3 + 0];
+		uint32_t n1 = NormalIndices[triangle * 3 + 1];
+		uint32_t n2 = NormalIndices[triangle * 3 + 2];
+
+		// Barycentrics only get worked out for the closest hit, the intersection loops never need them
+		float area = glm::dot(normal, normal);
+		if (n0 == NoNormal || n1 == NoNormal || n2 == NoNormal || area <= 0.0f)
+			return normal;
+
+		glm::vec3 offset = position - v0;
+		float u = glm::dot(glm::cross(offset, edge2), normal) / area;
+		float v = glm::dot(glm::cross(edge1, offset), normal) / area;
+		return Normals[n0] * (1.0f - u - v) + Normals[n1] * u + Normals[n2] * v;
+	}
+};
+
+// Spheres and meshes in their own space, placed any number of times by instances. Like meshes they never change
+// once they are in a scene, replace them instead
+struct GeometryBlock
+{
+	std::string Name; // Text scenes refer to it by this
+
+	// Hits inside the block number the spheres first, then the triangles of every mesh in order
+	std::vector<Sphere> Spheres;
+	std::vector<std::shared_ptr<const Mesh>> Meshes;
+
+	uint32_t GetPrimitiveCount() const
+	{
+		uint32_t count = (uint32_t)Spheres.size();
+		for (const auto& mesh : Meshes)
+			count += mesh->GetTriangleCount();
+		return count;
+	}
+};
+
+// One placement of a geometry block. The block is shared, so an instance costs a transform no matter how big it is
+struct Instance
+{
+	std::shared_ptr<const GeometryBlock> Geometry;
+	glm::mat4 Transform{ 1.0f }; // Object to world, anything invertible
+};
+
 struct Scene
 {
 	std::vector<Sphere> Spheres;
-};
\ No newline at end of file
+
+	// Traced after the spheres, hits report them as GetSphereCount() + the triangle's position over all meshes
+	std::vector<std::shared_ptr<const Mesh>> Meshes;
+
+	// Traced after the meshes, hits report them as GetSphereCount() + every mesh triangle + the instance's index.
+	// Moving one only needs a Version bump, changing the list or its geometry is picked up like new spheres
+	std::vector<Instance> Instances;
+
+	// Set instead of Spheres for scenes loaded from a binary file, nothing gets copied until MakeEditable
+	std::shared_ptr<const SphereArrays> Mapped;
+
+	// Bump it after editing Spheres or moving Instances, renderers compare it to tell whether their image is still current
+	uint64_t Version = 0;
+
+	uint32_t GetSphereCount() const { return Mapped ? Mapped->Count : (uint32_t)Spheres.size(); }
+
+	glm::vec3 GetPosition(uint32_t index) const
+	{
+		if (Mapped)
+			return { Mapped->X[index], Mapped->Y[index], Mapped->Z[index] };
+		return Spheres[index].Position;
+	}
+
+	glm::vec3 GetAlbedo(uint32_t index) const
+	{
+		if (Mapped)
+			return { Mapped->AlbedoR[index], Mapped->AlbedoG[index], Mapped->AlbedoB[index] };
+		return Spheres[index].Albedo;
+	}
+
+	Sphere GetSphere(uint32_t index) const
+	{
+		if (!Mapped)
+			return Spheres[index];
+
+		// Only the squared radius is stored, its sign never mattered for intersections
+		Sphere sphere;
+		sphere.Position = GetPosition(index);
+		sphere.Radius = glm::sqrt(Mapped->RadiusSquared[index]);
+		sphere.Albedo = GetAlbedo(index);
+		return sphere;
+	}
+
+	// Copies mapped spheres into Spheres so they can be changed, the mapping is released
+	void MakeEditable()
+	{
+		if (!Mapped)
+			return;
+
+		std::vector<Sphere> spheres(Mapped->Count);
+		for (uint32_t i = 0; i < Mapped->Count; i++)
+			spheres[i] = GetSphere(i);
+
+		Spheres = std::move(spheres);
+		Mapped.reset();
+		Version++;
+	}
+};
@@ -0,0 +1,428 @@
+#include "SceneSerializer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "ObjLoader.h"
+
+SceneSerializer::SceneSerializer(Scene& scene)
+	: m_Scene(scene)
+{
+}
+
+bool SceneSerializer::IsBinary(const std::string& filepath)
+{
+	return filepath.size() >= 5 && filepath.compare(filepath.size() - 5, 5, ".crts") == 0;
+}
+
+bool SceneSerializer::Serialize(const std::string& filepath) const
+{
+	return IsBinary(filepath) ? SerializeBinary(filepath) : SerializeText(filepath);
+}
+
+bool SceneSerializer::Deserialize(const std::string& filepath)
+{
+	return IsBinary(filepath) ? DeserializeBinary(filepath) : DeserializeText(filepath);
+}
+
+bool SceneSerializer::SerializeText(const std::string& filepath) const
+{
+	std::ofstream stream(filepath);
+	if (!stream)
+	{
+		std::cerr << "Could not write scene " << filepath << std::endl;
+		return false;
+	}
+
+	std::filesystem::path directory = std::filesystem::absolute(filepath).parent_path();
+
+	auto writeSphere = [&](const Sphere& sphere)
+	{
+		stream << "sphere "
+			<< sphere.Position.x << ' ' << sphere.Position.y << ' ' << sphere.Position.z << ' '
+			<< sphere.Radius << ' '
+			<< sphere.Albedo.r << ' ' << sphere.Albedo.g << ' ' << sphere.Albedo.b << '\n';
+	};
+
+	auto writeMesh = [&](const Mesh& mesh)
+	{
+		if (mesh.Filepath.empty())
+		{
+			std::cerr << "Skipped a mesh that was not loaded from a file" << std::endl;
+			return;
+		}
+
+		stream << "mesh " << std::filesystem::proximate(mesh.Filepath, directory).generic_string() << ' '
+			<< mesh.Albedo.r << ' ' << mesh.Albedo.g << ' ' << mesh.Albedo.b << '\n';
+	};
+
+	stream << "# sphere x y z radius r g b\n";
+	for (uint32_t i = 0; i < m_Scene.GetSphereCount(); i++)
+		writeSphere(m_Scene.GetSphere(i));
+
+	for (const auto& mesh : m_Scene.Meshes)
+		writeMesh(*mesh);
+
+	// Every block once, before the first instance using it. Names have to be unique in the file, unnamed or
+	// clashing blocks get a generated one
+	std::unordered_map<const GeometryBlock*, std::string> blockNames;
+	std::unordered_map<std::string, const GeometryBlock*> usedNames;
+	for (const Instance& instance : m_Scene.Instances)
+	{
+		const GeometryBlock* block = instance.Geometry.get();
+		if (!block || blockNames.count(block))
+			continue;
+
+		std::string name = block->Name;
+		for (size_t suffix = blockNames.size(); name.empty() || name.find_first_of(" \t#") != std::string::npos || usedNames.count(name); suffix++)
+			name = "block" + std::to_string(suffix);
+
+		blockNames[block] = name;
+		usedNames[name] = block;
+
+		stream << "block " << name << '\n';
+		for (const Sphere& sphere : block->Spheres)
+			writeSphere(sphere);
+		for (const auto& mesh : block->Meshes)
+			writeMesh(*mesh);
+		stream << "end\n";
+	}
+
+	for (const Instance& instance : m_Scene.Instances)
+	{
+		if (!instance.Geometry)
+			continue;
+
+		stream << "instance " << blockNames[instance.Geometry.get()];
+		for (int row = 0; row < 3; row++)
+		{
+			for (int column = 0; column < 4; column++)
+				stream << ' ' << instance.Transform[column][row];
+		}
+		stream << '\n';
+	}
+
+	return (bool)stream;
+}
+
+bool SceneSerializer::DeserializeText(const std::string& filepath)
+{
+	std::ifstream stream(filepath);
+	if (!stream)
+	{
+		std::cerr << "Could not open scene " << filepath << std::endl;
+		return false;
+	}
+
+	std::vector<Sphere> spheres;
+	std::vector<std::shared_ptr<const Mesh>> meshes;
+	std::vector<Instance> instances;
+
+	// Spheres and meshes go into the open block instead of the scene until its end
+	std::unordered_map<std::string, std::shared_ptr<const GeometryBlock>> blocks;
+	std::shared_ptr<GeometryBlock> block;
+
+	// Started on the first mesh if the caller did not hand one in
+	std::unique_ptr<ThreadPool> ownThreadPool;
+
+	std::string line;
+	for (uint32_t lineNumber = 1; std::getline(stream, line); lineNumber++)
+	{
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.resize(comment);
+
+		std::istringstream tokens(line);
+
+		std::string type;
+		if (!(tokens >> type))
+			continue;
+
+		if (type == "sphere")
+		{
+			Sphere sphere;
+			tokens >> sphere.Position.x >> sphere.Position.y >> sphere.Position.z >> sphere.Radius
+				>> sphere.Albedo.r >> sphere.Albedo.g >> sphere.Albedo.b;
+
+			if (!tokens)
+			{
+				std::cerr << filepath << ":" << lineNumber << ": expected sphere x y z radius r g b" << std::endl;
+				return false;
+			}
+
+			if (block)
+				block->Spheres.push_back(sphere);
+			else
+				spheres.push_back(sphere);
+		}
+		else if (type == "mesh")
+		{
+			std::string meshPath;
+			auto mesh = std::make_shared<Mesh>();
+			tokens >> meshPath >> mesh->Albedo.r >> mesh->Albedo.g >> mesh->Albedo.b;
+
+			if (!tokens)
+			{
+				std::cerr << filepath << ":" << lineNumber << ": expected mesh file.obj r g b" << std::endl;
+				return false;
+			}
+
+			if (!m_ThreadPool && !ownThreadPool)
+				ownThreadPool = std::make_unique<ThreadPool>();
+
+			ObjLoader loader(*mesh, m_ThreadPool ? *m_ThreadPool : *ownThreadPool);
+			if (!loader.Load((std::filesystem::path(filepath).parent_path() / meshPath).string()))
+				return false;
+
+			if (block)
+				block->Meshes.push_back(mesh);
+			else
+				meshes.push_back(mesh);
+		}
+		else if (type == "block")
+		{
+			std::string name;
+			if (!(tokens >> name) || block)
+			{
+				std::cerr << filepath << ":" << lineNumber << ": expected block name, outside of other blocks" << std::endl;
+				return false;
+			}
+
+			if (blocks.count(name))
+			{
+				std::cerr << filepath << ":" << lineNumber << ": block '" << name << "' is already defined" << std::endl;
+				return false;
+			}
+
+			block = std::make_shared<GeometryBlock>();
+			block->Name = name;
+		}
+		else if (type == "end")
+		{
+			if (!block)
+			{
+				std::cerr << filepath << ":" << lineNumber << ": end without a block" << std::endl;
+				return false;
+			}
+
+			blocks[block->Name] = block;
+			block.reset();
+		}
+		else if (type == "instance")
+		{
+			std::string name;
+			tokens >> name;
+
+			std::vector<float> values;
+			for (float value; tokens >> value;)
+				values.push_back(value);
+
+			auto found = blocks.find(name);
+			if (found == blocks.end() || block)
+			{
+				std::cerr << filepath << ":" << lineNumber << ": instance of unknown block '" << name << "'" << std::endl;
+				return false;
+			}
+
+			Instance instance;
+			instance.Geometry = found->second;
+
+			if (values.size() == 3 || values.size() == 5)
+			{
+				instance.Transform = glm::translate(glm::mat4(1.0f), glm::vec3(values[0], values[1], values[2]));
+				if (values.size() == 5)
+				{
+					instance.Transform = glm::rotate(instance.Transform, glm::radians(values[3]), glm::vec3(0.0f, 1.0f, 0.0f));
+					instance.Transform = glm::scale(instance.Transform, glm::vec3(values[4]));
+				}
+			}
+			else if (values.size() == 12)
+			{
+				for (int row = 0; row < 3; row++)
+				{
+					for (int column = 0; column < 4; column++)
+						instance.Transform[column][row] = values[row * 4 + column];
+				}
+			}
+			else
+			{
+				std::cerr << filepath << ":" << lineNumber << ": expected instance name x y z [yaw scale] or a 3x4 matrix" << std::endl;
+				return false;
+			}
+
+			instances.push_back(instance);
+		}
+		else
+		{
+			std::cerr << filepath << ":" << lineNumber << ": unknown object '" << type << "'" << std::endl;
+			return false;
+		}
+	}
+
+	if (block)
+	{
+		std::cerr << filepath << ": block '" << block->Name << "' is missing its end" << std::endl;
+		return false;
+	}
+
+	m_Scene.Spheres = std::move(spheres);
+	m_Scene.Meshes = std::move(meshes);
+	m_Scene.Instances = std::move(instances);
+	m_Scene.Mapped.reset();
+	m_Scene.Version++;
+	return true;
+}
+
+static uint64_t AlignSection(uint64_t offset)
+{
+	return (offset + 63) & ~(uint64_t)63;
+}
+
+bool SceneSerializer::SerializeBinary(const std::string& filepath) const
+{
+	std::ofstream stream(filepath, std::ios::binary);
+	if (!stream)
+	{
+		std::cerr << "Could not write scene " << filepath << std::endl;
+		return false;
+	}
+
+	if (!m_Scene.Meshes.empty() || !m_Scene.Instances.empty())
+		std::cerr << "Binary scenes only hold spheres, meshes and instances are not written to " << filepath << std::endl;
+
+	BinarySceneHeader header;
+	header.SphereCount = m_Scene.GetSphereCount();
+	header.PaddedCount = (header.SphereCount + 15) / 16 * 16;
+
+	uint64_t sectionSize = (uint64_t)header.PaddedCount * sizeof(float);
+	uint64_t offset = AlignSection(sizeof(BinarySceneHeader));
+	for (uint32_t section = 0; section < BinarySceneHeader::SectionCount; section++)
+	{
+		header.Sections[section] = offset;
+		offset = AlignSection(offset + sectionSize);
+	}
+
+	stream.write((const char*)&header, sizeof(header));
+
+	// One section at a time, so only a single array of the scene is held in memory
+	std::vector<float> values(header.PaddedCount);
+	for (uint32_t section = 0; section < BinarySceneHeader::SectionCount; section++)
+	{
+		float padding = section == BinarySceneHeader::RadiusSquared ? std::numeric_limits<float>::lowest() : 0.0f;
+		std::fill(values.begin() + header.SphereCount, values.end(), padding);
+
+		for (uint32_t i = 0; i < header.SphereCount; i++)
+		{
+			Sphere sphere = m_Scene.GetSphere(i);
+			switch (section)
+			{
+			case BinarySceneHeader::X: values[i] = sphere.Position.x; break;
+			case BinarySceneHeader::Y: values[i] = sphere.Position.y; break;
+			case BinarySceneHeader::Z: values[i] = sphere.Position.z; break;
+			case BinarySceneHeader::RadiusSquared: values[i] = sphere.Radius * sphere.Radius; break;
+			case BinarySceneHeader::AlbedoR: values[i] = sphere.Albedo.r; break;
+			case BinarySceneHeader::AlbedoG: values[i] = sphere.Albedo.g; break;
+			case BinarySceneHeader::AlbedoB: values[i] = sphere.Albedo.b; break;
+			}
+		}
+
+		// Zero fill up to the section start
+		static const char zeros[64] = {};
+		stream.write(zeros, header.Sections[section] - (uint64_t)stream.tellp());
+		stream.write((const char*)values.data(), sectionSize);
+	}
+
+	return (bool)stream;
+}
+
+bool SceneSerializer::DeserializeBinary(const std::string& filepath)
+{
+	auto file = std::make_shared<MappedFile>();
+	if (!file->Open(filepath))
+	{
+		std::cerr << "Could not open scene " << filepath << std::endl;
+		return false;
+	}
+
+	// No parsing, the header only has to describe arrays that are really in the file
+	BinarySceneHeader header;
+	if (file->GetSize() < sizeof(header))
+	{
+		std::cerr << filepath << ": too small for a binary scene" << std::endl;
+		return false;
+	}
+	memcpy(&header, file->GetData(), sizeof(header));
+
+	if (memcmp(header.Magic, BinarySceneHeader().Magic, sizeof(header.Magic)) != 0)
+	{
+		std::cerr << filepath << ": not a binary scene" << std::endl;
+		return false;
+	}
+
+	if (header.Version != BinarySceneHeader::CurrentVersion)
+	{
+		std::cerr << filepath << ": binary scene version " << header.Version << ", expected " << BinarySceneHeader::CurrentVersion << std::endl;
+		return false;
+	}
+
+	if (header.PaddedCount != ((uint64_t)header.SphereCount + 15) / 16 * 16)
+	{
+		std::cerr << filepath << ": invalid sphere count" << std::endl;
+		return false;
+	}
+
+	uint64_t sectionSize = (uint64_t)header.PaddedCount * sizeof(float);
+	const float* sections[BinarySceneHeader::SectionCount];
+	for (uint32_t section = 0; section < BinarySceneHeader::SectionCount; section++)
+	{
+		uint64_t offset = header.Sections[section];
+		if (offset % 64 != 0 || offset > file->GetSize() || file->GetSize() - offset < sectionSize)
+		{
+			std::cerr << filepath << ": section " << section << " is misaligned or truncated" << std::endl;
+			return false;
+		}
+
+		sections[section] = (const float*)(file->GetData() + offset);
+
+		// The mapping is read only and the intersection loops trust padding lanes to never hit, a hit there would index
+		// past the spheres. Only up to 15 of them, so checking costs nothing
+		float padding = section == BinarySceneHeader::RadiusSquared ? std::numeric_limits<float>::lowest() : 0.0f;
+		for (uint32_t i = header.SphereCount; i < header.PaddedCount; i++)
+		{
+			if (memcmp(&sections[section][i], &padding, sizeof(float)) != 0)
+			{
+				std::cerr << filepath << ": section " << section << " has invalid padding" << std::endl;
+				return false;
+			}
+		}
+	}
+
+	auto arrays = std::make_shared<SphereArrays>();
+	arrays->Count = header.SphereCount;
+	arrays->PaddedCount = header.PaddedCount;
+	arrays->X = sections[BinarySceneHeader::X];
+	arrays->Y = sections[BinarySceneHeader::Y];
+	arrays->Z = sections[BinarySceneHeader::Z];
+	arrays->RadiusSquared = sections[BinarySceneHeader::RadiusSquared];
+	arrays->AlbedoR = sections[BinarySceneHeader::AlbedoR];
+	arrays->AlbedoG = sections[BinarySceneHeader::AlbedoG];
+	arrays->AlbedoB = sections[BinarySceneHeader::AlbedoB];
+	arrays->File = file;
+
+	m_Scene.Spheres.clear();
+	m_Scene.Meshes.clear();
+	m_Scene.Instances.clear();
+	m_Scene.Mapped = arrays;
+	m_Scene.Version++;
+	return true;
+}
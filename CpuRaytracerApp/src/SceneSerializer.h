@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+
+#include "Scene.h"
+#include "ThreadPool.h"
+
+// Two formats, picked by the file extension.
+//
+// Plain text scenes (anything but .crts), one object per line:
+//   sphere <x> <y> <z> <radius> <r> <g> <b>
+//   mesh <file.obj> <r> <g> <b>
+// Spheres and meshes between block and end make up a geometry block that instances place by name:
+//   block <name>
+//   end
+//   instance <name> <x> <y> <z> [<yaw degrees> <scale>]
+//   instance <name> <m00> <m01> <m02> <m03> <m10> ... <m23>   (object to world, rows of a 3x4 matrix)
+// Mesh paths are relative to the scene file. Empty lines and everything after a # are ignored
+//
+// Binary scenes (.crts) are meant for millions of spheres. They are memory mapped and traced in place, loading one
+// only validates the header, see BinarySceneHeader. Loaded scenes are read only until Scene::MakeEditable.
+// They only hold spheres, meshes and instances are left out
+class SceneSerializer
+{
+public:
+	SceneSerializer(Scene& scene);
+
+	bool Serialize(const std::string& filepath) const;
+
+	// Replaces the scene's contents, problems are reported to stderr (with their line number for text scenes)
+	bool Deserialize(const std::string& filepath);
+
+	// Meshes of text scenes are parsed on this pool. Without one, a scene with meshes starts a pool of its own that
+	// every mesh of the file shares
+	void SetThreadPool(ThreadPool* threadPool) { m_ThreadPool = threadPool; }
+
+	static bool IsBinary(const std::string& filepath);
+private:
+	bool SerializeText(const std::string& filepath) const;
+	bool SerializeBinary(const std::string& filepath) const;
+
+	bool DeserializeText(const std::string& filepath);
+	bool DeserializeBinary(const std::string& filepath);
+private:
+	Scene& m_Scene;
+	ThreadPool* m_ThreadPool = nullptr;
+};
+
+// Little endian. Every section is a float array of PaddedCount entries starting on a 64 byte boundary,
+// padding entries are 0 except radius squared, which is the lowest float (see SphereArrays). PaddedCount is SphereCount
+// rounded up to 16, files with anything else there are rejected
+struct BinarySceneHeader
+{
+	static constexpr uint32_t CurrentVersion = 1;
+
+	enum Section
+	{
+		X = 0, Y, Z, RadiusSquared, AlbedoR, AlbedoG, AlbedoB,
+		SectionCount
+	};
+
+	char Magic[4] = { 'C', 'R', 'T', 'S' };
+	uint32_t Version = CurrentVersion;
+	uint32_t SphereCount = 0;
+	uint32_t PaddedCount = 0;
+
+	// Byte offsets from the start of the file
+	uint64_t Sections[SectionCount] = {};
+};
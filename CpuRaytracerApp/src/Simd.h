@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Lane count for ray packets and the other vectorized loops, picked at compile time from the enabled instruction set.
+// Define RT_SIMD_WIDTH yourself (1, 4, 8 or 16) to force a narrower path, eg. to compare against scalar
+#ifndef RT_SIMD_WIDTH
+	#if defined(__AVX512F__)
+		#define RT_SIMD_WIDTH 16
+	#elif defined(__AVX2__)
+		#define RT_SIMD_WIDTH 8
+	#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define RT_SIMD_WIDTH 4
+	#else
+		#define RT_SIMD_WIDTH 1
+	#endif
+#endif
+
+#if RT_SIMD_WIDTH == 16
+	#if !defined(__AVX512F__)
+		#error "RT_SIMD_WIDTH 16 needs AVX-512 enabled (/arch:AVX512 or -mavx512f)"
+	#endif
+	#include <immintrin.h>
+#elif RT_SIMD_WIDTH == 8
+	#if !defined(__AVX2__)
+		#error "RT_SIMD_WIDTH 8 needs AVX2 enabled (/arch:AVX2 or -mavx2)"
+	#endif
+	#include <immintrin.h>
+#elif RT_SIMD_WIDTH == 4
+	#include <emmintrin.h>
+#elif RT_SIMD_WIDTH == 1
+	#include <cmath>
+#else
+	#error "RT_SIMD_WIDTH must be 1, 4, 8 or 16"
+#endif
+
+namespace Simd
+{
+	constexpr uint32_t Width = RT_SIMD_WIDTH;
+
+	// ToInt rounds to nearest, StoreBytes writes every lane as one byte and expects them to be 0 - 255 already
+
+#if RT_SIMD_WIDTH == 16
+
+	struct Mask { __mmask16 v; };
+	struct Float { __m512 v; Float() = default; Float(__m512 x) : v(x) {} Float(float x) : v(_mm512_set1_ps(x)) {} };
+	struct Int { __m512i v; Int() = default; Int(__m512i x) : v(x) {} Int(int32_t x) : v(_mm512_set1_epi32(x)) {} };
+
+	inline Float Load(const float* p) { return _mm512_loadu_ps(p); }
+	inline void Store(float* p, Float a) { _mm512_storeu_ps(p, a.v); }
+	inline Int LoadInt(const int32_t* p) { return _mm512_loadu_si512(p); }
+	inline void Store(int32_t* p, Int a) { _mm512_storeu_si512(p, a.v); }
+	inline Int LaneIndices() { return _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); }
+
+	inline Float operator+(Float a, Float b) { return _mm512_add_ps(a.v, b.v); }
+	inline Float operator-(Float a, Float b) { return _mm512_sub_ps(a.v, b.v); }
+	inline Float operator*(Float a, Float b) { return _mm512_mul_ps(a.v, b.v); }
+	inline Float operator/(Float a, Float b) { return _mm512_div_ps(a.v, b.v); }
+	inline Float Sqrt(Float a) { return _mm512_sqrt_ps(a.v); }
+	inline Float Min(Float a, Float b) { return _mm512_min_ps(a.v, b.v); }
+	inline Float Max(Float a, Float b) { return _mm512_max_ps(a.v, b.v); }
+	inline Int operator+(Int a, Int b) { return _mm512_add_epi32(a.v, b.v); }
+	inline Float ToFloat(Int a) { return _mm512_cvtepi32_ps(a.v); }
+	inline Int ToInt(Float a) { return _mm512_cvtps_epi32(a.v); }
+	inline void StoreBytes(uint8_t* p, Int a) { _mm_storeu_si128((__m128i*)p, _mm512_cvtepi32_epi8(a.v)); }
+
+	inline Mask operator<(Float a, Float b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+	inline Mask operator>(Float a, Float b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+	inline Mask operator<=(Float a, Float b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) }; }
+	inline Mask operator>=(Float a, Float b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) }; }
+	inline Mask operator<(Int a, Int b) { return { _mm512_cmplt_epi32_mask(a.v, b.v) }; }
+
+	inline Mask operator&(Mask a, Mask b) { return { (__mmask16)(a.v & b.v) }; }
+	inline Mask operator|(Mask a, Mask b) { return { (__mmask16)(a.v | b.v) }; }
+	inline Mask AndNot(Mask a, Mask b) { return { (__mmask16)(~a.v & b.v) }; } // !a & b
+	inline uint32_t Bits(Mask m) { return m.v; }
+	inline bool Any(Mask m) { return m.v != 0; }
+
+	inline Float Select(Mask m, Float a, Float b) { return _mm512_mask_blend_ps(m.v, b.v, a.v); }
+	inline Int Select(Mask m, Int a, Int b) { return _mm512_mask_blend_epi32(m.v, b.v, a.v); }
+
+	inline float HorizontalMin(Float a) { return _mm512_reduce_min_ps(a.v); }
+
+#elif RT_SIMD_WIDTH == 8
+
+	struct Mask { __m256 v; };
+	struct Float { __m256 v; Float() = default; Float(__m256 x) : v(x) {} Float(float x) : v(_mm256_set1_ps(x)) {} };
+	struct Int { __m256i v; Int() = default; Int(__m256i x) : v(x) {} Int(int32_t x) : v(_mm256_set1_epi32(x)) {} };
+
+	inline Float Load(const float* p) { return _mm256_loadu_ps(p); }
+	inline void Store(float* p, Float a) { _mm256_storeu_ps(p, a.v); }
+	inline Int LoadInt(const int32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+	inline void Store(int32_t* p, Int a) { _mm256_storeu_si256((__m256i*)p, a.v); }
+	inline Int LaneIndices() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+
+	inline Float operator+(Float a, Float b) { return _mm256_add_ps(a.v, b.v); }
+	inline Float operator-(Float a, Float b) { return _mm256_sub_ps(a.v, b.v); }
+	inline Float operator*(Float a, Float b) { return _mm256_mul_ps(a.v, b.v); }
+	inline Float operator/(Float a, Float b) { return _mm256_div_ps(a.v, b.v); }
+	inline Float Sqrt(Float a) { return _mm256_sqrt_ps(a.v); }
+	inline Float Min(Float a, Float b) { return _mm256_min_ps(a.v, b.v); }
+	inline Float Max(Float a, Float b) { return _mm256_max_ps(a.v, b.v); }
+	inline Int operator+(Int a, Int b) { return _mm256_add_epi32(a.v, b.v); }
+	inline Float ToFloat(Int a) { return _mm256_cvtepi32_ps(a.v); }
+	inline Int ToInt(Float a) { return _mm256_cvtps_epi32(a.v); }
+	inline void StoreBytes(uint8_t* p, Int a)
+	{
+		__m128i words = _mm_packs_epi32(_mm256_castsi256_si128(a.v), _mm256_extracti128_si256(a.v, 1));
+		_mm_storel_epi64((__m128i*)p, _mm_packus_epi16(words, words));
+	}
+
+	inline Mask operator<(Float a, Float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+	inline Mask operator>(Float a, Float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+	inline Mask operator<=(Float a, Float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+	inline Mask operator>=(Float a, Float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+	inline Mask operator<(Int a, Int b) { return { _mm256_castsi256_ps(_mm256_cmpgt_epi32(b.v, a.v)) }; }
+
+	inline Mask operator&(Mask a, Mask b) { return { _mm256_and_ps(a.v, b.v) }; }
+	inline Mask operator|(Mask a, Mask b) { return { _mm256_or_ps(a.v, b.v) }; }
+	inline Mask AndNot(Mask a, Mask b) { return { _mm256_andnot_ps(a.v, b.v) }; } // !a & b
+	inline uint32_t Bits(Mask m) { return (uint32_t)_mm256_movemask_ps(m.v); }
+	inline bool Any(Mask m) { return _mm256_movemask_ps(m.v) != 0; }
+
+	inline Float Select(Mask m, Float a, Float b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+	inline Int Select(Mask m, Int a, Int b) { return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b.v), _mm256_castsi256_ps(a.v), m.v)); }
+
+	inline float HorizontalMin(Float a)
+	{
+		__m128 m = _mm_min_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+		m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+		m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+		return _mm_cvtss_f32(m);
+	}
+
+#elif RT_SIMD_WIDTH == 4
+
+	struct Mask { __m128 v; };
+	struct Float { __m128 v; Float() = default; Float(__m128 x) : v(x) {} Float(float x) : v(_mm_set1_ps(x)) {} };
+	struct Int { __m128i v; Int() = default; Int(__m128i x) : v(x) {} Int(int32_t x) : v(_mm_set1_epi32(x)) {} };
+
+	inline Float Load(const float* p) { return _mm_loadu_ps(p); }
+	inline void Store(float* p, Float a) { _mm_storeu_ps(p, a.v); }
+	inline Int LoadInt(const int32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+	inline void Store(int32_t* p, Int a) { _mm_storeu_si128((__m128i*)p, a.v); }
+	inline Int LaneIndices() { return _mm_setr_epi32(0, 1, 2, 3); }
+
+	inline Float operator+(Float a, Float b) { return _mm_add_ps(a.v, b.v); }
+	inline Float operator-(Float a, Float b) { return _mm_sub_ps(a.v, b.v); }
+	inline Float operator*(Float a, Float b) { return _mm_mul_ps(a.v, b.v); }
+	inline Float operator/(Float a, Float b) { return _mm_div_ps(a.v, b.v); }
+	inline Float Sqrt(Float a) { return _mm_sqrt_ps(a.v); }
+	inline Float Min(Float a, Float b) { return _mm_min_ps(a.v, b.v); }
+	inline Float Max(Float a, Float b) { return _mm_max_ps(a.v, b.v); }
+	inline Int operator+(Int a, Int b) { return _mm_add_epi32(a.v, b.v); }
+	inline Float ToFloat(Int a) { return _mm_cvtepi32_ps(a.v); }
+	inline Int ToInt(Float a) { return _mm_cvtps_epi32(a.v); }
+	inline void StoreBytes(uint8_t* p, Int a)
+	{
+		__m128i words = _mm_packs_epi32(a.v, a.v);
+		int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+		memcpy(p, &bytes, sizeof(bytes));
+	}
+
+	inline Mask operator<(Float a, Float b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+	inline Mask operator>(Float a, Float b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+	inline Mask operator<=(Float a, Float b) { return { _mm_cmple_ps(a.v, b.v) }; }
+	inline Mask operator>=(Float a, Float b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+	inline Mask operator<(Int a, Int b) { return { _mm_castsi128_ps(_mm_cmplt_epi32(a.v, b.v)) }; }
+
+	inline Mask operator&(Mask a, Mask b) { return { _mm_and_ps(a.v, b.v) }; }
+	inline Mask operator|(Mask a, Mask b) { return { _mm_or_ps(a.v, b.v) }; }
+	inline Mask AndNot(Mask a, Mask b) { return { _mm_andnot_ps(a.v, b.v) }; } // !a & b
+	inline uint32_t Bits(Mask m) { return (uint32_t)_mm_movemask_ps(m.v); }
+	inline bool Any(Mask m) { return _mm_movemask_ps(m.v) != 0; }
+
+	// SSE2 has no blendv, so and/andnot/or it is
+	inline Float Select(Mask m, Float a, Float b) { return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); }
+	inline Int Select(Mask m, Int a, Int b)
+	{
+		__m128i mi = _mm_castps_si128(m.v);
+		return _mm_or_si128(_mm_and_si128(mi, a.v), _mm_andnot_si128(mi, b.v));
+	}
+
+	inline float HorizontalMin(Float a)
+	{
+		__m128 m = _mm_min_ps(a.v, _mm_movehl_ps(a.v, a.v));
+		m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+		return _mm_cvtss_f32(m);
+	}
+
+#else
+
+	// Scalar fallback so every vectorized loop still compiles (and can be compared against) without SIMD
+	struct Mask { bool v; };
+	struct Float { float v; Float() = default; Float(float x) : v(x) {} };
+	struct Int { int32_t v; Int() = default; Int(int32_t x) : v(x) {} };
+
+	inline Float Load(const float* p) { return *p; }
+	inline void Store(float* p, Float a) { *p = a.v; }
+	inline Int LoadInt(const int32_t* p) { return *p; }
+	inline void Store(int32_t* p, Int a) { *p = a.v; }
+	inline Int LaneIndices() { return 0; }
+
+	inline Float operator+(Float a, Float b) { return a.v + b.v; }
+	inline Float operator-(Float a, Float b) { return a.v - b.v; }
+	inline Float operator*(Float a, Float b) { return a.v * b.v; }
+	inline Float operator/(Float a, Float b) { return a.v / b.v; }
+	inline Float Sqrt(Float a) { return std::sqrt(a.v); }
+	inline Float Min(Float a, Float b) { return a.v < b.v ? a.v : b.v; }
+	inline Float Max(Float a, Float b) { return a.v > b.v ? a.v : b.v; }
+	inline Int operator+(Int a, Int b) { return a.v + b.v; }
+	inline Float ToFloat(Int a) { return (float)a.v; }
+	inline Int ToInt(Float a) { return (int32_t)std::nearbyint(a.v); }
+	inline void StoreBytes(uint8_t* p, Int a) { *p = (uint8_t)a.v; }
+
+	inline Mask operator<(Float a, Float b) { return { a.v < b.v }; }
+	inline Mask operator>(Float a, Float b) { return { a.v > b.v }; }
+	inline Mask operator<=(Float a, Float b) { return { a.v <= b.v }; }
+	inline Mask operator>=(Float a, Float b) { return { a.v >= b.v }; }
+	inline Mask operator<(Int a, Int b) { return { a.v < b.v }; }
+
+	inline Mask operator&(Mask a, Mask b) { return { a.v && b.v }; }
+	inline Mask operator|(Mask a, Mask b) { return { a.v || b.v }; }
+	inline Mask AndNot(Mask a, Mask b) { return { !a.v && b.v }; } // !a & b
+	inline uint32_t Bits(Mask m) { return m.v ? 1u : 0u; }
+	inline bool Any(Mask m) { return m.v; }
+
+	inline Float Select(Mask m, Float a, Float b) { return m.v ? a : b; }
+	inline Int Select(Mask m, Int a, Int b) { return m.v ? a : b; }
+
+	inline float HorizontalMin(Float a) { return a.v; }
+
+#endif
+
+	inline uint32_t Count(Mask m)
+	{
+		uint32_t bits = Bits(m), count = 0;
+		for (; bits != 0; bits &= bits - 1)
+			count++;
+		return count;
+	}
+}
\ No newline at end of file
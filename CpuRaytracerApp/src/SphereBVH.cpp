@@ -0,0 +1,57 @@
+#include "SphereBVH.h"
+
+#include "SphereIntersection.h"
+
+void SphereBVH::Build(const std::vector<Sphere>& spheres, BVHCache& cache)
+{
+	std::vector<AABB> bounds(spheres.size());
+	for (size_t i = 0; i < spheres.size(); i++)
+	{
+		glm::vec3 extent(glm::abs(spheres[i].Radius));
+		bounds[i].Min = spheres[i].Position - extent;
+		bounds[i].Max = spheres[i].Position + extent;
+	}
+
+	cache.LoadOrBuild(m_BVH, bounds);
+
+	const uint32_t* indices = m_BVH.GetIndices();
+	m_Spheres.resize(m_BVH.GetPrimitiveCount());
+	for (uint32_t i = 0; i < m_BVH.GetPrimitiveCount(); i++)
+	{
+		const Sphere& sphere = spheres[indices[i]];
+		m_Spheres[i] = glm::vec4(sphere.Position, sphere.Radius * sphere.Radius);
+	}
+}
+
+void SphereBVH::Intersect(const Ray& ray, float& hitDistance, int& closestIndex, TraversalStats& stats) const
+{
+	const uint32_t* indices = m_BVH.GetIndices();
+
+	m_BVH.Traverse(ray, hitDistance, [&](uint32_t first, uint32_t count, float& closestT)
+		{
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				float t = IntersectSphere(ray, m_Spheres[i]);
+				if (t > 0.0f && t < closestT)
+				{
+					closestT = t;
+					closestIndex = (int)indices[i];
+				}
+			}
+		}, stats);
+}
+
+void SphereBVH::Intersect(const RayPacket& packet, Simd::Mask active, Simd::Float& hitDistances, Simd::Int& closestIndices, TraversalStats& stats) const
+{
+	const uint32_t* indices = m_BVH.GetIndices();
+	Simd::Float a = packet.DirectionX * packet.DirectionX + packet.DirectionY * packet.DirectionY + packet.DirectionZ * packet.DirectionZ;
+
+	m_BVH.Traverse(packet, active, hitDistances, [&](uint32_t first, uint32_t count, Simd::Mask lanes, Simd::Float& closestT)
+		{
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				const glm::vec4& sphere = m_Spheres[i];
+				IntersectSphere(packet, a, sphere.x, sphere.y, sphere.z, sphere.w, (int32_t)indices[i], lanes, closestT, closestIndices);
+			}
+		}, stats);
+}
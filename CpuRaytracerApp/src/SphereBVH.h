@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+#include "BVH.h"
+#include "BVHCache.h"
+#include "Memory.h"
+#include "Scene.h"
+
+// Spheres of a geometry block ready for tracing, the sphere counterpart of MeshBVH.
+// (position, radius squared) is copied out in leaf order, so a leaf reads one contiguous range
+class SphereBVH
+{
+public:
+	void Build(const std::vector<Sphere>& spheres, BVHCache& cache);
+
+	uint32_t GetSphereCount() const { return (uint32_t)m_Spheres.size(); }
+	const BVH& GetBVH() const { return m_BVH; }
+
+	// Closest hit closer than hitDistance, closestIndex becomes the sphere's index in the list it was built from
+	void Intersect(const Ray& ray, float& hitDistance, int& closestIndex, TraversalStats& stats) const;
+
+	void Intersect(const RayPacket& packet, Simd::Mask active, Simd::Float& hitDistances, Simd::Int& closestIndices, TraversalStats& stats) const;
+
+private:
+	BVH m_BVH;
+	AlignedVector<glm::vec4> m_Spheres;
+};
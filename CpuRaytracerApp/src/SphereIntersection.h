@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Ray.h"
+#include "Simd.h"
+
+// Ray/sphere intersection shared by the scene's spheres and the ones inside instanced geometry.
+// Directions do not have to be normalized, so rays moved into an instance's space keep their world distances
+
+// Distance to the first intersection in front of the ray origin, negative on a miss. sphere is (position, radius squared)
+inline float IntersectSphere(const Ray& ray, const glm::vec4& sphere)
+{
+	glm::vec3 origin = ray.Origin - glm::vec3(sphere);
+
+	float a = glm::dot(ray.Direction, ray.Direction);
+	float b = 2.0f * glm::dot(origin, ray.Direction);
+	float c = glm::dot(origin, origin) - sphere.w;
+
+	float discriminant = b * b - 4.0f * a * c;
+	if (discriminant < 0.0f)
+		return -1.0f;
+
+	return (-b - glm::sqrt(discriminant)) / (2.0f * a);
+}
+
+// One sphere against every active lane of a packet, a is the squared length of each direction
+inline void IntersectSphere(const RayPacket& packet, const Simd::Float& a, float x, float y, float z, float radiusSquared, int32_t index,
+	Simd::Mask active, Simd::Float& hitDistance, Simd::Int& closestSphere)
+{
+	Simd::Float originX = packet.OriginX - x;
+	Simd::Float originY = packet.OriginY - y;
+	Simd::Float originZ = packet.OriginZ - z;
+
+	Simd::Float b = 2.0f * (originX * packet.DirectionX + originY * packet.DirectionY + originZ * packet.DirectionZ);
+	Simd::Float c = (originX * originX + originY * originY + originZ * originZ) - radiusSquared;
+
+	Simd::Float discriminant = b * b - 4.0f * a * c;
+
+	// Skip the square root when every lane misses
+	Simd::Mask hit = active & (discriminant >= 0.0f);
+	if (!Simd::Any(hit))
+		return;
+
+	Simd::Float closestT = (Simd::Float(0.0f) - b - Simd::Sqrt(Simd::Max(discriminant, 0.0f))) / (2.0f * a);
+
+	Simd::Mask closer = hit & (closestT > 0.0f) & (closestT < hitDistance);
+	hitDistance = Simd::Select(closer, closestT, hitDistance);
+	closestSphere = Simd::Select(closer, Simd::Int(index), closestSphere);
+}
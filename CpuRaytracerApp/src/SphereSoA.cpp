@@ -0,0 +1,51 @@
+#include "SphereSoA.h"
+
+#include <limits>
+
+void SphereSoA::Build(const std::vector<Sphere>& spheres)
+{
+	m_Count = (uint32_t)spheres.size();
+
+	uint32_t paddedCount = (m_Count + Simd::Width - 1) / Simd::Width * Simd::Width;
+
+	// Padding lanes get a hugely negative radius squared so their discriminant can never be positive
+	m_X.assign(paddedCount, 0.0f);
+	m_Y.assign(paddedCount, 0.0f);
+	m_Z.assign(paddedCount, 0.0f);
+	m_RadiusSquared.assign(paddedCount, std::numeric_limits<float>::lowest());
+
+	for (uint32_t i = 0; i < m_Count; i++)
+		Update(i, spheres[i]);
+
+	m_PaddedCount = paddedCount;
+	m_XData = m_X.data();
+	m_YData = m_Y.data();
+	m_ZData = m_Z.data();
+	m_RadiusSquaredData = m_RadiusSquared.data();
+}
+
+void SphereSoA::Reference(const SphereArrays& arrays)
+{
+	m_Count = arrays.Count;
+
+	// The arrays are padded to 16, only as far as Simd::Width needs is traced
+	m_PaddedCount = (m_Count + Simd::Width - 1) / Simd::Width * Simd::Width;
+
+	m_X.clear();
+	m_Y.clear();
+	m_Z.clear();
+	m_RadiusSquared.clear();
+
+	m_XData = arrays.X;
+	m_YData = arrays.Y;
+	m_ZData = arrays.Z;
+	m_RadiusSquaredData = arrays.RadiusSquared;
+}
+
+void SphereSoA::Update(uint32_t index, const Sphere& sphere)
+{
+	m_X[index] = sphere.Position.x;
+	m_Y[index] = sphere.Position.y;
+	m_Z[index] = sphere.Position.z;
+	m_RadiusSquared[index] = sphere.Radius * sphere.Radius;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+#include "Memory.h"
+#include "Scene.h"
+#include "Simd.h"
+
+// Intersection only copy of Scene::Spheres with one array per component, padded to a multiple of Simd::Width.
+// One ray is tested against Simd::Width spheres per instruction and the albedo never gets pulled into cache
+class SphereSoA
+{
+public:
+	void Build(const std::vector<Sphere>& spheres);
+	void Update(uint32_t index, const Sphere& sphere);
+
+	// Uses arrays that already have the right layout (a binary scene's mapping) instead of copying, they have to outlive the next Build.
+	// Update must not be called until the next Build
+	void Reference(const SphereArrays& arrays);
+
+	uint32_t GetCount() const { return m_Count; }
+	uint32_t GetPaddedCount() const { return m_PaddedCount; }
+
+	const float* GetX() const { return m_XData; }
+	const float* GetY() const { return m_YData; }
+	const float* GetZ() const { return m_ZData; }
+	const float* GetRadiusSquared() const { return m_RadiusSquaredData; }
+
+private:
+	uint32_t m_Count = 0;
+	uint32_t m_PaddedCount = 0;
+
+	// Either the arrays below or referenced ones
+	const float* m_XData = nullptr;
+	const float* m_YData = nullptr;
+	const float* m_ZData = nullptr;
+	const float* m_RadiusSquaredData = nullptr;
+
+	AlignedVector<float> m_X;
+	AlignedVector<float> m_Y;
+	AlignedVector<float> m_Z;
+	AlignedVector<float> m_RadiusSquared;
+};
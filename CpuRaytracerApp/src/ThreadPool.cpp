@@ -0,0 +1,178 @@
+#include "ThreadPool.h"
+
+#include <string>
+
+#include "Memory.h"
+#include "Profiler.h"
+
+static uint32_t DefaultThreadCount()
+{
+	uint32_t count = std::thread::hardware_concurrency();
+	return count > 0 ? count : 1;
+}
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+	Start(threadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+	Stop();
+}
+
+void ThreadPool::SetThreadCount(uint32_t threadCount)
+{
+	if (threadCount == 0)
+		threadCount = DefaultThreadCount();
+
+	if (threadCount == GetThreadCount())
+		return;
+
+	Stop();
+	Start(threadCount);
+}
+
+void ThreadPool::ParallelFor(uint32_t jobCount, const JobFunc& func)
+{
+	if (jobCount == 0)
+		return;
+
+	uint32_t threadCount = GetThreadCount();
+
+	// Workers only read it after taking a job under a queue lock, so this is published by the pushes below
+	m_Func = &func;
+	m_PendingJobs = jobCount;
+
+	// Hand out contiguous ranges so neighbouring jobs start on the same thread. The owner walks its range in order
+	// while thieves take from the far end
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		WorkQueue& queue = *m_Queues[i];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		queue.Begin = (uint32_t)((uint64_t)jobCount * i / threadCount);
+		queue.End = (uint32_t)((uint64_t)jobCount * (i + 1) / threadCount);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Generation++;
+	}
+	m_WakeCondition.notify_all();
+
+	// The calling thread works too instead of just sleeping
+	uint32_t callerIndex = threadCount - 1;
+	while (RunNextJob(callerIndex))
+		;
+
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_DoneCondition.wait(lock, [this]() { return m_PendingJobs == 0; });
+	}
+
+	m_Func = nullptr;
+}
+
+void ThreadPool::Start(uint32_t threadCount)
+{
+	if (threadCount == 0)
+		threadCount = DefaultThreadCount();
+
+	m_Queues.clear();
+	for (uint32_t i = 0; i < threadCount; i++)
+		m_Queues.push_back(std::make_unique<WorkQueue>());
+
+	// The last queue is served by whoever calls ParallelFor
+	for (uint32_t i = 0; i + 1 < threadCount; i++)
+		m_Workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+void ThreadPool::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_WakeCondition.notify_all();
+
+	for (std::thread& worker : m_Workers)
+		worker.join();
+
+	m_Workers.clear();
+	m_Stopping = false;
+}
+
+void ThreadPool::WorkerLoop(uint32_t workerIndex)
+{
+	RT_PROFILE_THREAD("Worker " + std::to_string(workerIndex));
+
+#if RT_COUNT_ALLOCATIONS
+	// Workers only run jobs, whatever they allocate is the job's
+	Memory::TrackThreadAllocations(true);
+#endif
+
+	uint64_t seenGeneration;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		seenGeneration = m_Generation;
+	}
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_WakeCondition.wait(lock, [&]() { return m_Stopping || m_Generation != seenGeneration; });
+
+			if (m_Stopping)
+				return;
+
+			seenGeneration = m_Generation;
+		}
+
+		while (RunNextJob(workerIndex))
+			;
+	}
+}
+
+bool ThreadPool::RunNextJob(uint32_t workerIndex)
+{
+	uint32_t threadCount = GetThreadCount();
+	uint32_t job = 0;
+	bool found = false;
+
+	// Own work first, from the start of the range
+	{
+		WorkQueue& queue = *m_Queues[workerIndex];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if (queue.Begin < queue.End)
+		{
+			job = queue.Begin++;
+			found = true;
+		}
+	}
+
+	// Then steal from the end of somebody else's
+	for (uint32_t offset = 1; !found && offset < threadCount; offset++)
+	{
+		WorkQueue& victim = *m_Queues[(workerIndex + offset) % threadCount];
+		std::lock_guard<std::mutex> lock(victim.Mutex);
+		if (victim.Begin < victim.End)
+		{
+			job = --victim.End;
+			found = true;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	(*m_Func)(job, workerIndex);
+
+	if (m_PendingJobs.fetch_sub(1) == 1)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_DoneCondition.notify_all();
+	}
+
+	return true;
+}
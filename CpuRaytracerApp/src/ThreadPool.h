@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads where every worker owns a range of jobs.
+// A worker takes from the start of its own range and, once it runs dry, steals from the end of the others,
+// so batches with very uneven job costs still keep every thread busy until the end
+class ThreadPool
+{
+public:
+	using JobFunc = std::function<void(uint32_t jobIndex, uint32_t workerIndex)>;
+
+	explicit ThreadPool(uint32_t threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Number of threads running jobs, including the thread calling ParallelFor (0 means one per hardware thread)
+	void SetThreadCount(uint32_t threadCount);
+	uint32_t GetThreadCount() const { return (uint32_t)m_Queues.size(); }
+
+	// Runs func for every job in [0, jobCount) and blocks until all of them finished.
+	// workerIndex is always < GetThreadCount(), so it can index per thread scratch data
+	void ParallelFor(uint32_t jobCount, const JobFunc& func);
+
+private:
+	// Jobs [Begin, End), a range instead of a deque so handing out jobs never allocates
+	struct WorkQueue
+	{
+		std::mutex Mutex;
+		uint32_t Begin = 0, End = 0;
+	};
+
+	void Start(uint32_t threadCount);
+	void Stop();
+
+	void WorkerLoop(uint32_t workerIndex);
+	bool RunNextJob(uint32_t workerIndex);
+
+private:
+	std::vector<std::thread> m_Workers;
+	std::vector<std::unique_ptr<WorkQueue>> m_Queues; // One per worker, the last one belongs to the calling thread
+
+	const JobFunc* m_Func = nullptr;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_WakeCondition;
+	std::condition_variable m_DoneCondition;
+	uint64_t m_Generation = 0;
+	bool m_Stopping = false;
+
+	std::atomic<uint32_t> m_PendingJobs{ 0 };
+};
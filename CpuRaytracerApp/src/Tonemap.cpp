@@ -0,0 +1,121 @@
+#include "Tonemap.h"
+
+#include "Simd.h"
+
+// The framebuffer is handled as a flat float array, every lane is one channel of one pixel.
+// All operators work per channel, so nothing has to be shuffled between AoS and SoA
+
+// Channel of every lane, loaded at an offset so the pattern also lines up for widths below 4
+alignas(64) static const float s_LaneChannels[16 + 3] = { 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2 };
+
+static Simd::Float Saturate(Simd::Float x)
+{
+	return Simd::Min(Simd::Max(x, 0.0f), 1.0f);
+}
+
+template<TonemapOperator Operator>
+static Simd::Float ApplyOperator(Simd::Float x)
+{
+	if constexpr (Operator == TonemapOperator::Reinhard)
+	{
+		x = Simd::Max(x, 0.0f);
+		return x / (x + 1.0f);
+	}
+	else if constexpr (Operator == TonemapOperator::ACES)
+	{
+		x = Simd::Max(x, 0.0f);
+		Simd::Float numerator = x * (x * 2.51f + 0.03f);
+		Simd::Float denominator = x * (x * 2.43f + 0.59f) + 0.14f;
+		return Saturate(numerator / denominator);
+	}
+	else
+	{
+		return Saturate(x);
+	}
+}
+
+static Simd::Float LinearToSRGB(Simd::Float x)
+{
+	// Fit of 1.055 * x^(1 / 2.4) - 0.055 from three square roots, within a quarter of an 8 bit step on 0 - 1
+	Simd::Float s1 = Simd::Sqrt(x);
+	Simd::Float s2 = Simd::Sqrt(s1);
+	Simd::Float s3 = Simd::Sqrt(s2);
+	Simd::Float curve = s1 * 0.662002687f + s2 * 0.684122060f - s3 * 0.323583601f - x * 0.0225411470f;
+
+	return Simd::Select(x <= 0.0031308f, x * 12.92f, curve);
+}
+
+template<TonemapOperator Operator, bool SRGB>
+static void TonemapLanes(const float* hdr, uint8_t* rgba, Simd::Float scale, Simd::Mask alpha)
+{
+	Simd::Float value = Simd::Load(hdr) * scale;
+
+	Simd::Float color = ApplyOperator<Operator>(value);
+	if constexpr (SRGB)
+		color = LinearToSRGB(color);
+
+	color = Simd::Select(alpha, Saturate(value), color);
+
+	Simd::StoreBytes(rgba, Simd::ToInt(Saturate(color) * 255.0f));
+}
+
+// Instantiated per operator and curve, so the inner loop has no branches
+template<TonemapOperator Operator, bool SRGB>
+static void TonemapSpan(const float* input, uint8_t* output, uint32_t floatCount, float average, float exposure)
+{
+	// Exposure only applies to color, alpha gets the plain average
+	Simd::Mask alpha = Simd::Load(s_LaneChannels) > 2.5f;
+	Simd::Float scale = Simd::Select(alpha, Simd::Float(average), Simd::Float(average * exposure));
+
+	uint32_t i = 0;
+	for (; i + Simd::Width <= floatCount; i += Simd::Width)
+	{
+		// Only changes between iterations when the pattern is longer than a register
+		if constexpr (Simd::Width < 4)
+		{
+			alpha = Simd::Load(s_LaneChannels + (i & 3)) > 2.5f;
+			scale = Simd::Select(alpha, Simd::Float(average), Simd::Float(average * exposure));
+		}
+
+		TonemapLanes<Operator, SRGB>(input + i, output + i, scale, alpha);
+	}
+
+	// The last pixels of rows that are not a multiple of the width go through a padded copy
+	if (i < floatCount)
+	{
+		alignas(64) float paddedInput[Simd::Width] = {};
+		alignas(64) uint8_t paddedOutput[Simd::Width];
+
+		uint32_t remaining = floatCount - i;
+		for (uint32_t lane = 0; lane < remaining; lane++)
+			paddedInput[lane] = input[i + lane];
+
+		TonemapLanes<Operator, SRGB>(paddedInput, paddedOutput, scale, alpha);
+
+		for (uint32_t lane = 0; lane < remaining; lane++)
+			output[i + lane] = paddedOutput[lane];
+	}
+}
+
+template<TonemapOperator Operator>
+static void TonemapSpan(const float* input, uint8_t* output, uint32_t floatCount, float average, const TonemapSettings& settings)
+{
+	if (settings.SRGB)
+		TonemapSpan<Operator, true>(input, output, floatCount, average, settings.Exposure);
+	else
+		TonemapSpan<Operator, false>(input, output, floatCount, average, settings.Exposure);
+}
+
+void Tonemap(const glm::vec4* hdr, uint32_t* rgba, uint32_t count, uint32_t sampleCount, const TonemapSettings& settings)
+{
+	const float* input = (const float*)hdr;
+	uint8_t* output = (uint8_t*)rgba;
+	float average = 1.0f / (float)glm::max(sampleCount, 1u);
+
+	switch (settings.Operator)
+	{
+		case TonemapOperator::Reinhard: TonemapSpan<TonemapOperator::Reinhard>(input, output, count * 4, average, settings); break;
+		case TonemapOperator::ACES: TonemapSpan<TonemapOperator::ACES>(input, output, count * 4, average, settings); break;
+		default: TonemapSpan<TonemapOperator::Clamp>(input, output, count * 4, average, settings); break;
+	}
+}
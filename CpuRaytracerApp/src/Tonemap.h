@@ -0,0 +1,28 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+enum class TonemapOperator
+{
+	Clamp = 0,
+	Reinhard,
+	ACES // Narkowicz's per channel fit of the ACES filmic curve
+};
+
+struct TonemapSettings
+{
+	TonemapOperator Operator = TonemapOperator::Clamp;
+	float Exposure = 1.0f;
+
+	// Encode with the sRGB transfer curve, otherwise linear values are written as they are
+	bool SRGB = false;
+
+	bool operator==(const TonemapSettings& other) const { return Operator == other.Operator && Exposure == other.Exposure && SRGB == other.SRGB; }
+	bool operator!=(const TonemapSettings& other) const { return !(*this == other); }
+};
+
+// Averages count HDR pixels (sums of sampleCount samples), maps them through the operator and writes packed RGBA8.
+// Works on Simd::Width floats at a time, alpha is only clamped
+void Tonemap(const glm::vec4* hdr, uint32_t* rgba, uint32_t count, uint32_t sampleCount, const TonemapSettings& settings);
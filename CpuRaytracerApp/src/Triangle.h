@@ -0,0 +1,141 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Ray.h"
+#include "Simd.h"
+
+// Watertight ray/triangle intersection (Woop, Benthin and Wald 2013). The ray is turned into +z by swapping axes and
+// shearing, then the edge functions are evaluated in 2D around the origin. Neighbouring triangles compute the exact
+// same value for their shared edge, so rays can not slip through a mesh between two of them.
+// Everything that only depends on the ray is worked out once in Prepare and reused for every triangle
+
+struct TriangleRay
+{
+	glm::vec3 Origin;
+
+	// Axis the ray mostly runs along becomes z
+	int Kx, Ky, Kz;
+	float Sx, Sy, Sz;
+
+	void Prepare(const Ray& ray)
+	{
+		Origin = ray.Origin;
+
+		glm::vec3 direction = glm::abs(ray.Direction);
+		Kz = direction.x > direction.y ? (direction.x > direction.z ? 0 : 2) : (direction.y > direction.z ? 1 : 2);
+		Kx = (Kz + 1) % 3;
+		Ky = (Kx + 1) % 3;
+
+		Sx = ray.Direction[Kx] / ray.Direction[Kz];
+		Sy = ray.Direction[Ky] / ray.Direction[Kz];
+		Sz = 1.0f / ray.Direction[Kz];
+	}
+};
+
+// Distance to the triangle, negative on a miss. Both sides count as a hit
+inline float IntersectTriangle(const TriangleRay& ray, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+{
+	glm::vec3 a = v0 - ray.Origin;
+	glm::vec3 b = v1 - ray.Origin;
+	glm::vec3 c = v2 - ray.Origin;
+
+	float ax = a[ray.Kx] - ray.Sx * a[ray.Kz], ay = a[ray.Ky] - ray.Sy * a[ray.Kz];
+	float bx = b[ray.Kx] - ray.Sx * b[ray.Kz], by = b[ray.Ky] - ray.Sy * b[ray.Kz];
+	float cx = c[ray.Kx] - ray.Sx * c[ray.Kz], cy = c[ray.Ky] - ray.Sy * c[ray.Kz];
+
+	float u = cx * by - cy * bx;
+	float v = ax * cy - ay * cx;
+	float w = bx * ay - by * ax;
+
+	// Exactly on an edge in float, redo it in double so the neighbour sharing that edge agrees on the sign
+	if (u == 0.0f || v == 0.0f || w == 0.0f)
+	{
+		u = (float)((double)cx * by - (double)cy * bx);
+		v = (float)((double)ax * cy - (double)ay * cx);
+		w = (float)((double)bx * ay - (double)by * ax);
+	}
+
+	if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+		return -1.0f;
+
+	float determinant = u + v + w;
+	if (determinant == 0.0f)
+		return -1.0f;
+
+	float t = (u * a[ray.Kz] + v * b[ray.Kz] + w * c[ray.Kz]) * ray.Sz / determinant;
+	return t > 0.0f ? t : -1.0f;
+}
+
+// Same for a packet, lanes pick their own z axis through masks instead of indices
+struct TrianglePacket
+{
+	Simd::Float OriginX, OriginY, OriginZ;
+
+	Simd::Mask ZIsX, ZIsY; // z otherwise
+	Simd::Float Sx, Sy, Sz;
+
+	void Prepare(const RayPacket& packet)
+	{
+		OriginX = packet.OriginX;
+		OriginY = packet.OriginY;
+		OriginZ = packet.OriginZ;
+
+		Simd::Float zero = 0.0f;
+		Simd::Float absX = Simd::Max(packet.DirectionX, zero - packet.DirectionX);
+		Simd::Float absY = Simd::Max(packet.DirectionY, zero - packet.DirectionY);
+		Simd::Float absZ = Simd::Max(packet.DirectionZ, zero - packet.DirectionZ);
+
+		ZIsX = (absX > absY) & (absX > absZ);
+		ZIsY = Simd::AndNot(ZIsX, absY > absZ);
+
+		Simd::Float x, y, z;
+		Permute(packet.DirectionX, packet.DirectionY, packet.DirectionZ, x, y, z);
+
+		Sx = x / z;
+		Sy = y / z;
+		Sz = Simd::Float(1.0f) / z;
+	}
+
+	// (x, y, z) to (Kx, Ky, Kz) of every lane, same rotation as TriangleRay
+	void Permute(const Simd::Float& x, const Simd::Float& y, const Simd::Float& z, Simd::Float& outX, Simd::Float& outY, Simd::Float& outZ) const
+	{
+		outX = Simd::Select(ZIsX, y, Simd::Select(ZIsY, z, x));
+		outY = Simd::Select(ZIsX, z, Simd::Select(ZIsY, x, y));
+		outZ = Simd::Select(ZIsX, x, Simd::Select(ZIsY, y, z));
+	}
+};
+
+// One triangle against every active lane, closer hits replace hitDistance and closestIndex.
+// Unlike the single ray version there is no double precision retry for edge values of exactly 0
+inline void IntersectTriangle(const TrianglePacket& packet, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, int32_t index,
+	Simd::Mask active, Simd::Float& hitDistance, Simd::Int& closestIndex)
+{
+	Simd::Float ax, ay, az, bx, by, bz, cx, cy, cz;
+	packet.Permute(Simd::Float(v0.x) - packet.OriginX, Simd::Float(v0.y) - packet.OriginY, Simd::Float(v0.z) - packet.OriginZ, ax, ay, az);
+	packet.Permute(Simd::Float(v1.x) - packet.OriginX, Simd::Float(v1.y) - packet.OriginY, Simd::Float(v1.z) - packet.OriginZ, bx, by, bz);
+	packet.Permute(Simd::Float(v2.x) - packet.OriginX, Simd::Float(v2.y) - packet.OriginY, Simd::Float(v2.z) - packet.OriginZ, cx, cy, cz);
+
+	ax = ax - packet.Sx * az; ay = ay - packet.Sy * az;
+	bx = bx - packet.Sx * bz; by = by - packet.Sy * bz;
+	cx = cx - packet.Sx * cz; cy = cy - packet.Sy * cz;
+
+	Simd::Float u = cx * by - cy * bx;
+	Simd::Float v = ax * cy - ay * cx;
+	Simd::Float w = bx * ay - by * ax;
+
+	Simd::Float zero = 0.0f;
+	Simd::Mask negative = (u < zero) | (v < zero) | (w < zero);
+	Simd::Mask positive = (u > zero) | (v > zero) | (w > zero);
+
+	Simd::Float determinant = u + v + w;
+	Simd::Mask hit = Simd::AndNot(negative & positive, active) & ((determinant < zero) | (determinant > zero));
+	if (!Simd::Any(hit))
+		return;
+
+	Simd::Float t = (u * az + v * bz + w * cz) * packet.Sz / determinant;
+
+	Simd::Mask closer = hit & (t > zero) & (t < hitDistance);
+	hitDistance = Simd::Select(closer, t, hitDistance);
+	closestIndex = Simd::Select(closer, Simd::Int(index), closestIndex);
+}
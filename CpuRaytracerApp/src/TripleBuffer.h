@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free triple buffer for one writer thread and one reader thread.
+// The writer fills its back buffer and publishes it, the reader takes the most recently published one.
+// Neither side ever waits on the other, buffers the reader did not get to in time are simply skipped
+template<typename T>
+class TripleBuffer
+{
+public:
+	// Writer side, owned by the writer until the next Publish
+	T& GetWriteBuffer() { return m_Buffers[m_WriteIndex]; }
+
+	// Swaps the write buffer into the middle slot, the writer continues with whatever was there
+	void Publish()
+	{
+		uint8_t previous = m_Middle.exchange(m_WriteIndex | NewDataBit, std::memory_order_acq_rel);
+		m_WriteIndex = previous & IndexMask;
+	}
+
+	// Reader side, returns false (and keeps the current read buffer) if nothing was published since the last call
+	bool Acquire()
+	{
+		if (!(m_Middle.load(std::memory_order_acquire) & NewDataBit))
+			return false;
+
+		uint8_t previous = m_Middle.exchange(m_ReadIndex, std::memory_order_acq_rel);
+		m_ReadIndex = previous & IndexMask;
+		return true;
+	}
+
+	// Owned by the reader until the next successful Acquire, it may modify it too
+	T& GetReadBuffer() { return m_Buffers[m_ReadIndex]; }
+	const T& GetReadBuffer() const { return m_Buffers[m_ReadIndex]; }
+
+private:
+	static constexpr uint8_t IndexMask = 3;
+	static constexpr uint8_t NewDataBit = 4;
+
+	T m_Buffers[3];
+
+	// Each index is only touched by its own side, kept on separate cache lines
+	alignas(64) uint8_t m_WriteIndex = 0;
+	alignas(64) uint8_t m_ReadIndex = 1;
+	alignas(64) std::atomic<uint8_t> m_Middle{ 2 };
+};
@@ -1,17 +1,37 @@
 #include "Walnut/Application.h"
 #include "Walnut/EntryPoint.h"
 #include "Walnut/Image.h"
-#include "Walnut/Random.h"
-#include "Walnut/Timer.h"
-#include "Renderer.h"
+#include "RenderThread.h"
+#include "SceneSerializer.h"
+#include "WalnutImageTarget.h"
 #include "glm/gtc/type_ptr.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
 //
 class ExampleLayer : public Walnut::Layer
 {
 public:
 
-	ExampleLayer()
-		: m_Camera(45.f, 0.1f, 100.0f), m_Scene()
+	ExampleLayer(const std::string& scenePath)
+	{
+		Scene& scene = m_Scene;
+
+		SceneSerializer serializer(scene);
+		if (scenePath.empty() || !serializer.Deserialize(scenePath))
+			CreateDefaultScene(scene);
+		ReplaceScene();
+
+		m_State.Bounces = 2;
+		m_State.BVHCacheDirectory = "cache/bvh";
+
+		// Stop once the image is converged enough instead of keeping every core busy on a still view
+		m_State.Settings.MaxSamples = 1024;
+		m_State.Settings.AdaptiveThreshold = 0.01f;
+	}
+
+	static void CreateDefaultScene(Scene& scene)
 	{
 		{
 			Sphere sphere;
@@ -19,7 +39,7 @@ public:
 			sphere.Radius = 1.0f;
 			sphere.Albedo = { 1.0f, 0.0f, 1.0f };
 
-			m_Scene.Spheres.push_back(sphere);
+			scene.Spheres.push_back(sphere);
 		}
 
 		{
@@ -28,35 +48,209 @@ public:
 			sphere.Radius = 100.0f;
 			sphere.Albedo = { 0.2f, 0.3f, 1.0f };
 
-			m_Scene.Spheres.push_back(sphere);
+			scene.Spheres.push_back(sphere);
 		}
+	}
 
-
+	virtual void OnAttach() override
+	{
+		RT_PROFILE_THREAD("UI");
 	}
 
 	virtual void OnUpdate(float ts) override
 	{
-		m_Camera.OnUpdate(ts);
+		m_StateChanged |= m_State.CameraData.OnUpdate(ts);
 	}
 
 	virtual void OnUIRender() override
 	{
+		// Picks up whatever the render thread finished since the last UI frame, the UI never waits on it
+		if (m_RenderThread.AcquireFrame())
+		{
+			const RenderedFrame& frame = m_RenderThread.GetFrame();
+
+			FrameView view;
+			view.Width = frame.Width;
+			view.Height = frame.Height;
+			view.Pixels = frame.Pixels.data();
+			view.SampleCount = frame.SampleCount;
+			m_ImageTarget->Present(view);
+		}
+
+		const RenderedFrame& frame = m_RenderThread.GetFrame();
+		Renderer::Settings& settings = m_State.Settings;
+
 		// Renders lateral menu with settings and info
 		ImGui::Begin("Settings");
 
-		if (ImGui::Button("Render"))
+		ImGui::Text("%.3fms at %ux%u", frame.RenderTime, frame.RenderWidth, frame.RenderHeight);
+
+		int bounces = (int)m_State.Bounces;
+		if (ImGui::SliderInt("Bounces", &bounces, 0, 10))
+		{
+			m_State.Bounces = (uint32_t)bounces;
+			m_StateChanged = true;
+		}
+
+		m_StateChanged |= ImGui::Checkbox("Accumulate", &settings.Accumulate);
+		m_StateChanged |= ImGui::DragInt("Max Samples", (int*)&settings.MaxSamples, 1.0f, 0, 1 << 20);
+		m_StateChanged |= ImGui::DragFloat("Adaptive Threshold", &settings.AdaptiveThreshold, 0.001f, 0.0f, 1.0f);
+		m_StateChanged |= ImGui::DragInt("Adaptive Min Samples", (int*)&settings.AdaptiveMinSamples, 1.0f, 2, 1024);
+		m_StateChanged |= ImGui::Checkbox("Ray Packets", &settings.RayPackets);
+		ImGui::SameLine();
+		ImGui::Text("(%u wide)", Simd::Width);
+
+		int integrator = (int)settings.Integrator;
+		if (ImGui::Combo("Integrator", &integrator, "Megakernel\0Wavefront\0"))
+		{
+			settings.Integrator = (Renderer::IntegratorMode)integrator;
+			m_StateChanged = true;
+		}
+		if (settings.Integrator == Renderer::IntegratorMode::Wavefront)
+			m_StateChanged |= ImGui::Checkbox("Sort Secondary Rays", &settings.SortSecondaryRays);
+
+		// The camera only keeps its per pixel direction cache around for the mode that reads it
+		int primaryRays = (int)settings.PrimaryRays;
+		if (ImGui::Combo("Primary Rays", &primaryRays, "Analytic\0Camera (bit exact)\0"))
+		{
+			settings.PrimaryRays = (Renderer::PrimaryRayMode)primaryRays;
+			m_StateChanged = true;
+		}
+		m_State.CameraData.SetRayDirectionCaching(settings.PrimaryRays == Renderer::PrimaryRayMode::Camera);
+
+		int sampling = (int)settings.Sampling;
+		if (ImGui::Combo("Sampler", &sampling, "PCG\0Sobol (Owen)\0Blue Noise\0"))
+		{
+			settings.Sampling = (SamplerType)sampling;
+			m_State.ResetCount++;
+			m_StateChanged = true;
+		}
+
+		TonemapSettings& tonemap = settings.Tonemap;
+		int tonemapOperator = (int)tonemap.Operator;
+		if (ImGui::Combo("Tonemap", &tonemapOperator, "Clamp\0Reinhard\0ACES\0"))
+		{
+			tonemap.Operator = (TonemapOperator)tonemapOperator;
+			m_StateChanged = true;
+		}
+		m_StateChanged |= ImGui::DragFloat("Exposure", &tonemap.Exposure, 0.01f, 0.0f, 16.0f);
+		m_StateChanged |= ImGui::Checkbox("sRGB", &tonemap.SRGB);
+
+		int view = (int)settings.View;
+		if (ImGui::Combo("Debug View", &view, "None\0Sample Count\0Intersection Tests\0Nodes Visited\0Bounce Depth\0Time\0"))
+		{
+			settings.View = (Renderer::DebugView)view;
+			m_StateChanged = true;
+		}
+
+		if (ImGui::Button("Reset"))
 		{
-			Render();
+			m_State.ResetCount++;
+			m_StateChanged = true;
 		}
-		ImGui::Text("%.3fms", m_LastRenderTime);
 
-		ImGui::SliderInt("Bounces", &m_GuiBounces, 0, 10);
-		m_Renderer.SetBounces(m_GuiBounces);
+		ImGui::Text("Frame: %u, skipped: %llu", frame.SampleCount, (unsigned long long)m_RenderThread.GetSkippedFrameCount());
+
+		// Renderer starts with one thread per hardware thread
+		int threads = m_State.ThreadCount > 0 ? (int)m_State.ThreadCount : (int)glm::max(frame.ThreadCount, 1u);
+		if (ImGui::SliderInt("Threads", &threads, 1, (int)glm::max(std::thread::hardware_concurrency(), 1u)))
+		{
+			m_State.ThreadCount = (uint32_t)threads;
+			m_StateChanged = true;
+		}
+
+		int tileSize = (int)m_State.TileSize;
+		if (ImGui::SliderInt("Tile Size", &tileSize, 8, 128))
+		{
+			m_State.TileSize = (uint32_t)tileSize;
+			m_StateChanged = true;
+		}
+
+		DynamicResolutionSettings& resolution = m_State.Resolution;
+		m_StateChanged |= ImGui::Checkbox("Dynamic Resolution", &resolution.Enabled);
+		m_StateChanged |= ImGui::DragFloat("Frame Budget (ms)", &resolution.TargetFrameTime, 0.5f, 1.0f, 1000.0f);
+		m_StateChanged |= ImGui::DragFloat("Min Scale", &resolution.MinScale, 0.01f, DynamicResolution::ScaleStep, 1.0f);
+
+		m_StateChanged |= ImGui::DragInt("BVH Threshold", (int*)&settings.BVHThreshold, 1.0f, 0, 100000);
+
+		if (frame.BVHActive)
+		{
+			ImGui::Text("BVH: %u nodes, %.3fms build, SAH cost %.1f", frame.BVHNodeCount, frame.BVHBuildTime, frame.BVHCost);
+			ImGui::Text("Refits since build: %u (cost x%.2f), builds: %u", frame.BVHRefitCount, frame.BVHCostRatio, frame.BVHBuildCount);
+
+			const BVHCacheStats& cache = frame.BVHCache;
+			if (cache.Hits + cache.Misses > 0)
+				ImGui::Text("BVH cache: %u hits, %u misses, last %s in %.3fms (hash %.3fms)", cache.Hits, cache.Misses, cache.LastHit ? "loaded" : "missed", cache.LoadTime, cache.HashTime);
+		}
+
+		if (frame.InstanceCount > 0)
+		{
+			ImGui::Text("Instances: %u of %u blocks, top level %u nodes", frame.InstanceCount, frame.InstanceGeometryCount, frame.InstanceNodeCount);
+			ImGui::Text("Top level refits since build: %u", frame.InstanceRefitCount);
+		}
+
+		const TraversalStats& stats = frame.Stats;
+		float rays = (float)glm::max(stats.Rays, (uint64_t)1);
+		ImGui::Text("Per ray: %.1f nodes, %.1f leaves, %.1f primitives", stats.NodesVisited / rays, stats.LeavesTested / rays, stats.PrimitivesTested / rays);
+
+		if (stats.SecondaryPackets > 0)
+			ImGui::Text("Secondary direction coherence: %.3f", stats.DirectionCoherence / (double)stats.SecondaryPackets);
+
+		float pixels = (float)glm::max(frame.Width * frame.Height, 1u);
+		ImGui::Text("Pixels sampled: %.1f%%", stats.Samples / pixels * 100.0f);
 
 		ImGui::End();
 
+		RenderProfilerPanel(frame);
+
 		ImGui::Begin("Scene");
 
+		// Edits only touch the UI copy, the render thread gets the spheres and instances that changed along with the state
+		bool sceneChanged = false;
+
+		// Binary scenes are traced straight from their mapping, editing them needs a copy first
+		if (m_Scene.Mapped)
+		{
+			ImGui::Text("%u spheres mapped from file (read only)", m_Scene.GetSphereCount());
+			if (ImGui::Button("Make Editable"))
+			{
+				m_Scene.MakeEditable();
+				ReplaceScene();
+				m_StateChanged = true;
+			}
+		}
+
+		if (!m_Scene.Meshes.empty())
+		{
+			uint32_t triangleCount = 0;
+			for (const auto& mesh : m_Scene.Meshes)
+				triangleCount += mesh->GetTriangleCount();
+
+			ImGui::Text("%u meshes, %u triangles", (uint32_t)m_Scene.Meshes.size(), triangleCount);
+		}
+
+		// Folded by default, scenes can have thousands of them. Moving one only refits the top level
+		std::vector<Instance>& instances = m_Scene.Instances;
+		if (!instances.empty() && ImGui::TreeNode("Instances", "%u instances", (uint32_t)instances.size()))
+		{
+			for (size_t i = 0; i < instances.size(); i++)
+			{
+				ImGui::PushID((int)i);
+
+				const GeometryBlock* block = instances[i].Geometry.get();
+				ImGui::Text("Instance %zu: %s", i, block ? block->Name.c_str() : "(empty)");
+				if (ImGui::DragFloat3("Position", glm::value_ptr(instances[i].Transform[3]), 0.1f))
+				{
+					RecordEdit(m_EditedInstances, (uint32_t)i);
+					sceneChanged = true;
+				}
+
+				ImGui::PopID();
+			}
+
+			ImGui::TreePop();
+		}
+
 		for (size_t i = 0; i < m_Scene.Spheres.size(); i++)
 		{
 			ImGui::PushID(i);
@@ -65,25 +259,43 @@ public:
 
 			Sphere& sphere = m_Scene.Spheres[i];
 
-			ImGui::DragFloat3("Position", glm::value_ptr(sphere.Position), 0.1);
-			ImGui::DragFloat("Radius", &sphere.Radius, 0.1);
-			ImGui::ColorEdit3("Albedo", glm::value_ptr(sphere.Albedo), 0.1f);
+			bool edited = ImGui::DragFloat3("Position", glm::value_ptr(sphere.Position), 0.1);
+			edited |= ImGui::DragFloat("Radius", &sphere.Radius, 0.1);
+			edited |= ImGui::ColorEdit3("Albedo", glm::value_ptr(sphere.Albedo), 0.1f);
+
+			if (edited)
+			{
+				RecordEdit(m_EditedSpheres, (uint32_t)i);
+				sceneChanged = true;
+			}
 
 			ImGui::PopID();
 
 			ImGui::Separator();
 		}
 
+		if (sceneChanged)
+		{
+			m_Scene.Version++;
+			m_StateChanged = true;
+		}
+
 		ImGui::End();
 
 		// Renders the viewport with imagem buffer results
 		ImGui::Begin("Viewport");
 
+		uint32_t viewportWidth = (uint32_t)ImGui::GetContentRegionAvail().x;
+		uint32_t viewportHeight = (uint32_t)ImGui::GetContentRegionAvail().y;
+		if (viewportWidth != m_State.ViewportWidth || viewportHeight != m_State.ViewportHeight)
+		{
+			m_State.ViewportWidth = viewportWidth;
+			m_State.ViewportHeight = viewportHeight;
+			m_State.CameraData.OnResize(viewportWidth, viewportHeight);
+			m_StateChanged = true;
+		}
 
-		m_ViewportWidth = ImGui::GetContentRegionAvail().x;
-		m_ViewportHeight = ImGui::GetContentRegionAvail().y;
-
-		auto image = m_Renderer.GetFinalImage();
+		auto image = m_ImageTarget->GetImage();
 		if (image)
 			ImGui::Image(
 				image->GetDescriptorSet(), 
@@ -93,35 +305,180 @@ public:
 
 		ImGui::End();
 
-		Render();
+		if (m_StateChanged)
+		{
+			UpdateSceneChanges();
+			m_RenderThread.Submit(m_State);
+			m_StateChanged = false;
+		}
 	}
 
-	void Render()
+private:
+	void RenderProfilerPanel(const RenderedFrame& frame)
 	{
-		Walnut::Timer timer;
+		ImGui::Begin("Profiler");
 
-		// Renderer checks for resize
-		m_Renderer.OnResize(m_ViewportWidth, m_ViewportHeight);
+		if (!frame.RaysPerSecond.empty())
+		{
+			char overlay[32];
+			snprintf(overlay, sizeof(overlay), "%.2f Mrays/s", frame.RaysPerSecond.back());
+			ImGui::PlotLines("##RaysPerSecond", frame.RaysPerSecond.data(), (int)frame.RaysPerSecond.size(), 0, overlay, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+		}
+
+		const TraversalStats& stats = frame.Stats;
+		ImGui::Text("Rays: %llu primary, %llu secondary, %llu missed", (unsigned long long)(stats.Rays - stats.SecondaryRays),
+			(unsigned long long)stats.SecondaryRays, (unsigned long long)stats.Misses);
+		ImGui::Text("Tests: %llu nodes, %llu primitives", (unsigned long long)stats.NodesVisited, (unsigned long long)stats.PrimitivesTested);
 
-		// Corrects camera
-		m_Camera.OnResize(m_ViewportWidth, m_ViewportHeight);
+#if RT_PROFILE
+		// CPU time, summed over the threads, so stages that run on every worker can add up to more than the frame
+		ImGui::Separator();
+		for (uint32_t i = 0; i < (uint32_t)ProfileStage::Count; i++)
+			ImGui::Text("%-16s %8.3fms", GetProfileStageName((ProfileStage)i), frame.StageTimes[(ProfileStage)i]);
+#endif
+
+		if (ImGui::TreeNode("Threads", "%u threads", (uint32_t)frame.WorkerStats.size()))
+		{
+			for (size_t i = 0; i < frame.WorkerStats.size(); i++)
+			{
+				const TraversalStats& worker = frame.WorkerStats[i];
+				ImGui::Text("%zu: %llu rays (%llu secondary), %llu missed, %llu primitives", i, (unsigned long long)worker.Rays,
+					(unsigned long long)worker.SecondaryRays, (unsigned long long)worker.Misses, (unsigned long long)worker.PrimitivesTested);
+
+				if (i < frame.WorkerCounters.size() && frame.WorkerCounters[i].Frame.IsAvailable(PerfEvent::Cycles))
+				{
+					const PerfCounterValues& counters = frame.WorkerCounters[i].Frame;
+					ImGui::SameLine();
+					ImGui::Text(", IPC %.2f, %llu cache misses", counters.GetIPC(), (unsigned long long)counters[PerfEvent::CacheMisses]);
+				}
+			}
+			ImGui::TreePop();
+		}
+
+		// Off by default, every tile and pass reads the counters with a few syscalls
+		ImGui::Separator();
+		m_StateChanged |= ImGui::Checkbox("Hardware Counters", &m_State.Settings.HardwareCounters);
+		if (m_State.Settings.HardwareCounters)
+			RenderCounters(frame);
+
+#if RT_PROFILE
+		// Every scope of every thread until stopped, open the file in chrome://tracing or ui.perfetto.dev
+		ImGui::Separator();
+		if (!Profiler::IsCapturing())
+		{
+			if (ImGui::Button("Capture Trace"))
+				Profiler::BeginCapture();
+		}
+		else if (ImGui::Button("Stop and Save trace.json"))
+		{
+			m_TraceStatus = Profiler::EndCapture("trace.json") ? "Saved trace.json" : "Could not write trace.json";
+		}
 
-		// Renderer calls it's render function
-		m_Renderer.Render(m_Scene, m_Camera);
+		if (!m_TraceStatus.empty())
+			ImGui::Text("%s", m_TraceStatus.c_str());
+#endif
 
-		m_LastRenderTime = timer.ElapsedMillis();
+		ImGui::End();
+	}
+
+	void RenderCounters(const RenderedFrame& frame)
+	{
+		const PerfCounterValues& counters = frame.Counters.Frame;
+		if (counters.IsEmpty())
+		{
+			ImGui::Text("Unavailable: %s", frame.CounterError ? frame.CounterError : "nothing rendered yet");
+			return;
+		}
+
+		if (counters.IsAvailable(PerfEvent::Cycles))
+			ImGui::Text("IPC %.2f, %.1f%% cache misses", counters.GetIPC(), counters.GetCacheMissRate() * 100.0);
+		else if (frame.CounterError)
+			ImGui::Text("No hardware counters: %s", frame.CounterError);
+
+		double rays = (double)glm::max(frame.Stats.Rays, (uint64_t)1);
+		for (uint32_t i = 0; i < (uint32_t)PerfEvent::Count; i++)
+		{
+			PerfEvent event = (PerfEvent)i;
+			if (counters.IsAvailable(event))
+				ImGui::Text("%-16s %14llu %10.2f/ray", GetPerfEventName(event), (unsigned long long)counters[event], counters[event] / rays);
+			else
+				ImGui::Text("%-16s %14s", GetPerfEventName(event), "n/a");
+		}
+
+		// Only what runs as a pass of its own, the megakernel shows up in the totals above
+		for (uint32_t i = 0; i < (uint32_t)ProfileStage::Count; i++)
+		{
+			const PerfCounterValues& stage = frame.Counters.Stages[i];
+			if (stage.IsEmpty())
+				continue;
+
+			ImGui::Text("%-16s %14llu cycles, IPC %.2f, %llu cache misses, %llu branch misses", GetProfileStageName((ProfileStage)i),
+				(unsigned long long)stage[PerfEvent::Cycles], stage.GetIPC(), (unsigned long long)stage[PerfEvent::CacheMisses],
+				(unsigned long long)stage[PerfEvent::BranchMisses]);
+		}
 	}
 
 private:
+	// The scene as a whole goes to the render thread once, it keeps its own copy and only gets edits after that
+	void ReplaceScene()
+	{
+		m_Scene.Version++;
+		m_State.SceneChanges.NewScene = std::make_shared<const Scene>(m_Scene);
+
+		// The new scene has them already
+		m_EditedSpheres.clear();
+		m_EditedInstances.clear();
+	}
+
+	// Tagged with the version the bump at the end of the scene panel gives the scene
+	void RecordEdit(std::vector<std::pair<uint64_t, uint32_t>>& edits, uint32_t index)
+	{
+		auto it = std::find_if(edits.begin(), edits.end(), [index](const auto& edit) { return edit.second == index; });
+		if (it != edits.end())
+			it->first = m_Scene.Version + 1;
+		else
+			edits.emplace_back(m_Scene.Version + 1, index);
+	}
+
+	// Fills m_State.SceneChanges with what the render thread has not applied yet. Edits are only remembered until then,
+	// so this stays as small as the edits of the last few frames
+	void UpdateSceneChanges()
+	{
+		uint64_t appliedVersion = m_RenderThread.GetAppliedSceneVersion();
+		auto isApplied = [appliedVersion](const auto& edit) { return edit.first <= appliedVersion; };
+		m_EditedSpheres.erase(std::remove_if(m_EditedSpheres.begin(), m_EditedSpheres.end(), isApplied), m_EditedSpheres.end());
+		m_EditedInstances.erase(std::remove_if(m_EditedInstances.begin(), m_EditedInstances.end(), isApplied), m_EditedInstances.end());
+
+		SceneEdits& changes = m_State.SceneChanges;
+		if (changes.NewScene && changes.NewScene->Version <= appliedVersion)
+			changes.NewScene.reset();
+
+		changes.Spheres.clear();
+		for (const auto& [version, index] : m_EditedSpheres)
+			changes.Spheres.emplace_back(index, m_Scene.Spheres[index]);
+
+		changes.InstanceTransforms.clear();
+		for (const auto& [version, index] : m_EditedInstances)
+			changes.InstanceTransforms.emplace_back(index, m_Scene.Instances[index].Transform);
+
+		changes.Version = m_Scene.Version;
+	}
+
+private:
+	// UI side copy of everything the renderer needs, handed over on changes. The scene is edited here, the render
+	// thread keeps its own copy up to date from m_State.SceneChanges
 	Scene m_Scene;
-	Camera m_Camera;
-	Renderer m_Renderer;
-	uint32_t* m_ImageData = nullptr;
-	uint32_t m_ViewportWidth = 0;
-	uint32_t m_ViewportHeight = 0;
-	float m_LastRenderTime = 0.0f;
-
-	int m_GuiBounces = 2;
+	RenderState m_State;
+
+	// (scene version, index) of every sphere and instance the render thread may not have applied yet
+	std::vector<std::pair<uint64_t, uint32_t>> m_EditedSpheres;
+	std::vector<std::pair<uint64_t, uint32_t>> m_EditedInstances;
+	bool m_StateChanged = true;
+
+	RenderThread m_RenderThread;
+	std::shared_ptr<WalnutImageTarget> m_ImageTarget = std::make_shared<WalnutImageTarget>();
+
+	std::string m_TraceStatus;
 };
 
 Walnut::Application* Walnut::CreateApplication(int argc, char** argv)
@@ -131,8 +488,11 @@ Walnut::Application* Walnut::CreateApplication(int argc, char** argv)
 	spec.Width = 1280;
 	spec.Height = 720;
 
+	// Optional scene file as the first argument, text or binary (.crts)
+	std::string scenePath = argc > 1 ? argv[1] : "";
+
 	Walnut::Application* app = new Walnut::Application(spec);
-	app->PushLayer<ExampleLayer>();
+	app->PushLayer(std::make_shared<ExampleLayer>(scenePath));
 	app->SetMenubarCallback([app]()
 		{
 			if (ImGui::BeginMenu("File"))
@@ -0,0 +1,16 @@
+#include "WalnutImageTarget.h"
+
+#include "Profiler.h"
+
+void WalnutImageTarget::Present(const FrameView& frame)
+{
+	RT_PROFILE_SCOPE(ProfileStage::Upload);
+
+	if (!m_Image)
+		m_Image = std::make_shared<Walnut::Image>(frame.Width, frame.Height, Walnut::ImageFormat::RGBA);
+	else if (m_Image->GetWidth() != frame.Width || m_Image->GetHeight() != frame.Height)
+		m_Image->Resize(frame.Width, frame.Height);
+
+	// Sends pixels data to VRAM
+	m_Image->SetData(frame.Pixels);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Walnut/Image.h"
+
+#include <memory>
+
+#include "RenderTarget.h"
+
+// Uploads every presented frame into a Walnut::Image, so the viewport can draw it
+class WalnutImageTarget : public RenderTarget
+{
+public:
+	virtual void Present(const FrameView& frame) override;
+
+	std::shared_ptr<Walnut::Image> GetImage() const { return m_Image; }
+private:
+	std::shared_ptr<Walnut::Image> m_Image;
+};
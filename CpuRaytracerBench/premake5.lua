@@ -0,0 +1,71 @@
+project "CpuRaytracerBench"
+   kind "ConsoleApp"
+   language "C++"
+   cppdialect "C++17"
+   staticruntime "off"
+
+   -- Kernels are benchmarked straight from the app sources, minus everything that needs a window, Vulkan or ImGui
+   files
+   {
+      "src/**.h",
+      "src/**.cpp",
+
+      "../CpuRaytracerApp/src/**.h",
+      "../CpuRaytracerApp/src/**.cpp",
+   }
+
+   removefiles
+   {
+      "../CpuRaytracerApp/src/WalnutApp.cpp",
+      "../CpuRaytracerApp/src/CameraInput.cpp",
+      "../CpuRaytracerApp/src/WalnutImageTarget.h",
+      "../CpuRaytracerApp/src/WalnutImageTarget.cpp",
+   }
+
+   -- Heap allocations per iteration come from the counting operator new in Memory.cpp
+   defines { "RT_COUNT_ALLOCATIONS=1" }
+
+   includedirs
+   {
+      "src",
+      "../CpuRaytracerApp/src",
+
+      "../Walnut/vendor/glm",
+   }
+
+   targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
+   objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
+
+   filter "options:simd=avx2"
+      vectorextensions "AVX2"
+
+   filter { "options:simd=avx512", "toolset:msc*" }
+      buildoptions { "/arch:AVX512" }
+
+   filter { "options:simd=avx512", "toolset:not msc*" }
+      buildoptions { "-mavx512f" }
+
+   -- GCC and Clang fuse multiplies and adds into FMAs once the target has them (AVX-512 does), and only where the
+   -- optimizer sees both, so the integrators would stop giving the same image. MSVC does not contract by default
+   filter "toolset:not msc*"
+      buildoptions { "-ffp-contract=off" }
+
+   filter "system:windows"
+      systemversion "latest"
+
+   filter "system:linux"
+      links { "pthread" }
+
+   filter "configurations:Debug"
+      runtime "Debug"
+      symbols "On"
+
+   filter "configurations:Release"
+      runtime "Release"
+      optimize "On"
+      symbols "On"
+
+   filter "configurations:Dist"
+      runtime "Release"
+      optimize "On"
+      symbols "Off"
@@ -0,0 +1,197 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+#if !RT_COUNT_ALLOCATIONS
+	#error "CpuRaytracerBench reports heap allocations, build it with RT_COUNT_ALLOCATIONS=1"
+#endif
+
+BenchmarkRunner::BenchmarkRunner(const Options& options)
+	: m_Options(options)
+{
+}
+
+static std::string GetBenchmarkName(const std::string& kernel, const BenchmarkParams& params)
+{
+	std::string name = kernel;
+	if (params.Spheres > 0)
+		name += "/spheres:" + std::to_string(params.Spheres);
+	if (params.Width > 0)
+		name += "/res:" + std::to_string(params.Width) + "x" + std::to_string(params.Height);
+	if (params.Bounces > 0)
+		name += "/bounces:" + std::to_string(params.Bounces);
+	return name;
+}
+
+static const char* GetPerfCounterKey(PerfEvent event)
+{
+	switch (event)
+	{
+	case PerfEvent::Cycles: return "cycles";
+	case PerfEvent::Instructions: return "instructions";
+	case PerfEvent::BranchMisses: return "branch_misses";
+	case PerfEvent::CacheReferences: return "cache_references";
+	case PerfEvent::CacheMisses: return "cache_misses";
+	case PerfEvent::TLBMisses: return "tlb_misses";
+	case PerfEvent::PageFaults: return "page_faults";
+	default: return "unknown";
+	}
+}
+
+bool BenchmarkRunner::IsEnabled(const std::string& name) const
+{
+	return m_Options.Filter.empty() || name.find(m_Options.Filter) != std::string::npos;
+}
+
+void BenchmarkRunner::Run(const std::string& kernel, const BenchmarkParams& params, uint64_t pixels, const BenchmarkFunc& func)
+{
+	using Clock = std::chrono::steady_clock;
+
+	BenchmarkResult result;
+	result.Name = GetBenchmarkName(kernel, params);
+	result.Kernel = kernel;
+	result.Params = params;
+	result.Pixels = pixels;
+
+	if (!IsEnabled(result.Name))
+		return;
+
+	// Warm up caches and lazily sized buffers, neither the time nor the allocations count
+	func();
+
+	uint64_t allocationCount = Memory::GetHeapAllocationCount();
+	uint64_t allocatedBytes = Memory::GetHeapAllocatedBytes();
+
+	double totalNs = 0.0;
+	double minNs = 0.0;
+	uint64_t rays = 0;
+
+	while (result.Iterations < m_Options.MinIterations || totalNs < m_Options.MinTime * 1e9)
+	{
+		// Read outside of the timed part, the syscalls are not the kernel's
+		m_CountersReported = false;
+		PerfCounterValues countersStart = m_Options.Counters ? PerfCounters::Read() : PerfCounterValues();
+
+		auto start = Clock::now();
+		rays += func();
+		double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+		if (m_Options.Counters)
+			result.Counters += m_CountersReported ? m_ReportedCounters : PerfCounters::Read() - countersStart;
+
+		minNs = result.Iterations == 0 ? ns : std::min(minNs, ns);
+		totalNs += ns;
+		result.Iterations++;
+	}
+
+	double iterations = (double)result.Iterations;
+	result.MeanNs = totalNs / iterations;
+	result.MinNs = minNs;
+	result.Rays = rays / result.Iterations;
+	result.Allocations = (double)(Memory::GetHeapAllocationCount() - allocationCount) / iterations;
+	result.AllocatedBytes = (double)(Memory::GetHeapAllocatedBytes() - allocatedBytes) / iterations;
+
+	if (!m_Options.Quiet)
+	{
+		if (result.Rays > 0)
+			fprintf(stderr, "%-48s %10.3f ms %9.2f ns/ray %9.3f Mrays/s %8.1f allocs\n", result.Name.c_str(),
+				result.MeanNs * 1e-6, result.GetNsPerRay(), result.GetRaysPerSecond() * 1e-6, result.Allocations);
+		else
+			fprintf(stderr, "%-48s %10.3f ms %9.2f ns/px  %22.1f allocs\n", result.Name.c_str(),
+				result.MeanNs * 1e-6, result.GetNsPerPixel(), result.Allocations);
+
+		if (result.Counters.IsAvailable(PerfEvent::Cycles))
+			fprintf(stderr, "%-48s %10.2f IPC %8.1f%% cache misses\n", "", result.Counters.GetIPC(), result.Counters.GetCacheMissRate() * 100.0);
+	}
+
+	m_Results.push_back(result);
+}
+
+void BenchmarkRunner::ReportCounters(const PerfCounterValues& counters)
+{
+	m_ReportedCounters = counters;
+	m_CountersReported = true;
+}
+
+bool BenchmarkRunner::WriteJson(const std::string& filepath, const std::string& label, uint32_t simdWidth, uint32_t threadCount) const
+{
+	FILE* file = filepath.empty() ? stdout : fopen(filepath.c_str(), "w");
+	if (!file)
+		return false;
+
+	// Names and labels are ours, only quotes and backslashes need escaping
+	auto escape = [](const std::string& text)
+	{
+		std::string escaped;
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+				escaped += '\\';
+			escaped += c;
+		}
+		return escaped;
+	};
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"label\": \"%s\",\n", escape(label).c_str());
+	fprintf(file, "  \"simd_width\": %u,\n", simdWidth);
+	fprintf(file, "  \"threads\": %u,\n", threadCount);
+	if (m_Options.Counters && PerfCounters::GetError())
+		fprintf(file, "  \"counters_error\": \"%s\",\n", escape(PerfCounters::GetError()).c_str());
+	fprintf(file, "  \"benchmarks\": [");
+
+	for (size_t i = 0; i < m_Results.size(); i++)
+	{
+		const BenchmarkResult& result = m_Results[i];
+
+		fprintf(file, "%s\n    {\n", i > 0 ? "," : "");
+		fprintf(file, "      \"name\": \"%s\",\n", escape(result.Name).c_str());
+		fprintf(file, "      \"kernel\": \"%s\",\n", escape(result.Kernel).c_str());
+		fprintf(file, "      \"spheres\": %u,\n", result.Params.Spheres);
+		fprintf(file, "      \"width\": %u,\n", result.Params.Width);
+		fprintf(file, "      \"height\": %u,\n", result.Params.Height);
+		fprintf(file, "      \"bounces\": %u,\n", result.Params.Bounces);
+		fprintf(file, "      \"iterations\": %llu,\n", (unsigned long long)result.Iterations);
+		fprintf(file, "      \"mean_ns\": %.1f,\n", result.MeanNs);
+		fprintf(file, "      \"min_ns\": %.1f,\n", result.MinNs);
+		fprintf(file, "      \"rays\": %llu,\n", (unsigned long long)result.Rays);
+		fprintf(file, "      \"pixels\": %llu,\n", (unsigned long long)result.Pixels);
+		fprintf(file, "      \"ns_per_ray\": %.3f,\n", result.GetNsPerRay());
+		fprintf(file, "      \"rays_per_second\": %.1f,\n", result.GetRaysPerSecond());
+		fprintf(file, "      \"ns_per_pixel\": %.3f,\n", result.GetNsPerPixel());
+		fprintf(file, "      \"allocations\": %.2f,\n", result.Allocations);
+		fprintf(file, "      \"allocated_bytes\": %.1f%s\n", result.AllocatedBytes, result.Counters.IsEmpty() ? "" : ",");
+
+		// Per iteration like everything else, only the events that could be opened
+		if (!result.Counters.IsEmpty())
+		{
+			fprintf(file, "      \"counters\": {");
+			const char* separator = "";
+			for (uint32_t event = 0; event < (uint32_t)PerfEvent::Count; event++)
+			{
+				if (!result.Counters.IsAvailable((PerfEvent)event))
+					continue;
+
+				fprintf(file, "%s\"%s\": %.1f", separator, GetPerfCounterKey((PerfEvent)event), (double)result.Counters.Counts[event] / (double)result.Iterations);
+				separator = ", ";
+			}
+			if (result.Counters.IsAvailable(PerfEvent::Cycles))
+				fprintf(file, ", \"ipc\": %.3f", result.Counters.GetIPC());
+			if (result.Counters.IsAvailable(PerfEvent::CacheReferences))
+				fprintf(file, ", \"cache_miss_rate\": %.4f", result.Counters.GetCacheMissRate());
+			fprintf(file, "}\n");
+		}
+		fprintf(file, "    }");
+	}
+
+	fprintf(file, "\n  ]\n}\n");
+
+	bool success = !ferror(file);
+	if (file != stdout)
+		fclose(file);
+
+	return success;
+}
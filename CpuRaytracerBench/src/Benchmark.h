@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Memory.h"
+#include "PerfCounters.h"
+
+// Minimal timing harness for the kernels, no dependency besides the standard library.
+// Allocations are counted by the global operator new of Memory.cpp, the project builds with RT_COUNT_ALLOCATIONS
+
+struct BenchmarkParams
+{
+	uint32_t Spheres = 0;
+	uint32_t Width = 0, Height = 0;
+	uint32_t Bounces = 0;
+};
+
+struct BenchmarkResult
+{
+	std::string Name;
+	std::string Kernel;
+	BenchmarkParams Params;
+
+	uint64_t Iterations = 0;
+	double MeanNs = 0.0; // Per iteration
+	double MinNs = 0.0;
+
+	// Per iteration, rays is 0 for kernels that do not trace
+	uint64_t Rays = 0;
+	uint64_t Pixels = 0;
+
+	double Allocations = 0.0; // Per iteration
+	double AllocatedBytes = 0.0;
+
+	// Summed over every iteration, empty unless Options::Counters is on and counters could be opened
+	PerfCounterValues Counters;
+
+	double GetNsPerRay() const { return Rays > 0 ? MeanNs / (double)Rays : 0.0; }
+	double GetRaysPerSecond() const { return Rays > 0 ? (double)Rays * 1e9 / MeanNs : 0.0; }
+	double GetNsPerPixel() const { return Pixels > 0 ? MeanNs / (double)Pixels : 0.0; }
+};
+
+class BenchmarkRunner
+{
+public:
+	// Runs one iteration and returns the rays it traced
+	using BenchmarkFunc = std::function<uint64_t()>;
+
+	struct Options
+	{
+		double MinTime = 0.25; // Seconds per benchmark, at least MinIterations are run anyway
+		uint32_t MinIterations = 3;
+		std::string Filter; // Only names containing it run
+		bool Quiet = false;
+
+		// Hardware counters around every iteration, of the calling thread unless the benchmark reports its own
+		bool Counters = false;
+	};
+
+	BenchmarkRunner(const Options& options);
+
+	bool IsEnabled(const std::string& name) const;
+
+	void Run(const std::string& kernel, const BenchmarkParams& params, uint64_t pixels, const BenchmarkFunc& func);
+
+	// Counters of the iteration that is running, for benchmarks whose work runs on other threads. Replaces what the
+	// calling thread counted, so it has to cover the calling thread too (Renderer::GetPerfCounters() does)
+	void ReportCounters(const PerfCounterValues& counters);
+
+	const std::vector<BenchmarkResult>& GetResults() const { return m_Results; }
+
+	// label goes into the file as is, e.g. a commit hash to compare runs with
+	bool WriteJson(const std::string& filepath, const std::string& label, uint32_t simdWidth, uint32_t threadCount) const;
+private:
+	Options m_Options;
+	std::vector<BenchmarkResult> m_Results;
+
+	PerfCounterValues m_ReportedCounters;
+	bool m_CountersReported = false;
+};
+
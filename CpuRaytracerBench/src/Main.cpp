@@ -0,0 +1,369 @@
+#include "Benchmark.h"
+#include "Renderer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Microbenchmarks for the tracing kernels, results go out as JSON so runs of different commits can be diffed.
+// Kernels run single threaded on the main thread, only the Render benchmark uses the thread pool
+
+// Kernels are private to Renderer and Camera, both declare this struct a friend
+struct BenchmarkAccess
+{
+	static HitPayload TraceRay(Renderer& renderer, const Ray& ray, TraversalStats& stats) { return renderer.TraceRay(ray, stats); }
+	static glm::vec4 RayGen(Renderer& renderer, uint32_t x, uint32_t y, TraversalStats& stats) { return renderer.RayGen(x, y, stats); }
+	static HitPayload ClosestHit(Renderer& renderer, const Ray& ray, float hitDistance, int objectIndex, uint32_t primitiveIndex)
+	{
+		return renderer.ClosestHit(ray, hitDistance, objectIndex, primitiveIndex);
+	}
+
+	static void RecalculateRayDirections(Camera& camera) { camera.RecalculateRayDirections(); }
+};
+
+// Keeps the compiler from throwing away kernel results
+static volatile float s_Sink = 0.0f;
+
+struct Resolution
+{
+	uint32_t Width, Height;
+};
+
+static Scene CreateScene(uint32_t sphereCount)
+{
+	Scene scene;
+
+	// The app's default scene, then layers of 40 x 20 small spheres further away
+	{
+		Sphere sphere;
+		sphere.Position = { 0.0f, 0.0f, -4.0f };
+		sphere.Radius = 1.0f;
+		sphere.Albedo = { 1.0f, 0.0f, 1.0f };
+		scene.Spheres.push_back(sphere);
+	}
+
+	{
+		Sphere sphere;
+		sphere.Position = { 0.0f, -101.0f, -5.0f };
+		sphere.Radius = 100.0f;
+		sphere.Albedo = { 0.2f, 0.3f, 1.0f };
+		scene.Spheres.push_back(sphere);
+	}
+
+	for (uint32_t i = 0; scene.Spheres.size() < sphereCount; i++)
+	{
+		Sphere sphere;
+		sphere.Position = { (float)(i % 40) - 20.0f, (float)((i / 40) % 20) * 0.8f, -8.0f - (float)(i / 800) };
+		sphere.Radius = 0.3f;
+		sphere.Albedo = { (float)(i % 7) / 6.0f, (float)(i % 5) / 4.0f, (float)(i % 3) / 2.0f };
+		scene.Spheres.push_back(sphere);
+	}
+
+	scene.Spheres.resize(std::min<size_t>(scene.Spheres.size(), sphereCount));
+	return scene;
+}
+
+static std::vector<std::string> Split(const std::string& text, char separator)
+{
+	std::vector<std::string> parts;
+	size_t start = 0;
+	while (start <= text.size())
+	{
+		size_t end = text.find(separator, start);
+		if (end == std::string::npos)
+			end = text.size();
+
+		if (end > start)
+			parts.push_back(text.substr(start, end - start));
+		start = end + 1;
+	}
+	return parts;
+}
+
+static bool ParseList(const std::string& text, std::vector<uint32_t>& values)
+{
+	values.clear();
+	for (const std::string& part : Split(text, ','))
+	{
+		char* end = nullptr;
+		values.push_back((uint32_t)strtoul(part.c_str(), &end, 10));
+		if (*end != '\0')
+			return false;
+	}
+	return !values.empty();
+}
+
+static bool ParseResolutions(const std::string& text, std::vector<Resolution>& resolutions)
+{
+	resolutions.clear();
+	for (const std::string& part : Split(text, ','))
+	{
+		Resolution resolution;
+		if (sscanf(part.c_str(), "%ux%u", &resolution.Width, &resolution.Height) != 2 || resolution.Width == 0 || resolution.Height == 0)
+			return false;
+
+		resolutions.push_back(resolution);
+	}
+	return !resolutions.empty();
+}
+
+static void PrintUsage(const char* program)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  --output <file>        JSON results, stdout if not given\n"
+		"  --label <text>         Stored in the JSON, e.g. the commit hash\n"
+		"  --filter <text>        Only runs benchmarks whose name contains text\n"
+		"  --min-time <seconds>   Per benchmark (default 0.25)\n"
+		"  --spheres <n,...>      Scene sizes (default 2,64,1024,8192)\n"
+		"  --res <WxH,...>        Resolutions (default 320x180,1280x720)\n"
+		"  --bounces <n,...>      Bounce counts (default 1,3,5)\n"
+		"  --threads <n>          Workers for the Render benchmark, 0 uses every hardware thread (default)\n"
+		"  --counters             Hardware performance counters per benchmark (Linux perf_event_open)\n"
+		"  --quiet                No table on stderr\n",
+		program);
+}
+
+int main(int argc, char** argv)
+{
+	BenchmarkRunner::Options runnerOptions;
+	std::string outputPath, label;
+	std::vector<uint32_t> sphereCounts = { 2, 64, 1024, 8192 };
+	std::vector<Resolution> resolutions = { { 320, 180 }, { 1280, 720 } };
+	std::vector<uint32_t> bounceCounts = { 1, 3, 5 };
+	uint32_t threads = 0;
+	uint32_t threadCount = 0; // What the pool resolved --threads to
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (strcmp(arg, "--help") == 0)
+		{
+			PrintUsage(argv[0]);
+			return 0;
+		}
+
+		if (strcmp(arg, "--quiet") == 0)
+		{
+			runnerOptions.Quiet = true;
+			continue;
+		}
+
+		if (strcmp(arg, "--counters") == 0)
+		{
+			runnerOptions.Counters = true;
+			continue;
+		}
+
+		if (i + 1 >= argc || strncmp(arg, "--", 2) != 0)
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+		const char* value = argv[++i];
+
+		bool valid = true;
+		if (strcmp(arg, "--output") == 0) outputPath = value;
+		else if (strcmp(arg, "--label") == 0) label = value;
+		else if (strcmp(arg, "--filter") == 0) runnerOptions.Filter = value;
+		else if (strcmp(arg, "--min-time") == 0) valid = sscanf(value, "%lf", &runnerOptions.MinTime) == 1;
+		else if (strcmp(arg, "--spheres") == 0) valid = ParseList(value, sphereCounts);
+		else if (strcmp(arg, "--res") == 0) valid = ParseResolutions(value, resolutions);
+		else if (strcmp(arg, "--bounces") == 0) valid = ParseList(value, bounceCounts);
+		else if (strcmp(arg, "--threads") == 0) valid = sscanf(value, "%u", &threads) == 1;
+		else valid = false;
+
+		if (!valid)
+		{
+			fprintf(stderr, "Invalid option %s %s\n", arg, value);
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	BenchmarkRunner runner(runnerOptions);
+
+	// Pixel kernels only depend on the resolution
+	for (const Resolution& resolution : resolutions)
+	{
+		BenchmarkParams params;
+		params.Width = resolution.Width;
+		params.Height = resolution.Height;
+		uint64_t pixels = (uint64_t)resolution.Width * resolution.Height;
+
+		Camera camera(45.0f, 0.1f, 100.0f);
+		camera.OnResize(resolution.Width, resolution.Height);
+
+		runner.Run("Camera::RecalculateRayDirections", params, pixels, [&]()
+			{
+				BenchmarkAccess::RecalculateRayDirections(camera);
+				s_Sink = s_Sink + camera.GetRayDirections()[0].x;
+				return 0;
+			});
+
+		std::vector<glm::vec4> colors(pixels);
+		uint32_t seed = 1;
+		for (glm::vec4& color : colors)
+			color = glm::vec4(RandomFloat(seed), RandomFloat(seed), RandomFloat(seed), 1.0f);
+
+		std::vector<uint32_t> pixelData(pixels);
+
+		runner.Run("Utils::ConvertToRGBA", params, pixels, [&]()
+			{
+				for (size_t i = 0; i < colors.size(); i++)
+					pixelData[i] = Utils::ConvertToRGBA(colors[i]);
+
+				s_Sink = s_Sink + (float)pixelData[pixels / 2];
+				return 0;
+			});
+
+		// The output pass that replaced per pixel ConvertToRGBA, over HDR sums of 4 samples
+		const char* tonemapNames[] = { "Tonemap/Clamp", "Tonemap/Reinhard", "Tonemap/ACES" };
+		for (int op = 0; op < 3; op++)
+		{
+			for (bool srgb : { false, true })
+			{
+				TonemapSettings settings;
+				settings.Operator = (TonemapOperator)op;
+				settings.SRGB = srgb;
+
+				runner.Run(std::string(tonemapNames[op]) + (srgb ? "+sRGB" : ""), params, pixels, [&]()
+					{
+						Tonemap(colors.data(), pixelData.data(), (uint32_t)pixels, 4, settings);
+
+						s_Sink = s_Sink + (float)pixelData[pixels / 2];
+						return 0;
+					});
+			}
+		}
+	}
+
+	for (uint32_t sphereCount : sphereCounts)
+	{
+		Scene scene = CreateScene(sphereCount);
+
+		for (const Resolution& resolution : resolutions)
+		{
+			BenchmarkParams params;
+			params.Spheres = (uint32_t)scene.Spheres.size();
+			params.Width = resolution.Width;
+			params.Height = resolution.Height;
+			uint64_t pixels = (uint64_t)resolution.Width * resolution.Height;
+
+			Camera camera(45.0f, 0.1f, 100.0f);
+			camera.OnResize(resolution.Width, resolution.Height);
+
+			Renderer renderer;
+			renderer.SetThreadCount(threads);
+			renderer.GetSettings().HardwareCounters = runnerOptions.Counters;
+			renderer.OnResize(resolution.Width, resolution.Height);
+			threadCount = renderer.GetThreadCount();
+
+			// One frame sets up the scene data (SoA, BVH) the kernels read
+			renderer.Render(scene, camera);
+
+			std::vector<Ray> primaryRays(pixels);
+			for (size_t i = 0; i < primaryRays.size(); i++)
+				primaryRays[i] = { camera.GetPosition(), camera.GetRayDirections()[i] };
+
+			runner.Run("TraceRay", params, pixels, [&]()
+				{
+					TraversalStats stats;
+					float sum = 0.0f;
+					for (const Ray& ray : primaryRays)
+						sum += BenchmarkAccess::TraceRay(renderer, ray, stats).HitDistance;
+
+					s_Sink = s_Sink + sum;
+					return stats.Rays;
+				});
+
+			// Shading input, the primary hits of the view
+			std::vector<Ray> hitRays;
+			std::vector<HitPayload> hits;
+			{
+				TraversalStats stats;
+				for (const Ray& ray : primaryRays)
+				{
+					HitPayload payload = BenchmarkAccess::TraceRay(renderer, ray, stats);
+					if (payload.HitDistance < 0.0f)
+						continue;
+
+					hitRays.push_back(ray);
+					hits.push_back(payload);
+				}
+			}
+
+			if (!hits.empty())
+			{
+				runner.Run("ClosestHit", params, pixels, [&]()
+					{
+						float sum = 0.0f;
+						for (size_t i = 0; i < hits.size(); i++)
+							sum += BenchmarkAccess::ClosestHit(renderer, hitRays[i], hits[i].HitDistance, hits[i].ObjectIndex, hits[i].PrimitiveIndex).WorldNormal.x;
+
+						s_Sink = s_Sink + sum;
+						return (uint64_t)hits.size();
+					});
+			}
+
+			for (uint32_t bounces : bounceCounts)
+			{
+				params.Bounces = bounces;
+				renderer.SetBounces(bounces);
+
+				runner.Run("RayGen", params, pixels, [&]()
+					{
+						TraversalStats stats;
+						float sum = 0.0f;
+						for (uint32_t y = 0; y < resolution.Height; y++)
+						{
+							for (uint32_t x = 0; x < resolution.Width; x++)
+								sum += BenchmarkAccess::RayGen(renderer, x, y, stats).r;
+						}
+
+						s_Sink = s_Sink + sum;
+						return stats.Rays;
+					});
+
+				// Whole frames on the thread pool, including packets and accumulation
+				runner.Run("Render", params, pixels, [&]()
+					{
+						renderer.Render(scene, camera);
+						runner.ReportCounters(renderer.GetPerfCounters().Frame);
+						return renderer.GetTraversalStats().Rays;
+					});
+
+				// Same frames bounce by bounce, for a direct comparison with the megakernel above
+				renderer.GetSettings().Integrator = Renderer::IntegratorMode::Wavefront;
+				renderer.GetSettings().SortSecondaryRays = false;
+				runner.Run("Render/Wavefront", params, pixels, [&]()
+					{
+						renderer.Render(scene, camera);
+						runner.ReportCounters(renderer.GetPerfCounters().Frame);
+						return renderer.GetTraversalStats().Rays;
+					});
+
+				// Sorting pays for itself only if the reflected rays trace faster by more than the sort costs
+				renderer.GetSettings().SortSecondaryRays = true;
+				runner.Run("Render/Wavefront/Sorted", params, pixels, [&]()
+					{
+						renderer.Render(scene, camera);
+						runner.ReportCounters(renderer.GetPerfCounters().Frame);
+						return renderer.GetTraversalStats().Rays;
+					});
+				renderer.GetSettings().Integrator = Renderer::IntegratorMode::Megakernel;
+			}
+		}
+	}
+
+	if (!runner.WriteJson(outputPath, label, Simd::Width, threadCount))
+	{
+		fprintf(stderr, "Could not write %s\n", outputPath.c_str());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,269 @@
+#include "ImageFileTarget.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace Utils
+{
+	static ImageFileFormat FormatFromPath(const std::string& filepath)
+	{
+		size_t dot = filepath.find_last_of('.');
+		if (dot == std::string::npos)
+			return ImageFileFormat::None;
+
+		std::string extension = filepath.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+		if (extension == "ppm") return ImageFileFormat::PPM;
+		if (extension == "png") return ImageFileFormat::PNG;
+		if (extension == "exr") return ImageFileFormat::EXR;
+		return ImageFileFormat::None;
+	}
+
+	// Little endian, which is what EXR wants
+	template<typename T>
+	static void Append(std::vector<uint8_t>& buffer, T value)
+	{
+		uint8_t bytes[sizeof(T)];
+		memcpy(bytes, &value, sizeof(T));
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+	}
+
+	static void Append(std::vector<uint8_t>& buffer, const char* string)
+	{
+		buffer.insert(buffer.end(), string, string + strlen(string) + 1);
+	}
+
+	static void AppendBigEndian(std::vector<uint8_t>& buffer, uint32_t value)
+	{
+		buffer.push_back((uint8_t)(value >> 24));
+		buffer.push_back((uint8_t)(value >> 16));
+		buffer.push_back((uint8_t)(value >> 8));
+		buffer.push_back((uint8_t)value);
+	}
+
+	static uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+	{
+		static uint32_t table[256] = {};
+		static bool initialized = false;
+		if (!initialized)
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t c = i;
+				for (int k = 0; k < 8; k++)
+					c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+				table[i] = c;
+			}
+			initialized = true;
+		}
+
+		crc = ~crc;
+		for (size_t i = 0; i < size; i++)
+			crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	static bool WriteFile(const std::string& filepath, const std::vector<uint8_t>& data)
+	{
+		std::ofstream stream(filepath, std::ios::binary);
+		stream.write((const char*)data.data(), data.size());
+		return (bool)stream;
+	}
+}
+
+ImageFileTarget::ImageFileTarget(const std::string& filepath)
+	: m_Filepath(filepath), m_Format(Utils::FormatFromPath(filepath))
+{
+	m_Valid = m_Format != ImageFileFormat::None;
+}
+
+void ImageFileTarget::Present(const FrameView& frame)
+{
+	switch (m_Format)
+	{
+		case ImageFileFormat::PPM: m_Valid = WritePPM(frame); break;
+		case ImageFileFormat::PNG: m_Valid = WritePNG(frame); break;
+		case ImageFileFormat::EXR: m_Valid = WriteEXR(frame); break;
+		default: m_Valid = false; break;
+	}
+
+	if (!m_Valid)
+		std::cerr << "Could not write " << m_Filepath << std::endl;
+}
+
+bool ImageFileTarget::WritePPM(const FrameView& frame) const
+{
+	std::string header = "P6\n" + std::to_string(frame.Width) + " " + std::to_string(frame.Height) + "\n255\n";
+
+	std::vector<uint8_t> data(header.begin(), header.end());
+	data.reserve(data.size() + frame.Width * frame.Height * 3);
+
+	// Files start at the top row, the framebuffer at the bottom one
+	for (uint32_t y = frame.Height; y-- > 0;)
+	{
+		for (uint32_t x = 0; x < frame.Width; x++)
+		{
+			uint32_t pixel = frame.Pixels[x + y * frame.Width];
+			data.push_back((uint8_t)pixel);
+			data.push_back((uint8_t)(pixel >> 8));
+			data.push_back((uint8_t)(pixel >> 16));
+		}
+	}
+
+	return Utils::WriteFile(m_Filepath, data);
+}
+
+bool ImageFileTarget::WritePNG(const FrameView& frame) const
+{
+	// Raw scanlines, each starts with filter type 0 (none)
+	std::vector<uint8_t> scanlines;
+	scanlines.reserve((frame.Width * 4 + 1) * frame.Height);
+	for (uint32_t y = frame.Height; y-- > 0;)
+	{
+		scanlines.push_back(0);
+		const uint8_t* row = (const uint8_t*)(frame.Pixels + y * frame.Width);
+		scanlines.insert(scanlines.end(), row, row + frame.Width * 4);
+	}
+
+	// zlib stream made of stored deflate blocks. Bigger files, but no dependency and nothing to tune
+	std::vector<uint8_t> zlib = { 0x78, 0x01 };
+	constexpr size_t maxBlockSize = 65535;
+	size_t offset = 0;
+	do
+	{
+		size_t blockSize = std::min(maxBlockSize, scanlines.size() - offset);
+		bool last = offset + blockSize == scanlines.size();
+
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back((uint8_t)blockSize);
+		zlib.push_back((uint8_t)(blockSize >> 8));
+		zlib.push_back((uint8_t)~blockSize);
+		zlib.push_back((uint8_t)(~blockSize >> 8));
+		zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+
+		offset += blockSize;
+	} while (offset < scanlines.size());
+
+	uint32_t a = 1, b = 0; // Adler-32
+	for (uint8_t byte : scanlines)
+	{
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	Utils::AppendBigEndian(zlib, (b << 16) | a);
+
+	std::vector<uint8_t> data = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+	auto writeChunk = [&data](const char* type, const std::vector<uint8_t>& chunk)
+	{
+		Utils::AppendBigEndian(data, (uint32_t)chunk.size());
+
+		size_t start = data.size();
+		data.insert(data.end(), type, type + 4);
+		data.insert(data.end(), chunk.begin(), chunk.end());
+
+		Utils::AppendBigEndian(data, Utils::Crc32(data.data() + start, data.size() - start));
+	};
+
+	std::vector<uint8_t> header;
+	Utils::AppendBigEndian(header, frame.Width);
+	Utils::AppendBigEndian(header, frame.Height);
+	header.insert(header.end(), { 8, 6, 0, 0, 0 }); // 8 bit RGBA, deflate, no filtering, no interlacing
+
+	writeChunk("IHDR", header);
+	writeChunk("IDAT", zlib);
+	writeChunk("IEND", {});
+
+	return Utils::WriteFile(m_Filepath, data);
+}
+
+bool ImageFileTarget::WriteEXR(const FrameView& frame) const
+{
+	// Uncompressed scanline file with 32 bit float B, G, R channels (they have to be sorted by name)
+	std::vector<uint8_t> data;
+	Utils::Append<uint32_t>(data, 20000630); // Magic number
+	Utils::Append<uint32_t>(data, 2); // Version, single part scanline
+
+	Utils::Append(data, "channels");
+	Utils::Append(data, "chlist");
+	Utils::Append<int32_t>(data, 3 * (2 + 16) + 1);
+	for (const char* channel : { "B", "G", "R" })
+	{
+		Utils::Append(data, channel);
+		Utils::Append<int32_t>(data, 2); // FLOAT
+		Utils::Append<uint32_t>(data, 0); // pLinear and reserved
+		Utils::Append<int32_t>(data, 1); // x sampling
+		Utils::Append<int32_t>(data, 1); // y sampling
+	}
+	data.push_back(0);
+
+	Utils::Append(data, "compression");
+	Utils::Append(data, "compression");
+	Utils::Append<int32_t>(data, 1);
+	data.push_back(0); // NO_COMPRESSION
+
+	for (const char* window : { "dataWindow", "displayWindow" })
+	{
+		Utils::Append(data, window);
+		Utils::Append(data, "box2i");
+		Utils::Append<int32_t>(data, 16);
+		Utils::Append<int32_t>(data, 0);
+		Utils::Append<int32_t>(data, 0);
+		Utils::Append<int32_t>(data, (int32_t)frame.Width - 1);
+		Utils::Append<int32_t>(data, (int32_t)frame.Height - 1);
+	}
+
+	Utils::Append(data, "lineOrder");
+	Utils::Append(data, "lineOrder");
+	Utils::Append<int32_t>(data, 1);
+	data.push_back(0); // INCREASING_Y
+
+	Utils::Append(data, "pixelAspectRatio");
+	Utils::Append(data, "float");
+	Utils::Append<int32_t>(data, 4);
+	Utils::Append<float>(data, 1.0f);
+
+	Utils::Append(data, "screenWindowCenter");
+	Utils::Append(data, "v2f");
+	Utils::Append<int32_t>(data, 8);
+	Utils::Append<float>(data, 0.0f);
+	Utils::Append<float>(data, 0.0f);
+
+	Utils::Append(data, "screenWindowWidth");
+	Utils::Append(data, "float");
+	Utils::Append<int32_t>(data, 4);
+	Utils::Append<float>(data, 1.0f);
+
+	data.push_back(0); // End of header
+
+	// Offset table, one chunk per scanline
+	uint32_t lineSize = frame.Width * 3 * sizeof(float);
+	uint64_t chunkOffset = data.size() + frame.Height * sizeof(uint64_t);
+	for (uint32_t y = 0; y < frame.Height; y++)
+	{
+		Utils::Append<uint64_t>(data, chunkOffset);
+		chunkOffset += 2 * sizeof(int32_t) + lineSize;
+	}
+
+	float scale = frame.SampleCount > 0 ? 1.0f / (float)frame.SampleCount : 0.0f;
+
+	for (uint32_t line = 0; line < frame.Height; line++)
+	{
+		Utils::Append<int32_t>(data, (int32_t)line);
+		Utils::Append<uint32_t>(data, lineSize);
+
+		const glm::vec4* row = frame.Accumulation + (frame.Height - 1 - line) * frame.Width;
+		for (int channel = 2; channel >= 0; channel--)
+		{
+			for (uint32_t x = 0; x < frame.Width; x++)
+				Utils::Append<float>(data, row[x][channel] * scale);
+		}
+	}
+
+	return Utils::WriteFile(m_Filepath, data);
+}
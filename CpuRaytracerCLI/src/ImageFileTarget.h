@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+#include "RenderTarget.h"
+
+enum class ImageFileFormat
+{
+	None = 0, PPM, PNG, EXR
+};
+
+// Writes presented frames to disk. PPM and PNG get the clamped 8 bit pixels, EXR the averaged HDR samples
+class ImageFileTarget : public RenderTarget
+{
+public:
+	// The format comes from the extension (.ppm, .png or .exr)
+	ImageFileTarget(const std::string& filepath);
+
+	virtual void Present(const FrameView& frame) override;
+
+	ImageFileFormat GetFormat() const { return m_Format; }
+
+	// False if the format is unknown or the last Present could not write the file
+	bool IsValid() const { return m_Valid; }
+private:
+	bool WritePPM(const FrameView& frame) const;
+	bool WritePNG(const FrameView& frame) const;
+	bool WriteEXR(const FrameView& frame) const;
+private:
+	std::string m_Filepath;
+	ImageFileFormat m_Format = ImageFileFormat::None;
+	bool m_Valid = false;
+};
@@ -0,0 +1,526 @@
+#include "Renderer.h"
+#include "ObjLoader.h"
+#include "SceneSerializer.h"
+#include "ImageFileTarget.h"
+#include "Profiler.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Offline renderer, same core as the app but no window, no Vulkan and no ImGui
+
+struct Options
+{
+	std::string ScenePath;
+	std::string SaveScenePath;
+	uint32_t ExtraSpheres = 0;
+	std::vector<std::string> MeshPaths;
+	uint32_t Instances = 0;
+
+	glm::vec3 CameraPosition{ 0.0f, 0.0f, 1.0f };
+	glm::vec3 CameraDirection{ 0.0f, 0.0f, -1.0f };
+	float VerticalFOV = 45.0f;
+
+	uint32_t Width = 1280, Height = 720;
+	uint32_t Bounces = 3;
+	uint32_t Samples = 16;
+	float AdaptiveThreshold = 0.0f;
+	uint32_t Threads = 0;
+	std::string BVHCacheDirectory;
+	bool RayPackets = true;
+	Renderer::IntegratorMode Integrator = Renderer::IntegratorMode::Megakernel;
+	bool SortSecondaryRays = false;
+	Renderer::PrimaryRayMode PrimaryRays = Renderer::PrimaryRayMode::Analytic;
+	SamplerType Sampling = SamplerType::PCG;
+	TonemapSettings Tonemap;
+	Renderer::DebugView View = Renderer::DebugView::None;
+
+	std::string OutputPath = "render.png";
+	std::string TracePath;
+	bool Counters = false;
+	bool Quiet = false;
+};
+
+static void PrintUsage(const char* program)
+{
+	printf(
+		"Usage: %s [options]\n"
+		"  --scene <file>       Text scene (sphere x y z radius r g b per line) or binary .crts scene, the app's default scene otherwise\n"
+		"  --spheres <n>        Adds a grid of n small spheres in front of the camera\n"
+		"  --mesh <file.obj>    Adds a triangle mesh, can be given more than once\n"
+		"  --instances <n>      Places n copies of one block holding a sphere cluster and the --mesh meshes\n"
+		"  --save-scene <file>  Writes the scene (including --spheres) as text or binary .crts before rendering\n"
+		"  --camera <x,y,z>     Camera position (default 0,0,1)\n"
+		"  --look <x,y,z>       Camera direction (default 0,0,-1)\n"
+		"  --fov <degrees>      Vertical field of view (default 45)\n"
+		"  --res <WxH>          Resolution (default 1280x720)\n"
+		"  --bounces <n>        0 - 10 (default 3)\n"
+		"  --samples <n>        Accumulated samples per pixel (default 16)\n"
+		"  --adaptive <error>   Pixels stop sampling below this relative error, e.g. 0.01 (default 0, off)\n"
+		"  --threads <n>        0 uses every hardware thread (default)\n"
+		"  --bvh-cache <dir>    Loads the BVH of large scenes from dir instead of building it, stores it there on a miss\n"
+		"  --no-packets         Trace primary rays one at a time\n"
+		"  --wavefront          Trace bounce by bounce over queues of rays instead of one whole path per pixel\n"
+		"  --sort-rays          Sort the wavefront's reflected rays by origin and direction before tracing them\n"
+		"  --camera-rays        Primary rays from the camera matrices, bit exact with older builds\n"
+		"  --sampler <type>     pcg, sobol (Owen scrambled) or bluenoise, where in its pixel each sample lands (default pcg)\n"
+		"  --tonemap <op>       clamp, reinhard or aces for PPM/PNG (default clamp)\n"
+		"  --exposure <scale>   Applied before tonemapping (default 1)\n"
+		"  --srgb               Encode PPM/PNG with the sRGB curve\n"
+		"  --view <view>        PPM/PNG show samples, tests, nodes, depth or time per pixel instead of the image (default none)\n"
+		"  --trace <file.json>  Records every profiler scope of the render as Chrome trace_event JSON (chrome://tracing)\n"
+		"  --counters           Hardware performance counters of the render (Linux perf_event_open)\n"
+		"  --output <file>      .ppm, .png or .exr (EXR is always linear HDR, default render.png)\n"
+		"  --quiet              Only print errors\n",
+		program);
+}
+
+static bool ParseUInt(const char* text, uint32_t& value)
+{
+	char* end = nullptr;
+	unsigned long result = strtoul(text, &end, 10);
+	if (end == text || *end != '\0')
+		return false;
+
+	value = (uint32_t)result;
+	return true;
+}
+
+static bool ParseVec3(const char* text, glm::vec3& value)
+{
+	return sscanf(text, "%f,%f,%f", &value.x, &value.y, &value.z) == 3;
+}
+
+static bool ParseTonemapOperator(const char* text, TonemapOperator& op)
+{
+	if (strcmp(text, "clamp") == 0) op = TonemapOperator::Clamp;
+	else if (strcmp(text, "reinhard") == 0) op = TonemapOperator::Reinhard;
+	else if (strcmp(text, "aces") == 0) op = TonemapOperator::ACES;
+	else return false;
+
+	return true;
+}
+
+static bool ParseSamplerType(const char* text, SamplerType& type)
+{
+	if (strcmp(text, "pcg") == 0) type = SamplerType::PCG;
+	else if (strcmp(text, "sobol") == 0) type = SamplerType::Sobol;
+	else if (strcmp(text, "bluenoise") == 0) type = SamplerType::BlueNoise;
+	else return false;
+
+	return true;
+}
+
+static bool ParseDebugView(const char* text, Renderer::DebugView& view)
+{
+	if (strcmp(text, "none") == 0) view = Renderer::DebugView::None;
+	else if (strcmp(text, "samples") == 0) view = Renderer::DebugView::SampleCount;
+	else if (strcmp(text, "tests") == 0) view = Renderer::DebugView::IntersectionTests;
+	else if (strcmp(text, "nodes") == 0) view = Renderer::DebugView::NodesVisited;
+	else if (strcmp(text, "depth") == 0) view = Renderer::DebugView::BounceDepth;
+	else if (strcmp(text, "time") == 0) view = Renderer::DebugView::Time;
+	else return false;
+
+	return true;
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+
+		if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0)
+		{
+			PrintUsage(argv[0]);
+			exit(0);
+		}
+
+		if (strcmp(arg, "--no-packets") == 0) { options.RayPackets = false; continue; }
+		if (strcmp(arg, "--wavefront") == 0) { options.Integrator = Renderer::IntegratorMode::Wavefront; continue; }
+		if (strcmp(arg, "--sort-rays") == 0) { options.SortSecondaryRays = true; continue; }
+		if (strcmp(arg, "--camera-rays") == 0) { options.PrimaryRays = Renderer::PrimaryRayMode::Camera; continue; }
+		if (strcmp(arg, "--srgb") == 0) { options.Tonemap.SRGB = true; continue; }
+		if (strcmp(arg, "--counters") == 0) { options.Counters = true; continue; }
+		if (strcmp(arg, "--quiet") == 0) { options.Quiet = true; continue; }
+
+		// Everything else takes a value
+		if (i + 1 >= argc)
+		{
+			fprintf(stderr, "Missing value for %s\n", arg);
+			return false;
+		}
+		const char* value = argv[++i];
+
+		bool valid = true;
+		if (strcmp(arg, "--scene") == 0) options.ScenePath = value;
+		else if (strcmp(arg, "--save-scene") == 0) options.SaveScenePath = value;
+		else if (strcmp(arg, "--spheres") == 0) valid = ParseUInt(value, options.ExtraSpheres);
+		else if (strcmp(arg, "--mesh") == 0) options.MeshPaths.push_back(value);
+		else if (strcmp(arg, "--instances") == 0) valid = ParseUInt(value, options.Instances);
+		else if (strcmp(arg, "--camera") == 0) valid = ParseVec3(value, options.CameraPosition);
+		else if (strcmp(arg, "--look") == 0) valid = ParseVec3(value, options.CameraDirection);
+		else if (strcmp(arg, "--fov") == 0) valid = sscanf(value, "%f", &options.VerticalFOV) == 1;
+		else if (strcmp(arg, "--res") == 0) valid = sscanf(value, "%ux%u", &options.Width, &options.Height) == 2 && options.Width > 0 && options.Height > 0;
+		else if (strcmp(arg, "--bounces") == 0) valid = ParseUInt(value, options.Bounces);
+		else if (strcmp(arg, "--samples") == 0) valid = ParseUInt(value, options.Samples) && options.Samples > 0;
+		else if (strcmp(arg, "--adaptive") == 0) valid = sscanf(value, "%f", &options.AdaptiveThreshold) == 1 && options.AdaptiveThreshold >= 0.0f;
+		else if (strcmp(arg, "--threads") == 0) valid = ParseUInt(value, options.Threads);
+		else if (strcmp(arg, "--bvh-cache") == 0) options.BVHCacheDirectory = value;
+		else if (strcmp(arg, "--exposure") == 0) valid = sscanf(value, "%f", &options.Tonemap.Exposure) == 1;
+		else if (strcmp(arg, "--sampler") == 0) valid = ParseSamplerType(value, options.Sampling);
+		else if (strcmp(arg, "--view") == 0) valid = ParseDebugView(value, options.View);
+		else if (strcmp(arg, "--tonemap") == 0) valid = ParseTonemapOperator(value, options.Tonemap.Operator);
+		else if (strcmp(arg, "--output") == 0) options.OutputPath = value;
+		else if (strcmp(arg, "--trace") == 0) options.TracePath = value;
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", arg);
+			return false;
+		}
+
+		if (!valid)
+		{
+			fprintf(stderr, "Invalid value '%s' for %s\n", value, arg);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void CreateDefaultScene(Scene& scene)
+{
+	{
+		Sphere sphere;
+		sphere.Position = { 0.0f, 0.0f, -4.0f };
+		sphere.Radius = 1.0f;
+		sphere.Albedo = { 1.0f, 0.0f, 1.0f };
+
+		scene.Spheres.push_back(sphere);
+	}
+
+	{
+		Sphere sphere;
+		sphere.Position = { 0.0f, -101.0f, -5.0f };
+		sphere.Radius = 100.0f;
+		sphere.Albedo = { 0.2f, 0.3f, 1.0f };
+
+		scene.Spheres.push_back(sphere);
+	}
+}
+
+static void AddSphereGrid(Scene& scene, uint32_t count)
+{
+	// 40 x 20 layers stacked away from the camera, enough to push the renderer over the BVH threshold
+	for (uint32_t i = 0; i < count; i++)
+	{
+		Sphere sphere;
+		sphere.Position = { (float)(i % 40) - 20.0f, (float)((i / 40) % 20) * 0.8f, -8.0f - (float)(i / 800) };
+		sphere.Radius = 0.3f;
+		sphere.Albedo = { (float)(i % 7) / 6.0f, (float)(i % 5) / 4.0f, (float)(i % 3) / 2.0f };
+
+		scene.Spheres.push_back(sphere);
+	}
+}
+
+static void AddInstanceGrid(Scene& scene, const std::vector<std::shared_ptr<const Mesh>>& meshes, uint32_t count)
+{
+	auto block = std::make_shared<GeometryBlock>();
+	block->Name = "cluster";
+	block->Meshes = meshes;
+
+	// A ring of small spheres around the meshes, so the block has both kinds of bottom level
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		float angle = (float)i / 16.0f * 6.2831853f;
+
+		Sphere sphere;
+		sphere.Position = { glm::cos(angle), 0.3f * glm::sin(angle * 3.0f), glm::sin(angle) };
+		sphere.Radius = 0.15f;
+		sphere.Albedo = { 0.9f, (float)(i % 4) / 3.0f, 0.2f };
+		block->Spheres.push_back(sphere);
+	}
+
+	// Scaled to fit a cell of the grid, whatever size the meshes come in
+	AABB bounds;
+	for (const Sphere& sphere : block->Spheres)
+	{
+		bounds.Grow(sphere.Position - glm::vec3(sphere.Radius));
+		bounds.Grow(sphere.Position + glm::vec3(sphere.Radius));
+	}
+	for (const auto& mesh : meshes)
+	{
+		for (const glm::vec3& position : mesh->Positions)
+			bounds.Grow(position);
+	}
+
+	glm::vec3 extent = bounds.Max - bounds.Min;
+	float scale = 1.0f / glm::max(glm::max(extent.x, extent.y), extent.z);
+
+	uint32_t columns = (uint32_t)std::ceil(std::sqrt((float)count));
+	for (uint32_t i = 0; i < count; i++)
+	{
+		glm::vec3 position((float)(i % columns) - (float)columns * 0.5f, -0.5f, -3.0f - (float)(i / columns));
+
+		Instance instance;
+		instance.Geometry = block;
+		instance.Transform = glm::translate(glm::mat4(1.0f), position);
+		instance.Transform = glm::rotate(instance.Transform, (float)i * 0.7f, glm::vec3(0.0f, 1.0f, 0.0f));
+		instance.Transform = glm::scale(instance.Transform, glm::vec3(scale * 0.8f));
+		instance.Transform = glm::translate(instance.Transform, -bounds.GetCenter());
+		scene.Instances.push_back(instance);
+	}
+}
+
+static void PrintCounters(const PerfCounterStats& counters, uint64_t rays)
+{
+	const PerfCounterValues& frame = counters.Frame;
+	if (frame.IsEmpty())
+	{
+		const char* error = PerfCounters::GetError();
+		printf("Counters unavailable: %s\n", error ? error : "unknown reason");
+		return;
+	}
+
+	printf("Counters:");
+	for (uint32_t i = 0; i < (uint32_t)PerfEvent::Count; i++)
+	{
+		PerfEvent event = (PerfEvent)i;
+		if (frame.IsAvailable(event))
+			printf(" %s %llu (%.2f/ray)", GetPerfEventName(event), (unsigned long long)frame[event], frame[event] / (double)glm::max(rays, (uint64_t)1));
+	}
+	printf("\n");
+
+	if (frame.IsAvailable(PerfEvent::Cycles))
+		printf("IPC %.2f, %.1f%% cache misses\n", frame.GetIPC(), frame.GetCacheMissRate() * 100.0);
+	else if (PerfCounters::GetError())
+		printf("No hardware counters: %s\n", PerfCounters::GetError());
+
+	// Wavefront passes and conversion, the megakernel is only in the totals
+	for (uint32_t i = 0; i < (uint32_t)ProfileStage::Count; i++)
+	{
+		const PerfCounterValues& stage = counters.Stages[i];
+		if (stage.IsEmpty())
+			continue;
+
+		printf("  %-16s", GetProfileStageName((ProfileStage)i));
+		for (uint32_t j = 0; j < (uint32_t)PerfEvent::Count; j++)
+		{
+			PerfEvent event = (PerfEvent)j;
+			if (stage.IsAvailable(event))
+				printf(" %s %llu", GetPerfEventName(event), (unsigned long long)stage[event]);
+		}
+		if (stage.IsAvailable(PerfEvent::Cycles))
+			printf(", IPC %.2f", stage.GetIPC());
+		printf("\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	RT_PROFILE_THREAD("Main");
+
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	auto target = std::make_shared<ImageFileTarget>(options.OutputPath);
+	if (!target->IsValid())
+	{
+		fprintf(stderr, "Unsupported output format %s, use .ppm, .png or .exr\n", options.OutputPath.c_str());
+		return 1;
+	}
+
+	// Created up front, loading meshes runs on its workers too
+	Renderer renderer;
+	renderer.SetThreadCount(options.Threads);
+
+	Scene scene;
+	if (options.ScenePath.empty())
+	{
+		CreateDefaultScene(scene);
+	}
+	else
+	{
+		auto loadStart = std::chrono::steady_clock::now();
+
+		SceneSerializer serializer(scene);
+		serializer.SetThreadPool(&renderer.GetThreadPool());
+		if (!serializer.Deserialize(options.ScenePath))
+			return 1;
+
+		if (!options.Quiet)
+			printf("Loaded %s in %.3fms\n", options.ScenePath.c_str(),
+				std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - loadStart).count());
+	}
+
+	if (options.ExtraSpheres > 0)
+	{
+		// Binary scenes are read only
+		scene.MakeEditable();
+		AddSphereGrid(scene, options.ExtraSpheres);
+	}
+
+	std::vector<std::shared_ptr<const Mesh>> meshes;
+	for (const std::string& meshPath : options.MeshPaths)
+	{
+		auto loadStart = std::chrono::steady_clock::now();
+
+		auto mesh = std::make_shared<Mesh>();
+		ObjLoader loader(*mesh, renderer.GetThreadPool());
+		if (!loader.Load(meshPath))
+			return 1;
+
+		if (!options.Quiet)
+			printf("Loaded %s, %u triangles in %.3fms\n", meshPath.c_str(), mesh->GetTriangleCount(),
+				std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - loadStart).count());
+
+		meshes.push_back(mesh);
+	}
+
+	// Instanced meshes are only placed through the block
+	if (options.Instances > 0)
+		AddInstanceGrid(scene, meshes, options.Instances);
+	else
+		scene.Meshes.insert(scene.Meshes.end(), meshes.begin(), meshes.end());
+
+	if (!options.SaveScenePath.empty())
+	{
+		SceneSerializer serializer(scene);
+		if (!serializer.Serialize(options.SaveScenePath))
+			return 1;
+	}
+
+	Camera camera(options.VerticalFOV, 0.1f, 100.0f);
+	camera.SetRayDirectionCaching(options.PrimaryRays == Renderer::PrimaryRayMode::Camera);
+	camera.OnResize(options.Width, options.Height);
+	camera.SetView(options.CameraPosition, options.CameraDirection);
+
+	renderer.SetBVHCacheDirectory(options.BVHCacheDirectory);
+	renderer.SetBounces(options.Bounces);
+	renderer.GetSettings().RayPackets = options.RayPackets;
+	renderer.GetSettings().Integrator = options.Integrator;
+	renderer.GetSettings().SortSecondaryRays = options.SortSecondaryRays;
+	renderer.GetSettings().PrimaryRays = options.PrimaryRays;
+	renderer.GetSettings().Sampling = options.Sampling;
+	renderer.GetSettings().Tonemap = options.Tonemap;
+	renderer.GetSettings().View = options.View;
+	renderer.GetSettings().AdaptiveThreshold = options.AdaptiveThreshold;
+	renderer.GetSettings().HardwareCounters = options.Counters;
+	renderer.OnResize(options.Width, options.Height);
+
+	if (!options.Quiet)
+		printf("%u spheres, %zu meshes, %zu instances, %ux%u, %u samples, %u bounces, %u threads\n", scene.GetSphereCount(), scene.Meshes.size(),
+			scene.Instances.size(), options.Width, options.Height, options.Samples, options.Bounces, renderer.GetThreadCount());
+
+	TraversalStats total;
+	PerfCounterStats counters;
+#if RT_COUNT_ALLOCATIONS
+	uint64_t allocations = 0;
+	uint32_t frames = 0;
+#endif
+
+#if RT_PROFILE
+	ProfileStageTimes stagesBefore = Profiler::GetStageTimes();
+	if (!options.TracePath.empty())
+		Profiler::BeginCapture();
+#endif
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (uint32_t sample = 0; sample < options.Samples; sample++)
+	{
+		// Adaptive sampling can finish early, once every pixel converged there is nothing left to render
+		if (!renderer.Render(scene, camera))
+			break;
+
+		total += renderer.GetTraversalStats();
+		counters += renderer.GetPerfCounters();
+#if RT_COUNT_ALLOCATIONS
+		allocations += renderer.GetFrameAllocationCount();
+		frames++;
+#endif
+
+		if (!options.Quiet)
+		{
+			printf("\rSample %u/%u", sample + 1, options.Samples);
+			fflush(stdout);
+		}
+	}
+
+	float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+#if RT_PROFILE
+	ProfileStageTimes stages = Profiler::GetStageTimes() - stagesBefore;
+	if (!options.TracePath.empty() && !Profiler::EndCapture(options.TracePath))
+		fprintf(stderr, "Could not write %s\n", options.TracePath.c_str());
+#endif
+
+	// Only the converged frame goes to disk
+	target->Present(renderer.GetFrame());
+	if (!target->IsValid())
+		return 1;
+
+	if (!options.Quiet)
+	{
+		uint64_t fullSamples = (uint64_t)options.Width * options.Height * options.Samples;
+		printf("\r%.3fs, %.2f Mrays/s, %.1f%% of the samples, written to %s\n", seconds, total.Rays / seconds * 1e-6f,
+			total.Samples * 100.0 / (double)fullSamples, options.OutputPath.c_str());
+		printf("Rays: %llu primary, %llu secondary, %llu missed, %.1f nodes and %.1f primitives per ray\n",
+			(unsigned long long)(total.Rays - total.SecondaryRays), (unsigned long long)total.SecondaryRays, (unsigned long long)total.Misses,
+			total.NodesVisited / (double)glm::max(total.Rays, (uint64_t)1), total.PrimitivesTested / (double)glm::max(total.Rays, (uint64_t)1));
+
+		if (total.SecondaryPackets > 0)
+			printf("Secondary packets: %llu, direction coherence %.3f%s\n", (unsigned long long)total.SecondaryPackets,
+				total.DirectionCoherence / (double)total.SecondaryPackets, options.SortSecondaryRays ? " (sorted)" : "");
+
+#if RT_PROFILE
+		// CPU time summed over the threads
+		printf("Stages:");
+		for (uint32_t i = 0; i < (uint32_t)ProfileStage::Count; i++)
+		{
+			if (stages[(ProfileStage)i] > 0.0)
+				printf(" %s %.1fms", GetProfileStageName((ProfileStage)i), stages[(ProfileStage)i]);
+		}
+		printf("\n");
+
+		if (!options.TracePath.empty())
+			printf("Trace written to %s\n", options.TracePath.c_str());
+#endif
+
+		if (options.Counters)
+			PrintCounters(counters, total.Rays);
+
+#if RT_COUNT_ALLOCATIONS
+		// Scratch is sized by the first frames, after that rendering should not touch the heap
+		printf("Heap allocations: %llu over %u frames, %llu in the last\n", (unsigned long long)allocations, frames,
+			(unsigned long long)renderer.GetFrameAllocationCount());
+#endif
+
+		const BVHCacheStats& cache = renderer.GetBVHCacheStats();
+		if (cache.Hits + cache.Misses > 0)
+			printf("BVH cache %s: %u hits, %u misses, last lookup %.3fms (hash %.3fms)\n", options.BVHCacheDirectory.c_str(),
+				cache.Hits, cache.Misses, cache.LoadTime, cache.HashTime);
+		if (renderer.IsBVHActive() && renderer.GetBVHBuildCount() > 0)
+			printf("Sphere BVH built in %.3fms\n", renderer.GetBVH().GetBuildTime());
+
+		const InstanceBVH& instances = renderer.GetInstanceBVH();
+		if (!instances.IsEmpty())
+			printf("Instances: %u of %u blocks, top level %u nodes built in %.3fms\n", instances.GetInstanceCount(), instances.GetGeometryCount(),
+				instances.GetBVH().GetNodeCount(), instances.GetBVH().GetBuildTime());
+	}
+
+	return 0;
+}
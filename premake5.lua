@@ -5,6 +5,22 @@ workspace "CpuRaytracer"
    startproject "CpuRaytracer"
 
 outputdir = "%{cfg.buildcfg}-%{cfg.system}-%{cfg.architecture}"
+
+newoption
+{
+   trigger = "simd",
+   value = "ISA",
+   description = "Instruction set for ray packets (SSE is 4 wide, AVX2 8 wide, AVX-512 16 wide)",
+   allowed =
+   {
+      { "sse", "SSE2, 4 wide packets (default)" },
+      { "avx2", "AVX2, 8 wide packets" },
+      { "avx512", "AVX-512, 16 wide packets" },
+   },
+   default = "sse"
+}
 include "Walnut/WalnutExternal.lua"
 
-include "CpuRaytracerApp"
\ No newline at end of file
+include "CpuRaytracerApp"
+include "CpuRaytracerCLI"
+include "CpuRaytracerBench"
\ No newline at end of file